@@ -225,13 +225,13 @@ CommTracker* CommTracker::runOnGraph(TaskGraph* taskGraph)
                 {
                     case action_type_mem_write:
                     {
-                        tracker->addWrite(mem.addr, 1 << mem.pow_size, uid, bbId, pos++);
+                        tracker->addWrite(mem.addr, ff.getAccessSize(), uid, bbId, pos++);
                         break;
                     }
 
                     case action_type_mem_read:
                     {
-                        tracker->addRead(mem.addr, 1 << mem.pow_size, uid, bbId, pos++);
+                        tracker->addRead(mem.addr, ff.getAccessSize(), uid, bbId, pos++);
                         break;
                     }
 
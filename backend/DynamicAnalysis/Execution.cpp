@@ -32,6 +32,14 @@ using namespace boost;
 
 static DynamicAnalysis* Analyzer;
 
+// A range stands for several loads or stores of unknown sizes, which cannot be
+//   matched to the instructions of the block
+static MemoryAction instructionMemOp(MemoryAction ma)
+{
+    if (ma.is_range) report_fatal_error("Task graphs with range actions (middle -r) cannot be matched to instructions");
+    return ma;
+}
+
 #ifdef READ_BOTTLENECK
 static DynamicAnalysis* RelaxAnalyzer;
 #endif
@@ -527,13 +535,13 @@ bool EnginePass::runOnModule(Module &M)
                             
                             if (LoadInst *li = dyn_cast<LoadInst>(&*it))
                             {
-                                MemoryAction ma = *iMemOps;
+                                MemoryAction ma = instructionMemOp(*iMemOps);
                                 addr = ma.addr;
                                 ++iMemOps;
                             }
                             else if (StoreInst *si = dyn_cast<StoreInst>(&*it))
                             {
-                                MemoryAction ma = *iMemOps;
+                                MemoryAction ma = instructionMemOp(*iMemOps);
                                 addr = ma.addr;
                                 ++iMemOps;
                             }
@@ -671,13 +679,13 @@ bool EnginePass::runOnModule(Module &M)
                             
                             if (LoadInst *li = dyn_cast<LoadInst>(&*it))
                             {
-                                MemoryAction ma = *iMemOps;
+                                MemoryAction ma = instructionMemOp(*iMemOps);
                                 addr = ma.addr;
                                 ++iMemOps;
                             }
                             else if (StoreInst *si = dyn_cast<StoreInst>(&*it))
                             {
-                                MemoryAction ma = *iMemOps;
+                                MemoryAction ma = instructionMemOp(*iMemOps);
                                 addr = ma.addr;
                                 ++iMemOps;
                             }
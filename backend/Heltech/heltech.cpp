@@ -177,9 +177,11 @@ void hbRaceDetector(FILE* taskGraphIn)
             int memOpIndex = 0;
             uint64_t mallocAddr = 0;
             
-            for (MemoryAction bMop : f.getMemoryActions())
+            auto memActs = f.getMemoryActions();
+            for (auto iMop = memActs.begin(), eMop = memActs.end(); iMop != eMop; ++iMop)
             {
-                unsigned int nBytes = (0x1 << bMop.pow_size);
+                MemoryAction bMop = *iMop;
+                unsigned int nBytes = iMop.getAccessSize();
                 bool isRaceAccess = false;
                 
                 if (bMop.type == action_type_malloc)
@@ -123,7 +123,7 @@ void BackendMemUse::updateBackend(contech::Task* t)
                 // Read or write
                 uint64_t addr = ((MemoryAction)(*it)).addr;
                 
-                uint64_t size = 0x1 << ((MemoryAction)(*it)).pow_size;
+                uint64_t size = it.getAccessSize();
 
                 // Is addr in a known allocation
                 //   Does it overlap with 
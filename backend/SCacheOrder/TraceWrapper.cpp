@@ -129,9 +129,16 @@ int TraceWrapper::populateQueue()
                     MemoryAction ma = *iReq;
                     
                 
-                    if (ma.type == action_type_mem_read || action_type_mem_write)
+                    if (ma.type == action_type_mem_read || ma.type == action_type_mem_write)
                     {
-                        // Nothing special
+                        // The iterator skips the size action of a range, so its length
+                        //   is queued as a size action after it
+                        if (ma.is_range)
+                        {
+                            tReq.mav.push_back(ma);
+                            pushedOps++;
+                            ma = MemoryAction(iReq.getAccessSize(), 0, action_type_size);
+                        }
                     }
                     else if (ma.type == action_type_memcpy)
                     {
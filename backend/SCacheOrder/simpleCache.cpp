@@ -257,8 +257,16 @@ void SimpleCacheBackend::updateBackend(MemReqContainer& mrc)
             continue;
         }
         
-        char numOfBytes = (0x1 << ma.pow_size);
+        uint64_t numOfBytes = (0x1 << ma.pow_size);
         uint64_t address = ma.addr;
+        
+        // TraceWrapper queues a range's length as the size action after it
+        if (ma.is_range)
+        {
+            ++iReq;
+            assert((*iReq).type == action_type_size);
+            numOfBytes = (*iReq).addr;
+        }
         char accessBytes = 0;
         
         do {
@@ -385,7 +393,7 @@ void SimpleCacheBackend::updateBackend(Task* currentTask)
                 continue;
             }
             
-            char numOfBytes = (0x1 << ma.pow_size);
+            uint64_t numOfBytes = iReq.getAccessSize();
             uint64_t address = ma.addr;
             char accessBytes = 0;
             
@@ -232,7 +232,7 @@ void SimpleCacheBackend::updateBackend(Task* currentTask)
                 continue;
             }
             
-            char numOfBytes = (0x1 << ma.pow_size);
+            uint64_t numOfBytes = iReq.getAccessSize();
             uint64_t address = ma.addr;
             char accessBytes = 0;
             
@@ -107,13 +107,15 @@ int main(int argc, char const *argv[])
 
                     uint memOpsInBlock = 0;
                     // Note that memory actions include malloc, etc
-                    for (MemoryAction mem : f.getMemoryActions())
+                    auto memActs = f.getMemoryActions();
+                    for (auto im = memActs.begin(), em = memActs.end(); im != em; ++im)
                     {
+                        MemoryAction mem = *im;
                         totalMemOps++;
                         memOpsInTask++;
                         memOpsInBlock++;
                         if (mem.type == action_type_mem_read || mem.type == action_type_mem_write)
-                            totalMemBytes += (0x1 << mem.pow_size);
+                            totalMemBytes += im.getAccessSize();
                     }
 
                     maxMemOpsPerBasicBlock = max(maxMemOpsPerBasicBlock, memOpsInBlock);
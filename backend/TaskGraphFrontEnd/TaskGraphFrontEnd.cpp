@@ -3,6 +3,18 @@
 using namespace std;
 using namespace contech;
 
+// A range stands for several memOps of unknown sizes, which cannot be matched to
+//   the instructions of the marked code
+static MemoryAction instructionMemOp(MemoryAction a)
+{
+    if (a.is_range)
+    {
+        cerr << "Error: Task graphs with range actions (middle -r) cannot be matched to marked code" << endl;
+        exit(1);
+    }
+    return a;
+}
+
 IFrontEnd* createTaskGraphFrontEnd(std::string basename, unsigned int cpuId)
 {
     return new TaskGraphFrontEnd(basename, cpuId);
@@ -76,7 +88,7 @@ bool TaskGraphFrontEnd::getNextInstruction(IFrontEnd::Instruction& inst)
     {
         if (currentMemOp != memOpsInBlock.end())
         {
-            MemoryAction a = *currentMemOp;
+            MemoryAction a = instructionMemOp(*currentMemOp);
             if (a.type == action_type_mem_read)
             {
                 inst.readAddr[0] = a.addr;
@@ -90,7 +102,7 @@ bool TaskGraphFrontEnd::getNextInstruction(IFrontEnd::Instruction& inst)
     {
         if (currentMemOp != memOpsInBlock.end())
         {
-            MemoryAction a = *currentMemOp;
+            MemoryAction a = instructionMemOp(*currentMemOp);
             if (a.type == action_type_mem_write)
             {
                 inst.writeAddr[0] = a.addr;
@@ -111,7 +123,7 @@ bool TaskGraphFrontEnd::getNextInstruction(IFrontEnd::Instruction& inst)
         assert(readsRemaining <= 2 && writesRemaining <= 2);
         while ((readsRemaining > 0 || writesRemaining > 0) && currentMemOp != memOpsInBlock.end())
         {
-            MemoryAction a = *currentMemOp++;
+            MemoryAction a = instructionMemOp(*currentMemOp++);
             if (a.type == action_type_mem_read)
             {
                 inst.readAddr[currentInstruction->reads - readsRemaining] = a.addr;
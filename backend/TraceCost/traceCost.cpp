@@ -0,0 +1,282 @@
+#include "../../common/eventLib/ct_event.h"
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace contech;
+
+//
+// Bytes of the trace attributed to one key of a breakdown
+//
+struct cost
+{
+    uint64_t events;
+    uint64_t bytes;
+    uint64_t memOpBytes;   // Addresses of memory ops, the rest is control
+    cost() : events(0), bytes(0), memOpBytes(0) {}
+};
+
+struct block_name
+{
+    string function;
+    string file;
+    uint32_t line;
+};
+
+typedef map<string, cost> breakdown;
+
+static const char* eventTypeName(unsigned int t)
+{
+    switch (t)
+    {
+        case ct_event_basic_block: return "basic_block";
+        case ct_event_basic_block_info: return "basic_block_info";
+        case ct_event_memory: return "memory";
+        case ct_event_sync: return "sync";
+        case ct_event_barrier: return "barrier";
+        case ct_event_task_create: return "task_create";
+        case ct_event_task_join: return "task_join";
+        case ct_event_buffer: return "buffer";
+        case ct_event_bulk_memory_op: return "bulk_memory_op";
+        case ct_event_version: return "version";
+        case ct_event_delay: return "delay";
+        case ct_event_rank: return "rank";
+        case ct_event_mpi_transfer: return "mpi_transfer";
+        case ct_event_mpi_wait: return "mpi_wait";
+        case ct_event_roi: return "roi";
+        case ct_event_gv_info: return "gv_info";
+        case ct_event_loop: return "loop";
+        default: return "unknown";
+    }
+}
+
+// CSV fields are quoted with any quotes doubled
+static string csvField(const string& s)
+{
+    string r = "\"";
+    for (auto it = s.begin(), et = s.end(); it != et; ++it)
+    {
+        if (*it == '"') r += '"';
+        r += *it;
+    }
+    return r + "\"";
+}
+
+static string jsonString(const string& s)
+{
+    string r = "\"";
+    for (auto it = s.begin(), et = s.end(); it != et; ++it)
+    {
+        if (*it == '"' || *it == '\\') r += '\\';
+        if ((unsigned char)*it < 0x20) continue;
+        r += *it;
+    }
+    return r + "\"";
+}
+
+static bool byBytes(const pair<string, cost>& a, const pair<string, cost>& b)
+{
+    return (a.second.bytes > b.second.bytes) ||
+           (a.second.bytes == b.second.bytes && a.first < b.first);
+}
+
+static vector<pair<string, cost> > sortedRows(const breakdown& bd)
+{
+    vector<pair<string, cost> > rows(bd.begin(), bd.end());
+    sort(rows.begin(), rows.end(), byBytes);
+    return rows;
+}
+
+static void printCSV(const char* level, const breakdown& bd, uint64_t total)
+{
+    vector<pair<string, cost> > rows = sortedRows(bd);
+    for (auto it = rows.begin(), et = rows.end(); it != et; ++it)
+    {
+        const cost& c = it->second;
+        printf("%s,%s,%lu,%lu,%lu,%lu,%.4f\n", level, csvField(it->first).c_str(),
+                                               c.events, c.bytes, c.memOpBytes, c.bytes - c.memOpBytes,
+                                               (total > 0) ? (100.0 * c.bytes / total) : 0.0);
+    }
+}
+
+static void printJSON(const char* level, const breakdown& bd, uint64_t total, bool last)
+{
+    vector<pair<string, cost> > rows = sortedRows(bd);
+    printf("  \"%s\": [\n", level);
+    for (auto it = rows.begin(), et = rows.end(); it != et; ++it)
+    {
+        const cost& c = it->second;
+        printf("    {\"name\": %s, \"events\": %lu, \"bytes\": %lu, \"memop_bytes\": %lu, \"control_bytes\": %lu, \"percent\": %.4f}%s\n",
+               jsonString(it->first).c_str(), c.events, c.bytes, c.memOpBytes, c.bytes - c.memOpBytes,
+               (total > 0) ? (100.0 * c.bytes / total) : 0.0,
+               (it + 1 == et) ? "" : ",");
+    }
+    printf("  ]%s\n", last ? "" : ",");
+}
+
+//
+// Attribute the bytes of a trace to event types, basic blocks, functions, source files
+//   and contechs, splitting the bytes of basic blocks between memory op addresses
+//   and control.
+//
+int main(int argc, char* argv[])
+{
+    bool json = false;
+    const char* only = NULL;
+    const char* levels[] = {"type", "block", "function", "file", "context"};
+    const unsigned int numLevels = sizeof(levels) / sizeof(levels[0]);
+
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <event trace> [-j] [-l <level>]" << endl;
+        cerr << "\t-j Print JSON instead of CSV" << endl;
+        cerr << "\t-l Print only one of type, block, function, file or context" << endl;
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-j"))
+        {
+            json = true;
+        }
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+        {
+            only = argv[++i];
+            bool valid = false;
+            for (unsigned int l = 0; l < numLevels; l++)
+            {
+                if (!strcmp(only, levels[l])) valid = true;
+            }
+            if (!valid)
+            {
+                cerr << "Unknown level: " << only << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            cerr << "Unknown option: " << argv[i] << endl;
+            return 1;
+        }
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        cerr << "ERROR: Couldn't open input file: " << argv[1] << endl;
+        return 1;
+    }
+
+    EventLib el;
+    EventArena* arena = new EventArena;
+    vector<cost> typeCost(ct_event_unknown + 1);
+    vector<cost> blockCost;
+    vector<block_name> blockName;
+    map<unsigned int, cost> contechCost;
+
+    uint64_t pos = el.getSum();
+    while (pct_event e = el.createContechEvent(in, arena))
+    {
+        uint64_t bytes = el.getSum() - pos;
+        pos = el.getSum();
+
+        unsigned int t = (e->event_type < ct_event_unknown) ? e->event_type : ct_event_unknown;
+        typeCost[t].events++;
+        typeCost[t].bytes += bytes;
+
+        if (e->event_type == ct_event_basic_block)
+        {
+            uint32_t id = e->bb.basic_block_id;
+            uint64_t memOpBytes = el.getLastMemOpBytes();
+
+            if (id >= blockCost.size()) blockCost.resize(id + 1);
+            blockCost[id].events++;
+            blockCost[id].bytes += bytes;
+            blockCost[id].memOpBytes += memOpBytes;
+            typeCost[t].memOpBytes += memOpBytes;
+
+            cost& c = contechCost[e->contech_id];
+            c.events++;
+            c.bytes += bytes;
+            c.memOpBytes += memOpBytes;
+        }
+        else if (e->event_type == ct_event_basic_block_info)
+        {
+            uint32_t id = e->bbi.basic_block_id;
+            if (id >= blockName.size()) blockName.resize(id + 1);
+            blockName[id].function = (e->bbi.fun_name != NULL) ? e->bbi.fun_name : "";
+            blockName[id].file = (e->bbi.file_name != NULL) ? e->bbi.file_name : "";
+            blockName[id].line = e->bbi.line_num;
+        }
+        // Header events belong to no contech
+        else if (e->event_type != ct_event_version &&
+                 e->event_type != ct_event_rank &&
+                 e->event_type != ct_event_gv_info)
+        {
+            cost& c = contechCost[e->contech_id];
+            c.events++;
+            c.bytes += bytes;
+        }
+
+        EventLib::deleteContechEvent(e);
+    }
+    uint64_t total = el.getSum();
+    fclose(in);
+
+    // Roll the blocks up to their functions and files
+    breakdown bd[numLevels];
+    for (unsigned int i = 0; i <= ct_event_unknown; i++)
+    {
+        if (typeCost[i].events > 0) bd[0][eventTypeName(i)] = typeCost[i];
+    }
+    if (blockName.size() < blockCost.size()) blockName.resize(blockCost.size());
+    for (size_t i = 0; i < blockCost.size(); i++)
+    {
+        if (blockCost[i].events == 0) continue;
+        const block_name& bn = blockName[i];
+
+        bd[1][to_string(i) + ":" + bn.function + ":" + bn.file + ":" + to_string(bn.line)] = blockCost[i];
+
+        cost& f = bd[2][bn.function];
+        f.events += blockCost[i].events;
+        f.bytes += blockCost[i].bytes;
+        f.memOpBytes += blockCost[i].memOpBytes;
+
+        cost& s = bd[3][bn.file];
+        s.events += blockCost[i].events;
+        s.bytes += blockCost[i].bytes;
+        s.memOpBytes += blockCost[i].memOpBytes;
+    }
+    for (auto it = contechCost.begin(), et = contechCost.end(); it != et; ++it)
+    {
+        bd[4][to_string(it->first)] = it->second;
+    }
+
+    if (json)
+    {
+        printf("{\n  \"trace\": %s,\n  \"bytes\": %lu,\n", jsonString(argv[1]).c_str(), total);
+        for (unsigned int l = 0; l < numLevels; l++)
+        {
+            if (only != NULL && strcmp(only, levels[l])) continue;
+            printJSON(levels[l], bd[l], total, (only != NULL) || (l + 1 == numLevels));
+        }
+        printf("}\n");
+    }
+    else
+    {
+        printf("level,name,events,bytes,memop_bytes,control_bytes,percent\n");
+        for (unsigned int l = 0; l < numLevels; l++)
+        {
+            if (only != NULL && strcmp(only, levels[l])) continue;
+            printCSV(levels[l], bd[l], total);
+        }
+    }
+
+    arena->detach();
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "../../common/eventLib/ct_event.h"
+#include "../../common/eventLib/ct_index.h"
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <set>
+
+using namespace std;
+using namespace contech;
+
+//
+// Build or load the sidecar index of a trace, and optionally decode only the chunks
+//   of a time window or of a subset of contechs.
+//
+int main(int argc, char* argv[])
+{
+    bool rebuild = false;
+    bool window = false;
+    ct_tsc_t t0 = 0, t1 = ~0ULL;
+    set<unsigned int> contechs;
+
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <event trace> [-b] [-w <start> <end>] [-c <contech>]*" << endl;
+        cerr << "\t-b Rebuild the index even if the sidecar exists" << endl;
+        cerr << "\t-w Decode only the chunks covering these times" << endl;
+        cerr << "\t-c Decode only the chunks of this contech" << endl;
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-b"))
+        {
+            rebuild = true;
+        }
+        else if (!strcmp(argv[i], "-w") && i + 2 < argc)
+        {
+            window = true;
+            t0 = strtoull(argv[i + 1], NULL, 10);
+            t1 = strtoull(argv[i + 2], NULL, 10);
+            i += 2;
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            contechs.insert(strtoul(argv[i + 1], NULL, 10));
+            i++;
+        }
+        else
+        {
+            cerr << "Unknown option: " << argv[i] << endl;
+            return 1;
+        }
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        cerr << "ERROR: Couldn't open input file: " << argv[1] << endl;
+        return 1;
+    }
+
+    TraceIndex index;
+    string sidecar = TraceIndex::sidecarName(argv[1]);
+    if (rebuild || !index.read(sidecar.c_str()) || !index.matches(in))
+    {
+        cerr << "Building index of " << argv[1] << endl;
+        index.build(in);
+        index.write(sidecar.c_str());
+        rewind(in);
+    }
+
+    size_t resumable = 0;
+    for (auto it = index.chunks.begin(), et = index.chunks.end(); it != et; ++it)
+    {
+        if (it->resumable) resumable++;
+    }
+    cout << "Chunks: " << index.chunks.size() << "\tResumable: " << resumable;
+    cout << "\tHeader bytes: " << index.headerLen << "\tTrace bytes: " << index.traceLen << endl;
+
+    if (!window && contechs.empty()) return 0;
+
+    size_t first = 0, end = index.chunks.size();
+    if (window) index.getTimeWindow(t0, t1, &first, &end);
+    cout << "Decoding chunks " << first << " to " << end << endl;
+
+    // Read the header for the block info, then seek to each selected chunk
+    EventLib el;
+    map<unsigned int, uint64_t> typeCount;
+    uint64_t headerEvents = 0;
+    while (!(el.isInputMapped(in) && el.nextIsChunk()))
+    {
+        pct_event e = el.createContechEvent(in);
+        if (e == NULL) break;
+        headerEvents++;
+        EventLib::deleteContechEvent(e);
+    }
+    if (!el.isInputMapped(in))
+    {
+        cerr << "ERROR: Trace must be a regular file to seek" << endl;
+        return 1;
+    }
+
+    for (size_t i = first; i < end; i++)
+    {
+        if (!contechs.empty() && contechs.count(index.chunks[i].contech_id) == 0) continue;
+
+        el.seekInput(in, index.chunks[i].offset);
+        pct_event e = el.createContechEvent(in);
+        EventLib::deleteContechEvent(e);
+        while (!el.nextIsChunk() && (e = el.createContechEvent(in)) != NULL)
+        {
+            typeCount[e->event_type]++;
+            EventLib::deleteContechEvent(e);
+        }
+    }
+
+    cout << "Header events: " << headerEvents << endl;
+    for (auto it = typeCount.begin(), et = typeCount.end(); it != et; ++it)
+    {
+        cout << "Type " << it->first << ":\t" << it->second << endl;
+    }
+
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,700 @@
+#include "../../common/eventLib/ct_event.h"
+#include "../../common/eventLib/ct_index.h"
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace contech;
+
+// Size of the buffer event that starts each chunk: type, contech id, length
+#define CT_CHUNK_HEADER 12
+// Offset of the version in the version event that starts a trace: contech id, type, version
+#define CT_VERSION_POS 8
+// Since version 5, an event's type is followed by 3 bytes of padding instead of 7
+#define CT_SHORT_PAD_VERSION 5
+
+//
+// One trace to write: the header of the input, then the selected chunks in trace order
+//
+struct split_output
+{
+    string name;
+    vector<size_t> chunks;
+    uint64_t bytes;
+    bool failed;
+};
+
+//
+// A change to one event of a filtered trace.  Either the event at offset is dropped,
+//   or the field at offset is overwritten with value.
+//
+struct event_edit
+{
+    uint64_t offset;    // In the input
+    uint32_t len;       // Of the dropped event, 0 if the field is overwritten
+    uint32_t size;      // Of the overwritten field
+    uint64_t value;
+};
+
+//
+// A create, join, sync or barrier event of a filtered trace
+//
+struct control_event
+{
+    uint64_t offset, end;   // Bytes of the event in the input
+    ct_event_id type;
+    unsigned int contech_id;
+    unsigned int other_id;
+    bool child;             // Create recorded by the created contech, or an exit
+    uint64_t num;           // Ticket or barrier number
+};
+
+struct split_job
+{
+    int fd;
+    const char* trace;
+    unsigned int version;
+    bool filtered;
+    const TraceIndex* index;
+    vector<split_output>* outputs;
+    size_t nextOutput;
+    pthread_mutex_t lock;
+};
+
+static bool readRange(int fd, uint64_t offset, uint64_t len, vector<uint8_t>& buf)
+{
+    if (buf.size() < len) buf.resize(len);
+    uint64_t pos = 0;
+    while (pos < len)
+    {
+        ssize_t r = pread(fd, buf.data() + pos, len - pos, offset + pos);
+        if (r <= 0) return false;
+        pos += r;
+    }
+    return true;
+}
+
+static bool copyRange(int fd, uint64_t offset, uint64_t len, FILE* out, vector<uint8_t>& buf)
+{
+    if (!readRange(fd, offset, len, buf)) return false;
+    return (fwrite(buf.data(), 1, len, out) == len);
+}
+
+// Fields are stored little endian, as EventLib unpacks them
+static void putField(uint8_t* p, uint64_t v, unsigned int size)
+{
+    for (unsigned int i = 0; i < size; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void appendField(vector<uint8_t>& b, uint64_t v, unsigned int size)
+{
+    b.resize(b.size() + size);
+    putField(b.data() + b.size() - size, v, size);
+}
+
+static void appendChunkHeader(vector<uint8_t>& b, unsigned int ctid, uint32_t len)
+{
+    appendField(b, ct_event_buffer, 4);
+    appendField(b, ctid, 4);
+    appendField(b, len, 4);
+}
+
+static void appendCreate(vector<uint8_t>& b, unsigned int version, ct_tsc_t start, ct_tsc_t end,
+                         unsigned int other, uint64_t skew)
+{
+    b.push_back(ct_event_task_create);
+    b.resize(b.size() + ((version < CT_SHORT_PAD_VERSION) ? 7 : 3), 0);
+    appendField(b, start, 8);
+    appendField(b, end, 8);
+    appendField(b, other, 4);
+    appendField(b, skew, 8);
+}
+
+static void appendJoin(vector<uint8_t>& b, unsigned int version, ct_tsc_t start, ct_tsc_t end,
+                       unsigned int other)
+{
+    b.push_back(ct_event_task_join);
+    b.resize(b.size() + ((version < CT_SHORT_PAD_VERSION) ? 7 : 3), 0);
+    b.push_back(0);
+    appendField(b, start, 8);
+    appendField(b, end, 8);
+    appendField(b, other, 4);
+}
+
+// Bytes of a create and a join event
+static uint32_t createSize(unsigned int version)
+{
+    return ((version < CT_SHORT_PAD_VERSION) ? 8 : 4) + 28;
+}
+
+static uint32_t joinSize(unsigned int version)
+{
+    return ((version < CT_SHORT_PAD_VERSION) ? 8 : 4) + 21;
+}
+
+//
+// Plan a filtered output so that it remains an input to middle:
+//   - tickets and barrier numbers are renumbered to start at 0 without gaps
+//   - a contech whose creator is not in the output is created by contech 0, which is
+//     created at the start of the output, before the first event of any contech, and
+//     joins it at the end of the output unless another contech does
+//   - creates and joins of the contechs that are not in the output are dropped
+//   The events that the output needs are in prologue and epilogue, which precede and
+//   follow the chunks.
+//
+static bool planFilteredOutput(const split_job* job, const split_output& o, vector<uint8_t>& prologue,
+                               vector<uint8_t>& epilogue, vector<event_edit>& edits)
+{
+    const TraceIndex* index = job->index;
+    vector<control_event> events;
+    set<unsigned int> present;
+    map<unsigned int, unsigned int> creatorOf, startedBy;   // Of each created contech
+    vector<uint64_t> tickets, barriers;
+    set<unsigned int> joined;
+    bool haveFirstCreate = false;
+    ct_tsc_t firstStart = 0, firstEnd = 0, minTime = ~0ULL, maxTime = 0;
+
+    if (job->version == 0)
+    {
+        fprintf(stderr, "ERROR: Traces of version 0 cannot be filtered\n");
+        return false;
+    }
+
+    FILE* in = fopen(job->trace, "rb");
+    if (in == NULL)
+    {
+        fprintf(stderr, "ERROR: Couldn't open input file: %s\n", job->trace);
+        return false;
+    }
+
+    EventLib el;
+    el.setSkipMemOps(true);
+    if (!el.isInputMapped(in))
+    {
+        fprintf(stderr, "ERROR: Couldn't map %s\n", job->trace);
+        fclose(in);
+        return false;
+    }
+    while (!el.nextIsChunk())
+    {
+        pct_event e = el.createContechEvent(in);
+        if (e == NULL) break;
+        EventLib::deleteContechEvent(e);
+    }
+
+    // Each chunk decodes from the header alone, and the loops of a contech are in its chunks
+    present.insert(0);
+    bool mpi = false;
+    for (auto it = o.chunks.begin(), et = o.chunks.end(); it != et && !mpi; ++it)
+    {
+        const TraceIndex::trace_chunk& c = index->chunks[*it];
+        uint64_t chunkEnd = c.offset + CT_CHUNK_HEADER + c.len;
+        present.insert(c.contech_id);
+        if (c.firstTime != 0 && c.firstTime < minTime) minTime = c.firstTime;
+        if (c.lastTime > maxTime) maxTime = c.lastTime;
+
+        el.seekInput(in, c.offset);
+        while (el.getSum() < chunkEnd)
+        {
+            uint64_t offset = el.getSum();
+            pct_event e = el.createContechEvent(in);
+            if (e == NULL) break;
+
+            control_event ce;
+            ce.offset = offset;
+            ce.end = el.getSum();
+            ce.type = e->event_type;
+            ce.contech_id = e->contech_id;
+            ce.other_id = 0;
+            ce.child = false;
+            ce.num = 0;
+            switch (e->event_type)
+            {
+                case ct_event_task_create:
+                {
+                    ce.other_id = e->tc.other_id;
+                    ce.child = (e->tc.approx_skew != 0);
+                    if (ce.child) startedBy[ce.contech_id] = ce.other_id;
+                    else if (ce.other_id != 0 && ce.other_id != ce.contech_id) creatorOf[ce.other_id] = ce.contech_id;
+                    else if (ce.other_id == 0 && ce.contech_id == 0 && !haveFirstCreate)
+                    {
+                        haveFirstCreate = true;
+                        firstStart = e->tc.start_time;
+                        firstEnd = e->tc.end_time;
+                    }
+                    events.push_back(ce);
+                }
+                break;
+                case ct_event_task_join:
+                {
+                    ce.other_id = e->tj.other_id;
+                    ce.child = e->tj.isExit;
+                    events.push_back(ce);
+                }
+                break;
+                case ct_event_sync:
+                {
+                    ce.num = e->sy.ticketNum;
+                    tickets.push_back(ce.num);
+                    events.push_back(ce);
+                }
+                break;
+                case ct_event_barrier:
+                {
+                    ce.num = e->bar.barrierNum;
+                    barriers.push_back(ce.num);
+                    events.push_back(ce);
+                }
+                break;
+                case ct_event_mpi_transfer:
+                case ct_event_mpi_wait:
+                    mpi = true;
+                break;
+                default:
+                break;
+            }
+            EventLib::deleteContechEvent(e);
+        }
+    }
+    fclose(in);
+
+    // The traces of the other ranks would still match transfers with the dropped events
+    if (mpi)
+    {
+        fprintf(stderr, "ERROR: Couldn't write %s, a trace with MPI events can only be split by rank\n",
+                o.name.c_str());
+        return false;
+    }
+
+    sort(tickets.begin(), tickets.end());
+    tickets.erase(unique(tickets.begin(), tickets.end()), tickets.end());
+    sort(barriers.begin(), barriers.end());
+    barriers.erase(unique(barriers.begin(), barriers.end()), barriers.end());
+
+    // Contech 0 starts when it did in the input, as the created contechs' times are offset
+    //   from it.  Unless its first create is kept, the contechs that it creates start just
+    //   before the first event of the output.
+    ct_tsc_t t = firstStart, tc = firstEnd;
+    if (!haveFirstCreate)
+    {
+        t = (index->chunks.empty()) ? 0 : index->chunks[0].firstTime;
+        if (minTime != ~0ULL && t + 2 > minTime) t = (minTime > 2) ? minTime - 2 : 0;
+        firstEnd = t;
+        tc = (minTime != ~0ULL) ? max(t, minTime - 2) : t;
+    }
+    vector<unsigned int> adopted;
+
+    for (auto it = events.begin(), et = events.end(); it != et; ++it)
+    {
+        event_edit ed;
+        ed.offset = it->offset;
+        ed.len = 0;
+        ed.size = 0;
+        ed.value = 0;
+        switch (it->type)
+        {
+            case ct_event_sync:
+            case ct_event_barrier:
+            {
+                vector<uint64_t>& nums = (it->type == ct_event_sync) ? tickets : barriers;
+                ed.value = lower_bound(nums.begin(), nums.end(), it->num) - nums.begin();
+                if (ed.value == it->num) continue;
+                ed.offset = it->end - 8;
+                ed.size = 8;
+            }
+            break;
+            case ct_event_task_create:
+            {
+                if (it->child)
+                {
+                    // The created contech names its creator before the skew
+                    auto cit = creatorOf.find(it->contech_id);
+                    if (cit != creatorOf.end() && cit->second == it->other_id) continue;
+                    adopted.push_back(it->contech_id);
+                    if (it->other_id == 0) continue;
+                    ed.offset = it->end - 12;
+                    ed.size = 4;
+                }
+                else if (it->other_id == 0 && it->contech_id == 0)
+                {
+                    // Replaced by the first create in the prologue
+                    ed.len = it->end - it->offset;
+                }
+                else
+                {
+                    auto sit = startedBy.find(it->other_id);
+                    if (sit != startedBy.end() && sit->second == it->contech_id) continue;
+                    if (it->other_id == it->contech_id) continue;
+                    ed.len = it->end - it->offset;
+                }
+            }
+            break;
+            case ct_event_task_join:
+            {
+                if (present.count(it->other_id) != 0)
+                {
+                    if (!it->child) joined.insert(it->other_id);
+                    continue;
+                }
+                if (it->child)
+                {
+                    // An exit to a creator that is not in the output goes to contech 0
+                    ed.offset = it->end - 4;
+                    ed.size = 4;
+                }
+                else
+                {
+                    ed.len = it->end - it->offset;
+                }
+            }
+            break;
+            default:
+                continue;
+        }
+        edits.push_back(ed);
+    }
+
+    // The contechs that started before the output are created at its start
+    vector<unsigned int> started;
+    for (auto it = present.begin(), et = present.end(); it != et; ++it)
+    {
+        if (*it == 0 || startedBy.count(*it) != 0) continue;
+        adopted.push_back(*it);
+        started.push_back(*it);
+    }
+
+    appendChunkHeader(prologue, 0, (1 + adopted.size()) * createSize(job->version));
+    appendCreate(prologue, job->version, t, firstEnd, 0, 0);
+    for (auto it = adopted.begin(), et = adopted.end(); it != et; ++it)
+    {
+        appendCreate(prologue, job->version, tc, tc, *it, 0);
+    }
+    for (auto it = started.begin(), et = started.end(); it != et; ++it)
+    {
+        appendChunkHeader(prologue, *it, createSize(job->version));
+        appendCreate(prologue, job->version, tc + 1, tc + 1, 0, 1);
+    }
+
+    // Joining also gives the create task of contech 0 a continuation
+    vector<unsigned int> unjoined;
+    for (auto it = adopted.begin(), et = adopted.end(); it != et; ++it)
+    {
+        if (joined.count(*it) == 0) unjoined.push_back(*it);
+    }
+    if (!unjoined.empty())
+    {
+        ct_tsc_t tj = max(maxTime, tc + 1) + 1;
+        appendChunkHeader(epilogue, 0, unjoined.size() * joinSize(job->version));
+        for (auto it = unjoined.begin(), et = unjoined.end(); it != et; ++it)
+        {
+            appendJoin(epilogue, job->version, tj, tj, *it);
+        }
+    }
+
+    return true;
+}
+
+//
+// Copy a chunk, applying the edits from edits[*nextEdit] that fall in it
+//
+static bool copyChunk(int fd, const TraceIndex::trace_chunk& c, const vector<event_edit>& edits,
+                      size_t* nextEdit, FILE* out, vector<uint8_t>& buf, uint64_t* bytes)
+{
+    uint64_t len = CT_CHUNK_HEADER + c.len;
+    if (!readRange(fd, c.offset, len, buf)) return false;
+
+    // Dropped events are squeezed out by moving the rest of the chunk down
+    uint64_t kept = 0, pos = 0;
+    size_t i = *nextEdit;
+    for (; i < edits.size() && edits[i].offset < c.offset + len; i++)
+    {
+        const event_edit& ed = edits[i];
+        uint64_t at = ed.offset - c.offset;
+        if (ed.len == 0)
+        {
+            putField(buf.data() + at, ed.value, ed.size);
+            continue;
+        }
+        memmove(buf.data() + kept, buf.data() + pos, at - pos);
+        kept += at - pos;
+        pos = at + ed.len;
+    }
+    *nextEdit = i;
+    memmove(buf.data() + kept, buf.data() + pos, len - pos);
+    kept += len - pos;
+    putField(buf.data() + 8, kept - CT_CHUNK_HEADER, 4);
+
+    *bytes += kept;
+    return (fwrite(buf.data(), 1, kept, out) == kept);
+}
+
+//
+// Write outputs until none are left.  The chunks of an unfiltered output are copied
+//   verbatim.  Those of a filtered output are decoded once to plan its edits, which
+//   only change events in place or drop them, so nothing is encoded again.
+//
+static void* splitWorker(void* v)
+{
+    split_job* job = (split_job*)v;
+    vector<uint8_t> buf;
+
+    while (true)
+    {
+        pthread_mutex_lock(&job->lock);
+        size_t i = job->nextOutput++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->outputs->size()) break;
+
+        split_output& o = (*job->outputs)[i];
+        vector<uint8_t> prologue, epilogue;
+        vector<event_edit> edits;
+        if (job->filtered && !planFilteredOutput(job, o, prologue, epilogue, edits))
+        {
+            o.failed = true;
+            continue;
+        }
+
+        FILE* out = fopen(o.name.c_str(), "wb");
+        if (out == NULL)
+        {
+            fprintf(stderr, "ERROR: Couldn't open output file: %s\n", o.name.c_str());
+            o.failed = true;
+            continue;
+        }
+
+        // The version, rank, block info and global info events precede the first chunk
+        o.failed = !copyRange(job->fd, 0, job->index->headerLen, out, buf);
+        o.bytes = job->index->headerLen;
+        if (!o.failed && !prologue.empty())
+        {
+            o.failed = (fwrite(prologue.data(), 1, prologue.size(), out) != prologue.size());
+            o.bytes += prologue.size();
+        }
+        size_t nextEdit = 0;
+        for (auto it = o.chunks.begin(), et = o.chunks.end(); it != et && !o.failed; ++it)
+        {
+            o.failed = !copyChunk(job->fd, job->index->chunks[*it], edits, &nextEdit, out, buf, &o.bytes);
+        }
+        if (!o.failed && !epilogue.empty())
+        {
+            o.failed = (fwrite(epilogue.data(), 1, epilogue.size(), out) != epilogue.size());
+            o.bytes += epilogue.size();
+        }
+
+        if (fclose(out) != 0) o.failed = true;
+        if (o.failed) fprintf(stderr, "ERROR: Failed writing %s\n", o.name.c_str());
+    }
+
+    return NULL;
+}
+
+//
+// Find the times of the ROI start and end events.  Without an end, the ROI runs to the
+//   end of the trace.
+//
+static bool findROI(FILE* in, ct_tsc_t* t0, ct_tsc_t* t1)
+{
+    EventLib el;
+    unsigned int found = 0;
+
+    el.setSkipMemOps(true);
+    *t0 = 0;
+    *t1 = ~0ULL;
+    while (pct_event e = el.createContechEvent(in))
+    {
+        if (e->event_type == ct_event_roi)
+        {
+            if (found == 0) *t0 = e->roi.start_time;
+            else if (found == 1) *t1 = e->roi.start_time;
+            found++;
+        }
+        EventLib::deleteContechEvent(e);
+    }
+    rewind(in);
+
+    return (found > 0);
+}
+
+//
+// Copy the chunks of a time range, the ROI or some contechs of a trace into new traces,
+//   which keep the header of the input so that they can be decoded like the input.
+//   Each MPI rank records its own trace, so splitting by rank is splitting by file;
+//   -s instead splits a trace into one output per contech.
+//
+//   A filtered trace is still an input to middle, see planFilteredOutput.
+//
+int main(int argc, char* argv[])
+{
+    bool window = false;
+    bool roi = false;
+    bool split = false;
+    unsigned int numThreads = 4;
+    ct_tsc_t t0 = 0, t1 = ~0ULL;
+    set<unsigned int> contechs;
+
+    if (argc < 3)
+    {
+        cerr << "Usage: " << argv[0] << " <event trace> <output> [-w <start> <end>] [-r] [-c <contech>]* [-s] [-t <threads>]" << endl;
+        cerr << "\t-w Keep only the chunks covering these times" << endl;
+        cerr << "\t-r Keep only the chunks covering the ROI" << endl;
+        cerr << "\t-c Keep only the chunks of this contech" << endl;
+        cerr << "\t-s Write each contech to <output>.<contech>" << endl;
+        cerr << "\t-t Threads writing the outputs, default 4" << endl;
+        return 1;
+    }
+
+    for (int i = 3; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-w") && i + 2 < argc)
+        {
+            window = true;
+            t0 = strtoull(argv[i + 1], NULL, 10);
+            t1 = strtoull(argv[i + 2], NULL, 10);
+            i += 2;
+        }
+        else if (!strcmp(argv[i], "-r"))
+        {
+            roi = true;
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            contechs.insert(strtoul(argv[i + 1], NULL, 10));
+            i++;
+        }
+        else if (!strcmp(argv[i], "-s"))
+        {
+            split = true;
+        }
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            numThreads = strtoul(argv[i + 1], NULL, 10);
+            if (numThreads == 0) numThreads = 1;
+            i++;
+        }
+        else
+        {
+            cerr << "Unknown option: " << argv[i] << endl;
+            return 1;
+        }
+    }
+
+    if (window && roi)
+    {
+        cerr << "ERROR: -w and -r cannot be combined" << endl;
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        cerr << "ERROR: Couldn't open input file: " << argv[1] << endl;
+        return 1;
+    }
+
+    TraceIndex index;
+    string sidecar = TraceIndex::sidecarName(argv[1]);
+    if (!index.read(sidecar.c_str()) || !index.matches(in))
+    {
+        cerr << "Building index of " << argv[1] << endl;
+        if (!index.build(in))
+        {
+            cerr << "ERROR: Couldn't index " << argv[1] << endl;
+            return 1;
+        }
+        index.write(sidecar.c_str());
+        rewind(in);
+    }
+
+    if (roi)
+    {
+        if (!findROI(in, &t0, &t1))
+        {
+            cerr << "ERROR: No ROI events in " << argv[1] << endl;
+            return 1;
+        }
+        window = true;
+    }
+
+    // Select the chunks, starting the window at a chunk that can be decoded from the header
+    size_t first = 0, end = index.chunks.size();
+    if (window) index.getTimeWindow(t0, t1, &first, &end);
+
+    vector<split_output> outputs;
+    map<unsigned int, size_t> outputOf;
+    for (size_t i = first; i < end; i++)
+    {
+        unsigned int ctid = index.chunks[i].contech_id;
+        if (!contechs.empty() && contechs.count(ctid) == 0) continue;
+
+        unsigned int key = (split) ? ctid : 0;
+        auto it = outputOf.find(key);
+        if (it == outputOf.end())
+        {
+            split_output o;
+            o.name = (split) ? (string(argv[2]) + "." + to_string(ctid)) : string(argv[2]);
+            o.bytes = 0;
+            o.failed = false;
+            it = outputOf.insert(make_pair(key, outputs.size())).first;
+            outputs.push_back(o);
+        }
+        outputs[it->second].chunks.push_back(i);
+    }
+
+    // A filter that matches nothing still yields a trace with just the header
+    if (outputs.empty() && !split)
+    {
+        split_output o;
+        o.name = argv[2];
+        o.bytes = 0;
+        o.failed = false;
+        outputs.push_back(o);
+    }
+
+    split_job job;
+    job.fd = fileno(in);
+    job.trace = argv[1];
+    job.filtered = (window || split || !contechs.empty());
+    job.version = 0;
+    if (index.headerLen >= CT_VERSION_POS + sizeof(uint32_t))
+    {
+        uint8_t v[sizeof(uint32_t)];
+        if (pread(job.fd, v, sizeof(v), CT_VERSION_POS) == sizeof(v))
+        {
+            job.version = v[0] | (v[1] << 8) | (v[2] << 16) | ((unsigned int)v[3] << 24);
+        }
+    }
+    job.index = &index;
+    job.outputs = &outputs;
+    job.nextOutput = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    if (numThreads > outputs.size()) numThreads = (outputs.empty()) ? 1 : outputs.size();
+    vector<pthread_t> threads(numThreads);
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        int r = pthread_create(&threads[i], NULL, splitWorker, &job);
+        assert(r == 0);
+    }
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+    fclose(in);
+
+    int ret = 0;
+    for (auto it = outputs.begin(), et = outputs.end(); it != et; ++it)
+    {
+        cout << it->name << ":\t" << it->chunks.size() << " chunks\t" << it->bytes << " bytes" << endl;
+        if (it->failed) ret = 1;
+    }
+
+    return ret;
+}
@@ -0,0 +1,190 @@
+#include "ct_decode.h"
+
+using namespace contech;
+
+// Size of the buffer event that starts each chunk: type, contech id, length
+#define CT_CHUNK_HEADER 12
+
+//
+// Take over decoding from el, whose next event must start a buffer chunk of a mapped
+//   trace.  el must have loaded the block info, and must outlive the decoder.
+//   At most maxChunks chunks are decoded.
+//
+ParallelDecode::ParallelDecode(EventLib* el, FILE* f, unsigned int numWorkers, size_t maxChunks)
+{
+    file = f;
+    source = el;
+    totalBytes = 0;
+    currentChunk = 0;
+    currentPos = 0;
+    currentReady = false;
+    stopping = false;
+
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&readyCond, NULL);
+    pthread_cond_init(&windowCond, NULL);
+
+    indexChunks(maxChunks);
+    decoded.resize(chunks.size());
+    ready.resize(chunks.size(), false);
+
+    if (numWorkers == 0) numWorkers = 1;
+    for (unsigned int i = 0; i < numWorkers; i++)
+    {
+        pdecode_worker w = new decode_worker;
+        w->pd = this;
+        w->id = i;
+        w->el.shareBlockInfo(el);
+        w->arena = new EventArena(true);
+        workers.push_back(w);
+    }
+
+    for (auto it = workers.begin(), et = workers.end(); it != et; ++it)
+    {
+        int r = pthread_create(&(*it)->thread, NULL, workerMain, *it);
+        assert(r == 0);
+    }
+}
+
+ParallelDecode::~ParallelDecode()
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&windowCond);
+    pthread_mutex_unlock(&lock);
+
+    for (auto it = workers.begin(), et = workers.end(); it != et; ++it)
+    {
+        pthread_join((*it)->thread, NULL);
+    }
+
+    // Free any events that were decoded but not consumed
+    for (size_t i = currentChunk; i < decoded.size(); i++)
+    {
+        for (size_t j = (i == currentChunk) ? currentPos : 0; j < decoded[i].size(); j++)
+        {
+            EventLib::deleteContechEvent(decoded[i][j]);
+        }
+    }
+
+    for (auto it = workers.begin(), et = workers.end(); it != et; ++it)
+    {
+        (*it)->arena->detach();
+        delete *it;
+    }
+
+    pthread_cond_destroy(&windowCond);
+    pthread_cond_destroy(&readyCond);
+    pthread_mutex_destroy(&lock);
+}
+
+//
+// Walk the chunk headers of the remaining trace, recording where each chunk's data is
+//
+void ParallelDecode::indexChunks(size_t maxChunks)
+{
+    size_t len = 0;
+    const uint8_t* p = source->getInputSpan(&len);
+    const uint8_t* e = p + len;
+
+    while (p < e && chunks.size() < maxChunks)
+    {
+        chunk_index ci;
+
+        if ((size_t)(e - p) < CT_CHUNK_HEADER || p[0] != ct_event_buffer)
+        {
+            fprintf(stderr, "ERROR: Expected buffer event at %lu bytes into chunks\n", totalBytes);
+            assert(0);
+        }
+
+        memcpy(&ci.contech_id, p + 4, sizeof(uint32_t));
+        memcpy(&ci.len, p + 8, sizeof(uint32_t));
+        ci.data = p + CT_CHUNK_HEADER;
+
+        if ((size_t)(e - ci.data) < ci.len)
+        {
+            fprintf(stderr, "ERROR: Buffer of %u bytes at %lu exceeds the trace\n", ci.len, totalBytes);
+            assert(0);
+        }
+
+        chunks.push_back(ci);
+        p = ci.data + ci.len;
+        totalBytes += CT_CHUNK_HEADER + ci.len;
+    }
+}
+
+void* ParallelDecode::workerMain(void* v)
+{
+    pdecode_worker w = (pdecode_worker) v;
+    w->pd->decodeChunks(w);
+    return NULL;
+}
+
+void ParallelDecode::decodeChunks(pdecode_worker w)
+{
+    unsigned int numWorkers = workers.size();
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (chunks[i].contech_id % numWorkers != w->id) continue;
+
+        // Stay within the window of chunks ahead of the consumer
+        pthread_mutex_lock(&lock);
+        while (stopping == false && i >= currentChunk + chunkWindow)
+        {
+            pthread_cond_wait(&windowCond, &lock);
+        }
+        bool stop = stopping;
+        pthread_mutex_unlock(&lock);
+        if (stop == true) break;
+
+        std::vector<pct_event> events;
+        w->el.setInputChunk(file, chunks[i].data, chunks[i].len, chunks[i].contech_id);
+        while (pct_event event = w->el.createContechEvent(file, w->arena))
+        {
+            events.push_back(event);
+        }
+
+        pthread_mutex_lock(&lock);
+        decoded[i].swap(events);
+        ready[i] = true;
+        pthread_cond_broadcast(&readyCond);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+//
+// Return the next event in trace order, or NULL at the end of the trace
+//
+pct_event ParallelDecode::getNextEvent()
+{
+    while (currentChunk < chunks.size())
+    {
+        if (currentReady == false)
+        {
+            pthread_mutex_lock(&lock);
+            while (ready[currentChunk] == false)
+            {
+                pthread_cond_wait(&readyCond, &lock);
+            }
+            pthread_mutex_unlock(&lock);
+            currentReady = true;
+        }
+
+        if (currentPos < decoded[currentChunk].size())
+        {
+            return decoded[currentChunk][currentPos++];
+        }
+
+        // Release the chunk and let the workers advance
+        pthread_mutex_lock(&lock);
+        std::vector<pct_event>().swap(decoded[currentChunk]);
+        currentChunk++;
+        currentPos = 0;
+        currentReady = false;
+        pthread_cond_broadcast(&windowCond);
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,69 @@
+#ifndef CT_DECODE_H
+#define CT_DECODE_H
+
+#include "ct_event.h"
+#include <pthread.h>
+
+#include <vector>
+
+namespace contech
+{
+    //
+    // Decodes the buffer chunks of a mapped trace on worker threads.
+    //   The chunks are indexed by a pre-scan of their headers.  Each contech is
+    //   assigned to one worker, which decodes that contech's chunks in order, as
+    //   the loop tracking state is per contech.  Events are returned in the order
+    //   of the trace, so consumers see the same sequence as a serial decode, less
+    //   the buffer events themselves.
+    //
+    class ParallelDecode
+    {
+        private:
+            typedef struct _chunk_index
+            {
+                const uint8_t* data;
+                uint32_t len;
+                uint32_t contech_id;
+            } chunk_index, *pchunk_index;
+
+            typedef struct _decode_worker
+            {
+                ParallelDecode* pd;
+                unsigned int id;
+                pthread_t thread;
+                EventLib el;
+                EventArena* arena;
+            } decode_worker, *pdecode_worker;
+
+            // Chunks that may be decoded ahead of the consumer
+            static const size_t chunkWindow = 256;
+
+            FILE* file;
+            EventLib* source;
+            std::vector<chunk_index> chunks;
+            std::vector<std::vector<pct_event> > decoded;
+            std::vector<bool> ready;
+            std::vector<pdecode_worker> workers;
+            uint64_t totalBytes;
+
+            pthread_mutex_t lock;
+            pthread_cond_t readyCond;
+            pthread_cond_t windowCond;
+            size_t currentChunk;
+            size_t currentPos;
+            bool currentReady;
+            bool stopping;
+
+            void indexChunks(size_t);
+            void decodeChunks(pdecode_worker);
+            static void* workerMain(void*);
+
+        public:
+            ParallelDecode(EventLib*, FILE*, unsigned int, size_t = ~0UL);
+            ~ParallelDecode();
+            pct_event getNextEvent();
+            uint64_t getBytes() {return totalBytes;}
+    };
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef CT_DELTA_H
+#define CT_DELTA_H
+
+#include <stdint.h>
+#include <string.h>
+
+//
+// Delta encoding of the recorded memory op addresses, in traces of CONTECH_DELTA_VERSION
+//   and later.  The runtime writer and EventLib each keep a table of the last address and
+//   stride of each (basic block, recorded op) pair, which is reset at the start of every
+//   buffer chunk so that chunks can still be decoded on their own.  An address is stored
+//   as a varint of its difference from the predicted address, last + stride, so a stride
+//   hit is one byte.  A pair not yet seen in the chunk is predicted by the chunk's most
+//   recent address, as addresses cluster in a few regions.
+//
+//   Shared by the runtime (C) and EventLib (C++), so both sides update the table alike.
+//
+
+// Entries are direct mapped, colliding pairs only cost prediction accuracy
+#define CT_DELTA_TABLE_BITS 12
+#define CT_DELTA_TABLE_SIZE (1 << CT_DELTA_TABLE_BITS)
+#define CT_DELTA_ADDR_MASK 0xffffffffffffULL
+// A 48 bit difference in zigzag form needs at most 7 bytes
+#define CT_DELTA_MAX_BYTES 7
+
+typedef struct _ct_delta_entry
+{
+    uint64_t last;
+    uint64_t stride;
+} ct_delta_entry, *pct_delta_entry;
+
+typedef struct _ct_delta_table
+{
+    uint64_t recent;
+    ct_delta_entry entry[CT_DELTA_TABLE_SIZE];   // last is 0 if unused
+} ct_delta_table, *pct_delta_table;
+
+static inline void ct_delta_reset(pct_delta_table t)
+{
+    memset(t, 0, sizeof(ct_delta_table));
+}
+
+static inline pct_delta_entry ct_delta_lookup(pct_delta_table t, uint32_t bbid, uint32_t op)
+{
+    return &t->entry[((bbid << 3) + (bbid >> (CT_DELTA_TABLE_BITS - 3)) + op) & (CT_DELTA_TABLE_SIZE - 1)];
+}
+
+static inline uint64_t ct_delta_predict(pct_delta_table t, pct_delta_entry e)
+{
+    return (e->last != 0) ? (e->last + e->stride) : t->recent;
+}
+
+static inline void ct_delta_update(pct_delta_table t, pct_delta_entry e, uint64_t addr)
+{
+    e->stride = (e->last != 0) ? ((addr - e->last) & CT_DELTA_ADDR_MASK) : 0;
+    e->last = addr;
+    t->recent = addr;
+}
+
+//
+// Encode addr into buf, returning the bytes used
+//
+static inline unsigned int ct_delta_encode(pct_delta_table t, pct_delta_entry e, uint64_t addr, uint8_t* buf)
+{
+    uint64_t d;
+    
+    addr &= CT_DELTA_ADDR_MASK;
+    d = (addr - ct_delta_predict(t, e)) & CT_DELTA_ADDR_MASK;
+    int64_t sd = ((int64_t)(d << 16)) >> 16;
+    uint64_t z = ((uint64_t)sd << 1) ^ (uint64_t)(sd >> 63);
+    unsigned int n = 0;
+
+    while (z >= 0x80)
+    {
+        buf[n++] = (uint8_t)(z | 0x80);
+        z >>= 7;
+    }
+    buf[n++] = (uint8_t)z;
+
+    ct_delta_update(t, e, addr);
+    return n;
+}
+
+//
+// Decode an address from buf, returning the bytes used or 0 if the varint does not end
+//   within len bytes
+//
+static inline unsigned int ct_delta_decode(pct_delta_table t, pct_delta_entry e, const uint8_t* buf, size_t len, uint64_t* addr)
+{
+    uint64_t z = 0;
+    unsigned int n = 0;
+    unsigned int shift = 0;
+
+    while (1)
+    {
+        if (n >= len || n >= CT_DELTA_MAX_BYTES) return 0;
+        uint8_t b = buf[n++];
+        z |= ((uint64_t)(b & 0x7f)) << shift;
+        if ((b & 0x80) == 0) break;
+        shift += 7;
+    }
+
+    uint64_t d = (z >> 1) ^ (0 - (z & 1));
+    uint64_t a = (ct_delta_predict(t, e) + d) & CT_DELTA_ADDR_MASK;
+
+    ct_delta_update(t, e, a);
+    *addr = a;
+    return n;
+}
+
+//
+// Bytes of the varint at the start of buf, or 0 if it does not end within len bytes
+//
+static inline unsigned int ct_delta_length(const uint8_t* buf, size_t len)
+{
+    unsigned int n = 0;
+    while (n < len && n < CT_DELTA_MAX_BYTES)
+    {
+        if ((buf[n++] & 0x80) == 0) return n;
+    }
+    return 0;
+}
+
+#endif
@@ -1,15 +1,82 @@
 #include "ct_event.h"
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 using namespace contech;
 
+// Size of the blocks read when the trace cannot be mapped
+#define CT_INPUT_BLOCK (1 << 20)
+
+// Bytes of each memory op address recorded in the trace
+#define CT_PACKED_ADDR 6
+
+//
+// Expand n packed addresses from src into dst, merging in each op's static bits.
+//   The vector versions move whole ops with a shuffle, leaving the scalar loop for
+//   the ops where a full vector load would run past the end of src.
+//
+static void expandMemOpsScalar(pct_memory_op dst, const uint8_t* src, const uint64_t* bits, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+    {
+        uint64_t a = 0;
+        memcpy(&a, src + i * CT_PACKED_ADDR, CT_PACKED_ADDR);
+        dst[i].data = a | bits[i];
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("ssse3")))
+static void expandMemOpsSSSE3(pct_memory_op dst, const uint8_t* src, const uint64_t* bits, unsigned int n)
+{
+    const __m128i shuf = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+    unsigned int i = 0;
+    
+    // Two ops per 16 byte load
+    for (; (i + 2) * CT_PACKED_ADDR + 4 <= n * CT_PACKED_ADDR; i += 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * CT_PACKED_ADDR));
+        v = _mm_shuffle_epi8(v, shuf);
+        v = _mm_or_si128(v, _mm_loadu_si128((const __m128i*)(bits + i)));
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    }
+    
+    expandMemOpsScalar(dst + i, src + i * CT_PACKED_ADDR, bits + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void expandMemOpsAVX2(pct_memory_op dst, const uint8_t* src, const uint64_t* bits, unsigned int n)
+{
+    const __m256i shuf = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1,
+                                          0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+    unsigned int i = 0;
+    
+    // Four ops per iteration, two in each 128 bit lane
+    for (; (i + 4) * CT_PACKED_ADDR + 4 <= n * CT_PACKED_ADDR; i += 4)
+    {
+        const uint8_t* p = src + i * CT_PACKED_ADDR;
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+                                            _mm_loadu_si128((const __m128i*)(p + 2 * CT_PACKED_ADDR)), 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        v = _mm256_or_si256(v, _mm256_loadu_si256((const __m256i*)(bits + i)));
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+    }
+    
+    expandMemOpsScalar(dst + i, src + i * CT_PACKED_ADDR, bits + i, n - i);
+}
+#endif
+
 void EventLib::fread_check(void* x, size_t y, size_t z, FILE* a)
 {
     uint32_t t = 0;
-    if ((y * z) != (t = ct_read(x,(y * z),a))) 
+    if ((y * z) != (t = readInput(x,(y * z),a))) 
     {
         fprintf(stderr, "FREAD failure at %d of %lu after %lu\n", __LINE__, z, sum);
         dumpAndTerminate(a);
@@ -35,26 +102,319 @@ EventLib::EventLib()
     bb_count = 0;
     
     bb_info_table = NULL;
+    sharedInfo = false;
+    skipMemOps = false;
+    lastMemOpBytes = 0;
+    deltaTable = NULL;
     constGVAddr = NULL;
     maxConstGVId = 0;
+    
+    inFile = NULL;
+    inPos = inEnd = inBase = NULL;
+    inLen = 0;
+    inMapped = false;
+    
+    expandMemOps = expandMemOpsScalar;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) expandMemOps = expandMemOpsAVX2;
+    else if (__builtin_cpu_supports("ssse3")) expandMemOps = expandMemOpsSSSE3;
+#endif
 }
 
 EventLib::~EventLib()
 {
-    if (bb_info_table != NULL) 
+    resetEventLib();
+}
+
+//
+// Start reading from a new stream.  Regular files are mapped from the current position,
+//   which is left unchanged, as mapping the file does not move the stream.  Anything
+//   else, such as a pipe, is read in large blocks.
+//
+void EventLib::attachInput(FILE* fptr)
+{
+    struct stat st;
+    
+    releaseInput();
+    inFile = fptr;
+    
+    off_t offset = ftello(fptr);
+    if (offset >= 0 &&
+        fstat(fileno(fptr), &st) == 0 && 
+        S_ISREG(st.st_mode) && 
+        st.st_size > offset)
     {
-        uint64_t thresh = sum / 100;
-        for (int i = 0; i < bb_count; i++)
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fptr), 0);
+        if (map != MAP_FAILED)
+        {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            inBase = (uint8_t*) map;
+            inLen = st.st_size;
+            inMapped = true;
+            inPos = inBase + offset;
+            inEnd = inBase + inLen;
+            return;
+        }
+    }
+    
+    inBase = (uint8_t*) malloc(CT_INPUT_BLOCK);
+    if (inBase == NULL)
+    {
+        fprintf(stderr, "Failure to allocate input block for trace\n");
+        assert(0);
+    }
+    inLen = CT_INPUT_BLOCK;
+    inMapped = false;
+    inPos = inEnd = inBase;
+}
+
+void EventLib::releaseInput()
+{
+    if (inBase != NULL)
+    {
+        if (inMapped) munmap(inBase, inLen);
+        else free(inBase);
+    }
+    
+    inFile = NULL;
+    inPos = inEnd = inBase = NULL;
+    inLen = 0;
+    inMapped = false;
+}
+
+//
+// Copy len bytes from the span, refilling it as needed.  Returns the bytes copied,
+//   which is less than len only at the end of the trace.
+//
+size_t EventLib::readInputSlow(void* x, size_t len, FILE* a)
+{
+    size_t read = 0;
+    
+    if (a != inFile) attachInput(a);
+    
+    while (read < len)
+    {
+        size_t avail = inEnd - inPos;
+        if (avail == 0)
+        {
+            if (inMapped) break;
+            
+            inPos = inBase;
+            inEnd = inBase + fread(inBase, 1, inLen, a);
+            if (inEnd == inBase) break;
+            continue;
+        }
+        
+        if (avail > len - read) avail = len - read;
+        memcpy((char*)x + read, inPos, avail);
+        inPos += avail;
+        read += avail;
+    }
+    
+    return read;
+}
+
+//
+// Return len contiguous bytes of the trace, directly from the span if possible
+//
+const uint8_t* EventLib::readInputSpan(size_t len, FILE* a)
+{
+    const uint8_t* p = NULL;
+    
+    if (a == inFile && (size_t)(inEnd - inPos) >= len)
+    {
+        p = inPos;
+        inPos += len;
+        sum += len;
+        return p;
+    }
+    
+    if (inScratch.size() < len) inScratch.resize(len);
+    fread_check(inScratch.data(), sizeof(uint8_t), len, a);
+    return inScratch.data();
+}
+
+//
+// Decode an address whose varint is not wholly in the input span
+//
+uint64_t EventLib::readDeltaAddrSlow(pct_delta_entry e, FILE* a)
+{
+    uint8_t buf[CT_DELTA_MAX_BYTES];
+    uint64_t addr = 0;
+    size_t n = 0;
+    
+    do
+    {
+        if (n == CT_DELTA_MAX_BYTES)
+        {
+            fprintf(stderr, "ERROR: Address delta exceeds %d bytes\n", CT_DELTA_MAX_BYTES);
+            dumpAndTerminate(a);
+        }
+        fread_check(&buf[n], sizeof(uint8_t), 1, a);
+    } while ((buf[n++] & 0x80) != 0);
+    
+    ct_delta_decode(deltaTable, e, buf, n, &addr);
+    return addr;
+}
+
+//
+// Step over n delta encoded addresses, without updating the table
+//
+void EventLib::skipDeltaAddrs(unsigned int n, FILE* a)
+{
+    for (unsigned int i = 0; i < n; i++)
+    {
+        unsigned int len;
+        if (a == inFile && (len = ct_delta_length(inPos, inEnd - inPos)) != 0)
         {
-            uint64_t prod = bb_info_table[i].count * bb_info_table[i].totalBytes;
-           
-            if (prod > thresh)
+            inPos += len;
+            sum += len;
+            continue;
+        }
+        
+        uint8_t b;
+        unsigned int bytes = 0;
+        do
+        {
+            if (bytes++ == CT_DELTA_MAX_BYTES)
             {
-                printf("BBID:%u\t%d\t%u\t%lu\n", i, bb_info_table[i].count, bb_info_table[i].totalBytes, prod);
+                fprintf(stderr, "ERROR: Address delta exceeds %d bytes\n", CT_DELTA_MAX_BYTES);
+                dumpAndTerminate(a);
             }
+            fread_check(&b, sizeof(uint8_t), 1, a);
+        } while ((b & 0x80) != 0);
+    }
+}
+
+//
+// Compile the decode plan of a block once its info is loaded.  When every op's
+//   address is in the trace, the ops are a run of packed addresses that only
+//   differ from the decoded ops by their static bits.
+//
+void EventLib::compileDecodePlan(unsigned int id)
+{
+    pinternal_basic_block_info bbi = &bb_info_table[id];
+    
+    if (bbi->mem_op_plan != NULL) free(bbi->mem_op_plan);
+    bbi->mem_op_plan = NULL;
+    
+    bbi->recordedBytes = 0;
+    for (unsigned int i = 0; i < bbi->len; i++)
+    {
+        if ((bbi->mem_op_info[i].memFlags & (BBI_FLAG_MEM_DUP | BBI_FLAG_MEM_GV | BBI_FLAG_MEM_LOOP)) == 0)
+        {
+            bbi->recordedBytes += CT_PACKED_ADDR;
         }
     }
+    
+    if (bbi->len == 0) return;
+    for (unsigned int i = 0; i < bbi->len; i++)
+    {
+        if ((bbi->mem_op_info[i].memFlags & (BBI_FLAG_MEM_DUP | BBI_FLAG_MEM_GV | BBI_FLAG_MEM_LOOP)) != 0) return;
+    }
+    
+    bbi->mem_op_plan = (uint64_t*) malloc(sizeof(uint64_t) * bbi->len);
+    if (bbi->mem_op_plan == NULL) return;
+    
+    for (unsigned int i = 0; i < bbi->len; i++)
+    {
+        ct_memory_op op;
+        op.data = 0;
+        op.is_write = bbi->mem_op_info[i].memFlags & 0x1;
+        op.pow_size = bbi->mem_op_info[i].size;
+        if ((bbi->mem_op_info[i].memFlags & BBI_FLAG_MEM_RANGE) == BBI_FLAG_MEM_RANGE) op.range_cont = 1;
+        if ((bbi->mem_op_info[i].memFlags & BBI_FLAG_MEM_ATOMIC) == BBI_FLAG_MEM_ATOMIC) op.is_atomic = 1;
+        bbi->mem_op_plan[i] = op.data;
+    }
+}
+
+bool EventLib::isInputMapped(FILE* fptr)
+{
+    if (fptr != inFile) attachInput(fptr);
+    return inMapped;
+}
+
+//
+// Is the next event the start of a buffer chunk, such that the rest of the
+//   trace is a sequence of chunks
+//
+bool EventLib::nextIsChunk()
+{
+    return (version > 0 &&
+            next_basic_block_id == -1 &&
+            inPos < inEnd &&
+            *inPos == ct_event_buffer);
+}
+
+//
+// Return the unread remainder of a mapped trace
+//
+const uint8_t* EventLib::getInputSpan(size_t* len)
+{
+    assert(inMapped);
+    *len = inEnd - inPos;
+    return inPos;
+}
+
+//
+// Decode using the block info and global values already loaded by src.
+//   src must outlive this EventLib and not load further info.
+//
+void EventLib::shareBlockInfo(EventLib* src)
+{
     resetEventLib();
+    version = src->version;
+    bb_count = src->bb_count;
+    bb_info_table = src->bb_info_table;
+    constGVAddr = src->constGVAddr;
+    maxConstGVId = src->maxConstGVId;
+    skipMemOps = src->skipMemOps;
+    sharedInfo = true;
+    
+    if (version >= CONTECH_DELTA_VERSION)
+    {
+        deltaTable = (pct_delta_table) malloc(sizeof(ct_delta_table));
+        if (deltaTable == NULL)
+        {
+            fprintf(stderr, "Failure to allocate the address delta table\n");
+            abort();
+        }
+        ct_delta_reset(deltaTable);
+    }
+}
+
+//
+// Decode the events in the data of one buffer chunk, which belong to contech ctid.
+//   The data remains owned by the caller.
+//
+void EventLib::setInputChunk(FILE* fptr, const uint8_t* data, size_t len, unsigned int ctid)
+{
+    releaseInput();
+    inFile = fptr;
+    inPos = (uint8_t*) data;
+    inEnd = (uint8_t*) data + len;
+    inMapped = true;
+    
+    currentID = ctid;
+    next_basic_block_id = -1;
+    bufSum = 0;
+    if (deltaTable != NULL) ct_delta_reset(deltaTable);
+}
+
+//
+// Continue decoding a mapped trace from offset, which must be the start of a buffer
+//   chunk, such as one recorded in a TraceIndex.  Returns false if the trace is not mapped.
+//
+bool EventLib::seekInput(FILE* fptr, uint64_t offset)
+{
+    if (!isInputMapped(fptr) || offset > inLen) return false;
+    
+    inPos = inBase + offset;
+    sum = offset;
+    bufSum = 0;
+    next_basic_block_id = -1;
+    if (deltaTable != NULL) ct_delta_reset(deltaTable);
+    return true;
 }
 
 /* unpack: unpack packed items from buf, return length */
@@ -133,16 +493,18 @@ int EventLib::unpack(uint8_t *buf, char const fmt[], ...)
 
 void EventLib::resetEventLib()
 {
-    if (bb_info_table != NULL) 
+    if (bb_info_table != NULL && sharedInfo == false) 
     {
         for (int i = 0; i < bb_count; i++)
         {
             if (bb_info_table[i].mem_op_info != NULL) free(bb_info_table[i].mem_op_info);
+            if (bb_info_table[i].mem_op_plan != NULL) free(bb_info_table[i].mem_op_plan);
         }
         free(bb_info_table);
     }
     
     bb_info_table = NULL;
+    sharedInfo = false;
     version = 0;
     sum = 0;
     bb_count = 0;
@@ -150,12 +512,108 @@ void EventLib::resetEventLib()
     bufSum = 0;
     constGVAddr = NULL;
     maxConstGVId = 0;
+    if (deltaTable != NULL) free(deltaTable);
+    deltaTable = NULL;
+    freeLoopTracking();
+    releaseInput();
+}
+
+//
+// Loop tracking state is kept per contech, in dense tables by contech id.
+//   Tracks are pooled, as loops are started and ended throughout the trace.
+//
+EventLib::pinternal_loop_context EventLib::createLoopContext(uint32_t ctid)
+{
+    if (ctid >= loopContexts.size()) loopContexts.resize(ctid + 1, NULL);
+    if (loopContexts[ctid] == NULL) loopContexts[ctid] = new internal_loop_context;
+    return loopContexts[ctid];
+}
+
+void EventLib::resetLoopContext(pinternal_loop_context lc)
+{
+    while (!lc->stack.empty())
+    {
+        popLoopTrack(lc);
+    }
+}
+
+EventLib::pinternal_loop_track EventLib::pushLoopTrack(pinternal_loop_context lc, pct_event npe)
+{
+    pinternal_loop_track clt;
+    if (loopTrackPool.empty())
+    {
+        clt = new internal_loop_track;
+    }
+    else
+    {
+        clt = loopTrackPool.back();
+        loopTrackPool.pop_back();
+    }
+    
+    clt->loopStarted = false;
+    clt->clb = npe->loop.clb;
+    clt->preLoopId = npe->loop.preLoopId;
+    clt->baseAddr.clear();
+    
+    // Hide any outer track of the same loop or step block, which is restored on pop
+    pinternal_loop_track& sameLoop = lc->byLoop[clt->preLoopId];
+    clt->outerSameLoop = sameLoop;
+    sameLoop = clt;
+    pinternal_loop_track& sameStep = lc->byStep[clt->clb.stepBlock];
+    clt->outerSameStep = sameStep;
+    sameStep = clt;
+    
+    if (clt->clb.stepBlock >= stepBlockRefs.size()) stepBlockRefs.resize(clt->clb.stepBlock + 1, 0);
+    stepBlockRefs[clt->clb.stepBlock]++;
+    
+    lc->stack.push_back(clt);
+    return clt;
+}
+
+void EventLib::popLoopTrack(pinternal_loop_context lc)
+{
+    pinternal_loop_track clt = lc->stack.back();
+    lc->stack.pop_back();
+    
+    if (clt->outerSameLoop == NULL) lc->byLoop.erase(clt->preLoopId);
+    else lc->byLoop[clt->preLoopId] = clt->outerSameLoop;
+    if (clt->outerSameStep == NULL) lc->byStep.erase(clt->clb.stepBlock);
+    else lc->byStep[clt->clb.stepBlock] = clt->outerSameStep;
+    
+    stepBlockRefs[clt->clb.stepBlock]--;
+    loopTrackPool.push_back(clt);
+}
+
+void EventLib::freeLoopTracking()
+{
+    for (auto it = loopContexts.begin(), et = loopContexts.end(); it != et; ++it)
+    {
+        if (*it == NULL) continue;
+        resetLoopContext(*it);
+        delete *it;
+    }
+    loopContexts.clear();
+    stepBlockRefs.clear();
+    
+    for (auto it = loopTrackPool.begin(), et = loopTrackPool.end(); it != et; ++it)
+    {
+        delete *it;
+    }
+    loopTrackPool.clear();
 }
 
 //
 // Deserialize a CT_EVENT from a FILE stream
 //
 pct_event EventLib::createContechEvent(FILE* fptr)
+{
+    return createContechEvent(fptr, NULL);
+}
+
+//
+// Deserialize a CT_EVENT, with its storage taken from arena if not NULL
+//
+pct_event EventLib::createContechEvent(FILE* fptr, EventArena* arena)
 {
     unsigned int t;
     pct_event npe;
@@ -169,7 +627,15 @@ pct_event EventLib::createContechEvent(FILE* fptr)
     //    debug_file = fopen("debug.log", "w");
     }
     
-    npe = (pct_event) malloc(sizeof(ct_event));
+    if (arena != NULL)
+    {
+        npe = arena->allocEvent(0);
+    }
+    else
+    {
+        npe = (pct_event) malloc(sizeof(ct_event));
+        if (npe != NULL) npe->arena = NULL;
+    }
     if (npe == NULL)
     {
         fprintf(stderr, "Failure to allocate new contech event\n");
@@ -180,12 +646,12 @@ pct_event EventLib::createContechEvent(FILE* fptr)
     //if (0 == (t = fread(&npe->contech_id, sizeof(unsigned int), 1, fptr)))
     if (version == 0)
     {
-        if (0 == (t = ct_read(&npe->contech_id, sizeof(unsigned int), fptr)))
+        if (0 == (t = readInput(&npe->contech_id, sizeof(unsigned int), fptr)))
         {
-            free(npe);
+            releaseEvent(npe);
             return NULL;
         }
-        // ct_read returns bytes read not elements read
+        // readInput returns bytes read not elements read
         sum += t;
         
         fread_check(&npe->event_type, sizeof(unsigned int), 1, fptr);
@@ -200,11 +666,11 @@ pct_event EventLib::createContechEvent(FILE* fptr)
     else
     {
         // Problem here is that event_type is of size int, 
-        // so we have to initialize the field and not just the ct_read call
+        // so we have to initialize the field and not just the readInput call
         npe->event_type = (ct_event_id)0;
-        if (0 == (t = ct_read(&npe->event_type, sizeof(char), fptr)))
+        if (0 == (t = readInput(&npe->event_type, sizeof(char), fptr)))
         {
-            free(npe);
+            releaseEvent(npe);
             return NULL;
         }
         
@@ -283,14 +749,37 @@ pct_event EventLib::createContechEvent(FILE* fptr)
             {
                 //fprintf(stderr, "%d -> %d\n", id, this->next_basic_block_id);
             }
+            uint64_t memOpStart = sum;
+            if (skipMemOps == true && npe->bb.len > 0)
+            {
+                // Step over the recorded addresses; elided ops take no space in the trace
+                if (version >= CONTECH_DELTA_VERSION)
+                    skipDeltaAddrs(bb_info_table[id].recordedBytes / CT_PACKED_ADDR, fptr);
+                else
+                    readInputSpan((version == 0) ? npe->bb.len * sizeof(ct_memory_op) : bb_info_table[id].recordedBytes, fptr);
+                npe->bb.len = 0;
+            }
             if (npe->bb.len > 0)
             {
-                npe->bb.mem_op_array = (pct_memory_op) malloc(npe->bb.len * sizeof(ct_memory_op));
+                if (npe->arena != NULL)
+                {
+                    // Move to a slot that can hold the memory ops inline
+                    npe = npe->arena->resizeEvent(npe, npe->bb.len);
+                    if (npe == NULL)
+                    {
+                        fprintf(stderr, "Failure to allocate arena slot for basic block event\n");
+                        return NULL;
+                    }
+                }
+                else
+                {
+                    npe->bb.mem_op_array = (pct_memory_op) malloc(npe->bb.len * sizeof(ct_memory_op));
+                }
 
                 if (npe->bb.mem_op_array == NULL)
                 {
                     fprintf(stderr, "Failure to allocate array for memory ops in basic block event\n");
-                    free (npe);
+                    releaseEvent(npe);
                     return NULL;
                 }
                 
@@ -302,8 +791,21 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                 {
                     fread_check(npe->bb.mem_op_array, sizeof(ct_memory_op), npe->bb.len, fptr);
                 }
+                else if (bb_info_table[id].mem_op_plan != NULL && version >= CONTECH_DELTA_VERSION)
+                {
+                    for (unsigned int i = 0; i < npe->bb.len; i++)
+                    {
+                        npe->bb.mem_op_array[i].data = readDeltaAddr(id, i, fptr) | bb_info_table[id].mem_op_plan[i];
+                    }
+                }
+                else if (bb_info_table[id].mem_op_plan != NULL)
+                {
+                    const uint8_t* src = readInputSpan(npe->bb.len * CT_PACKED_ADDR, fptr);
+                    expandMemOps(npe->bb.mem_op_array, src, bb_info_table[id].mem_op_plan, npe->bb.len);
+                }
                 else
                 {
+                    unsigned int recordedOp = 0;
                     for (int i = 0; i < npe->bb.len; i++)
                     {
                         npe->bb.mem_op_array[i].data = 0;
@@ -377,17 +879,10 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                             uint32_t loopId = bb_info_table[id].mem_op_info[i].headerLoopId;
                             uint8_t size = bb_info_table[id].mem_op_info[i].size;
                             
-                            auto lv = loopTrack[npe->contech_id];
-                            internal_loop_track* clt = NULL;
-                            for (auto it = lv.rbegin(), et = lv.rend(); it != et; ++it)
-                            {
-                                if ((*it)->preLoopId == loopId)
-                                {
-                                    clt = *it;
-                                    break;
-                                }
-                            }
-                            assert(clt != NULL);
+                            pinternal_loop_context lc = getLoopContext(npe->contech_id);
+                            auto lt = lc->byLoop.find(loopId);
+                            assert(lt != lc->byLoop.end());
+                            internal_loop_track* clt = lt->second;
                             
                             npe->bb.mem_op_array[i].addr = ((int64_t) offset) + 
                                                            ((int64_t) bb_info_table[id].mem_op_info[i].loopIVSize) * (clt->clb.startValue) + 
@@ -404,7 +899,7 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                             
                             if (tmo.addr != npe->bb.mem_op_array[i].addr)
                             {
-                                fprintf(stderr, "In loopTrack[%d] size %d:\n", npe->contech_id, lv.size());
+                                fprintf(stderr, "In loopContexts[%d] size %d:\n", npe->contech_id, lc->stack.size());
                                 fprintf(stderr, "%d.%d of loop %d.%d with %d in %d\n", id, i, loopId, loopMemOpId, clt->clb.step, clt->clb.stepBlock);
                                 fprintf(stderr, "%p != %p\n", tmo.addr, npe->bb.mem_op_array[i].addr);
                                 fprintf(stderr, "%p[%d * %d] + %d -> %p\n", clt->baseAddr[loopMemOpId], 
@@ -418,6 +913,12 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                             npe->bb.mem_op_array[i].is_write = bb_info_table[id].mem_op_info[i].memFlags & 0x1;
                             npe->bb.mem_op_array[i].pow_size = size;
                         }
+                        else if (version >= CONTECH_DELTA_VERSION)
+                        {
+                            npe->bb.mem_op_array[i].data = readDeltaAddr(id, recordedOp++, fptr);
+                            npe->bb.mem_op_array[i].is_write = bb_info_table[id].mem_op_info[i].memFlags & 0x1;
+                            npe->bb.mem_op_array[i].pow_size = bb_info_table[id].mem_op_info[i].size;
+                        }
                         else
                         {
                             fread_check(&npe->bb.mem_op_array[i].data32[0], sizeof(unsigned int), 1, fptr);
@@ -426,6 +927,15 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                             npe->bb.mem_op_array[i].is_write = bb_info_table[id].mem_op_info[i].memFlags & 0x1;
                             npe->bb.mem_op_array[i].pow_size = bb_info_table[id].mem_op_info[i].size;
                         }
+                        
+                        if ((bb_info_table[id].mem_op_info[i].memFlags & BBI_FLAG_MEM_RANGE) == BBI_FLAG_MEM_RANGE)
+                        {
+                            npe->bb.mem_op_array[i].range_cont = 1;
+                        }
+                        if ((bb_info_table[id].mem_op_info[i].memFlags & BBI_FLAG_MEM_ATOMIC) == BBI_FLAG_MEM_ATOMIC)
+                        {
+                            npe->bb.mem_op_array[i].is_atomic = 1;
+                        }
                     }
                 }
             }
@@ -433,12 +943,18 @@ pct_event EventLib::createContechEvent(FILE* fptr)
             {
                 npe->bb.mem_op_array = NULL;
             }
+            lastMemOpBytes = sum - memOpStart;
             
-            auto lb = loopBlock[npe->contech_id].find(npe->bb.basic_block_id);
-            if (lb != loopBlock[npe->contech_id].end())
+            // Only look up the contech's loops if some open loop steps on this block
+            if (id < stepBlockRefs.size() && stepBlockRefs[id] != 0)
             {
-                auto clt = lb->second.back();
-                clt->clb.startValue += clt->clb.step;
+                pinternal_loop_context lc = getLoopContext(npe->contech_id);
+                auto lb = lc->byStep.find(id);
+                if (lb != lc->byStep.end())
+                {
+                    auto clt = lb->second;
+                    clt->clb.startValue += clt->clb.step;
+                }
             }
         }
         break;
@@ -482,7 +998,7 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                 if (tStr == NULL)
                 {
                     fprintf(stderr, "ERROR: Failed to allocate %lu bytes for function name\n", sizeof(char) * (len + 1));
-                    free(npe);
+                    releaseEvent(npe);
                     return NULL;
                 }
                 tStr[len] = '\0';
@@ -503,7 +1019,7 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                 {
                     fprintf(stderr, "ERROR: Failed to allocate %lu bytes for file name\n", sizeof(char) * (len + 1));
                     free(npe->bbi.fun_name);
-                    free(npe);
+                    releaseEvent(npe);
                     return NULL;
                 }
                 tStr[len] = '\0';
@@ -525,7 +1041,7 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                     fprintf(stderr, "ERROR: Failed to allocate %lu bytes for called function name\n", sizeof(char) * (len + 1));
                     free(npe->bbi.file_name);
                     free(npe->bbi.fun_name);
-                    free(npe);
+                    releaseEvent(npe);
                     return NULL;
                 }
                 tStr[len] = '\0';
@@ -591,8 +1107,7 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                 bb_info_table[id].mem_op_info = NULL;
             }
             
-            bb_info_table[id].count = 0;
-            bb_info_table[id].totalBytes = 0;
+            compileDecodePlan(id);
         }
         break;
         
@@ -615,12 +1130,7 @@ pct_event EventLib::createContechEvent(FILE* fptr)
             if (npe->tc.approx_skew != 0 ||
                 npe->tc.other_id == 0)
             {
-                std::vector<pinternal_loop_track> vl;
-                vl.push_back(NULL);
-                loopTrack[npe->contech_id] = vl;
-                
-                std::map< uint32_t, std::vector<pinternal_loop_track> > ml;
-                loopBlock[npe->contech_id] = ml;
+                resetLoopContext(getLoopContext(npe->contech_id));
             }
         }
         break;
@@ -731,6 +1241,9 @@ pct_event EventLib::createContechEvent(FILE* fptr)
             {
                 currentID = npe->contech_id;
             }
+            
+            // Each chunk starts with no address history
+            if (deltaTable != NULL) ct_delta_reset(deltaTable);
         }
         break;
         
@@ -811,8 +1324,20 @@ pct_event EventLib::createContechEvent(FILE* fptr)
             assert(version == 0);
             fread_check(&version, sizeof(unsigned int), 1, fptr);
             fread_check(&bb_count, sizeof(unsigned int), 1, fptr);
+            // Ids reserved by the instrumentation but never assigned leave holes in
+            //   the table, so the entries are zeroed rather than left uninitialized.
             if (bb_count > 0)
-                bb_info_table = (pinternal_basic_block_info) malloc (sizeof(internal_basic_block_info) * bb_count);
+                bb_info_table = (pinternal_basic_block_info) calloc (bb_count, sizeof(internal_basic_block_info));
+            if (version >= CONTECH_DELTA_VERSION)
+            {
+                deltaTable = (pct_delta_table) malloc(sizeof(ct_delta_table));
+                if (deltaTable == NULL)
+                {
+                    fprintf(stderr, "Failure to allocate the address delta table\n");
+                    dumpAndTerminate(fptr);
+                }
+                ct_delta_reset(deltaTable);
+            }
             
             if (version > CONTECH_EVENT_VERSION)
                 fprintf(stderr, "WARNING: Version %d exceeds supported versions\n", version);
@@ -842,25 +1367,23 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                                              &npe->loop.preLoopId);
             assert(bytesConsume == loop_size);
             
-            auto lv = loopTrack.find(npe->contech_id);
-            assert(lv != loopTrack.end());
-            if (lv == loopTrack.end())
-            {
-                dumpAndTerminate(fptr);
-            }
+            pinternal_loop_context lc = getLoopContext(npe->contech_id);
             
             // Loop start and end events are slightly different.
             if (npe->loop.start == 0)
             {
-                internal_loop_track* clt = lv->second.back();
+                if (lc->stack.empty())
+                {
+                    fprintf(stderr, "ERROR: End of loop %d with no open loop\n", npe->loop.preLoopId);
+                    dumpAndTerminate(fptr);
+                }
+                internal_loop_track* clt = lc->stack.back();
                 if (clt->preLoopId != npe->loop.preLoopId)
                 {
                     printf("In %d, loop %d was instead %d\n", lastBBID, npe->loop.preLoopId, clt->preLoopId);
                 }
                 assert(clt->preLoopId == npe->loop.preLoopId);
-                lv->second.pop_back();
-                loopBlock[npe->contech_id][clt->clb.stepBlock].pop_back();
-                delete clt;
+                popLoopTrack(lc);
             }
             else
             {
@@ -877,16 +1400,12 @@ pct_event EventLib::createContechEvent(FILE* fptr)
                                                      &npe->loop.clm.memOpId,
                                                      &npe->loop.clm.baseAddr);
                 
-                internal_loop_track* clt = lv->second.back();
+                internal_loop_track* clt = (lc->stack.empty()) ? NULL : lc->stack.back();
                 if (clt == NULL || 
                     clt->preLoopId != npe->loop.preLoopId ||
                     npe->loop.clm.memOpId == 0)
                 {
-                    clt = new internal_loop_track;
-                    clt->clb = npe->loop.clb;
-                    clt->preLoopId = npe->loop.preLoopId;
-                    lv->second.push_back(clt);
-                    loopBlock[npe->contech_id][clt->clb.stepBlock].push_back(clt);
+                    clt = pushLoopTrack(lc, npe);
                 }
                 
                 // resize will not shrink
@@ -908,30 +1427,6 @@ pct_event EventLib::createContechEvent(FILE* fptr)
         break;
     }
     
-    // If this is a basic block, then record all of the prior space
-    if (npe->event_type == ct_event_basic_block)
-    {
-        if (lastBBIDPos > 0)
-        {
-            if (bb_info_table[lastBBID].totalBytes == 0)
-            {
-                bb_info_table[lastBBID].totalBytes = startSum - lastBBIDPos;
-            }
-        }
-        if (lastBBID < bb_count)
-        {
-            bb_info_table[lastBBID].count++;
-        }
-        
-        lastBBIDPos = startSum;
-    }
-    else if (npe->event_type == ct_event_delay ||
-             npe->event_type == ct_event_buffer)
-    {
-        // Do not record space across artificial events
-        lastBBIDPos = 0;
-    }
-    
     lastID = npe->contech_id;
     lastType = npe->event_type;
     if (npe->event_type == ct_event_basic_block)
@@ -972,14 +1467,200 @@ pct_event EventLib::createContechEvent(FILE* fptr)
 void EventLib::deleteContechEvent(pct_event e)
 {
     if (e == NULL) return;
-    if (e->event_type == ct_event_basic_block && e->bb.mem_op_array != NULL) free(e->bb.mem_op_array);
+    
+    // Arena events hold their memory ops inline
+    if (e->event_type == ct_event_basic_block && e->bb.mem_op_array != NULL && e->arena == NULL) free(e->bb.mem_op_array);
     if (e->event_type == ct_event_basic_block_info)
     {
         if (e->bbi.fun_name != NULL) free(e->bbi.fun_name);
         if (e->bbi.file_name != NULL) free(e->bbi.file_name);
         if (e->bbi.callFun_name != NULL) free(e->bbi.callFun_name);
     }    
-    free(e);
+    releaseEvent(e);
+}
+
+//
+// Return the storage of the event itself, without any arrays it references
+//
+void EventLib::releaseEvent(pct_event e)
+{
+    if (e->arena != NULL) e->arena->freeEvent(e);
+    else free(e);
+}
+
+EventArena::EventArena(bool isShared)
+{
+    for (unsigned int i = 0; i < numSizeClasses; i++)
+    {
+        freeList[i] = NULL;
+    }
+    liveEvents = 0;
+    detached = false;
+    shared = isShared;
+    if (shared) pthread_mutex_init(&lock, NULL);
+}
+
+EventArena::~EventArena()
+{
+    for (auto it = slabs.begin(), et = slabs.end(); it != et; ++it)
+    {
+        free(*it);
+    }
+    if (shared) pthread_mutex_destroy(&lock);
+}
+
+void EventArena::detach()
+{
+    if (shared) pthread_mutex_lock(&lock);
+    detached = true;
+    bool unused = (liveEvents == 0);
+    if (shared) pthread_mutex_unlock(&lock);
+    
+    if (unused) delete this;
+}
+
+EventArena::parena_slot EventArena::slotOf(pct_event e)
+{
+    return (parena_slot)(((char*)e) - offsetof(arena_slot, event));
+}
+
+//
+// Class 0 holds no memory ops, class k holds up to 2^(k-1)
+//
+unsigned int EventArena::sizeClassOf(unsigned int memOps)
+{
+    unsigned int sizeClass = 0;
+    while (memOps > 0 && (1U << sizeClass) < (memOps << 1))
+    {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+void EventArena::refill(unsigned int sizeClass)
+{
+    const size_t slabBytes = 64 * 1024;
+    size_t memOps = (sizeClass == 0) ? 0 : (1UL << (sizeClass - 1));
+    size_t slotSize = sizeof(arena_slot) + memOps * sizeof(ct_memory_op);
+    size_t count = slabBytes / slotSize;
+    if (count == 0) count = 1;
+    
+    char* slab = (char*) malloc(slotSize * count);
+    if (slab == NULL) return;
+    slabs.push_back(slab);
+    
+    for (size_t i = 0; i < count; i++)
+    {
+        parena_slot slot = (parena_slot)(slab + i * slotSize);
+        slot->sizeClass = sizeClass;
+        slot->next = freeList[sizeClass];
+        freeList[sizeClass] = slot;
+    }
+}
+
+pct_event EventArena::allocEvent(unsigned int memOps)
+{
+    unsigned int sizeClass = sizeClassOf(memOps);
+    assert(sizeClass < numSizeClasses);
+    
+    if (shared) pthread_mutex_lock(&lock);
+    if (freeList[sizeClass] == NULL)
+    {
+        refill(sizeClass);
+        if (freeList[sizeClass] == NULL) 
+        {
+            if (shared) pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+    }
+    
+    parena_slot slot = freeList[sizeClass];
+    freeList[sizeClass] = slot->next;
+    liveEvents++;
+    if (shared) pthread_mutex_unlock(&lock);
+    
+    slot->event.arena = this;
+    slot->event.bb.mem_op_array = (memOps > 0) ? (pct_memory_op)(slot + 1) : NULL;
+    
+    return &slot->event;
+}
+
+//
+// Ensure that the event can hold memOps inline.  The event may move, in which
+//   case its header is copied.  Blocks too large for any slot fall back to malloc.
+//   On failure, the event is freed and NULL is returned.
+//
+pct_event EventArena::resizeEvent(pct_event e, unsigned int memOps)
+{
+    parena_slot slot = slotOf(e);
+    unsigned int sizeClass = sizeClassOf(memOps);
+    pct_event ne = NULL;
+    
+    if (sizeClass <= slot->sizeClass)
+    {
+        e->bb.mem_op_array = (memOps > 0) ? (pct_memory_op)(slot + 1) : NULL;
+        return e;
+    }
+    
+    if (sizeClass < numSizeClasses)
+    {
+        ne = allocEvent(memOps);
+        if (ne != NULL)
+        {
+            pct_memory_op inlineOps = ne->bb.mem_op_array;
+            *ne = *e;
+            ne->arena = this;
+            ne->bb.mem_op_array = inlineOps;
+        }
+    }
+    else
+    {
+        ne = (pct_event) malloc(sizeof(ct_event));
+        if (ne != NULL)
+        {
+            *ne = *e;
+            ne->arena = NULL;
+            ne->bb.mem_op_array = (pct_memory_op) malloc(memOps * sizeof(ct_memory_op));
+        }
+    }
+    
+    freeEvent(e);
+    return ne;
+}
+
+void EventArena::freeEvent(pct_event e)
+{
+    parena_slot slot = slotOf(e);
+    
+    if (shared) pthread_mutex_lock(&lock);
+    slot->next = freeList[slot->sizeClass];
+    freeList[slot->sizeClass] = slot;
+    
+    assert(liveEvents > 0);
+    liveEvents--;
+    bool unused = (detached == true && liveEvents == 0);
+    if (shared) pthread_mutex_unlock(&lock);
+    
+    if (unused) delete this;
+}
+
+//
+// Find the contiguous range of memory ops starting at first.  Returns the number of
+//   ops in the range and sets bytes to the total length accessed from the first op's address.
+//
+unsigned int EventLib::getMemOpRange(const ct_basic_block* bb, unsigned int first, uint64_t* bytes)
+{
+    unsigned int last = first + 1;
+    uint64_t len = 1 << bb->mem_op_array[first].pow_size;
+    
+    while (last < bb->len && bb->mem_op_array[last].range_cont == 1)
+    {
+        len += 1 << bb->mem_op_array[last].pow_size;
+        last++;
+    }
+    
+    if (bytes != NULL) *bytes = len;
+    return last - first;
 }
 
 void EventLib::dumpAndTerminate(FILE *fh)
@@ -989,8 +1670,13 @@ void EventLib::dumpAndTerminate(FILE *fh)
     fstat(fileno(fh), &buf);
     fprintf(stderr, "%p - %d - %d - %lx - %ld - %lx\n", 
                     (void*)fh, ferror(fh), feof(fh), ftell(fh), fread(&d, 1, 1, fh), buf.st_size);
+    if (inBase != NULL)
+    {
+        fprintf(stderr, "%s input at %lx of %lx\n", (inMapped)?"Mapped":"Block", 
+                        (unsigned long)(inPos - inBase), (unsigned long)(inEnd - inBase));
+    }
     displayContechEventDebugInfo();
-    assert(0);
+    abort();
 }
 
 void EventLib::displayContechEventDiagInfo()
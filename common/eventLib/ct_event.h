@@ -3,10 +3,14 @@
 
 #include "../taskLib/ct_file.h"
 #include "ct_event_st.h"
+#include "ct_delta.h"
 #include <stdint.h>
 #include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 namespace contech
@@ -145,6 +149,8 @@ namespace contech
         ct_loop_memop clm;
     } ct_loop, *pct_loop;
     
+    class EventArena;
+    
     //
     // There are two ways to combine objects with common fields.
     //   1) Common fields in a single type that is the first field
@@ -156,6 +162,7 @@ namespace contech
     typedef struct _ct_event {
         unsigned int contech_id;
         ct_event_id event_type;
+        EventArena* arena;  // Owner of the event's storage, NULL if malloc'd
         
         union {
             ct_basic_block      bb;
@@ -177,6 +184,48 @@ namespace contech
         };
     } ct_event, *pct_event;
     
+    //
+    // Recycles event storage, so that decoding does not call malloc once the
+    //   arena has warmed up.  A basic block's memory ops are stored inline after
+    //   its event, in slots grouped by the power of two of the ops they hold.
+    //   A shared arena locks its free lists, so that events can be freed by
+    //   a thread other than the one decoding into the arena.
+    //
+    class EventArena
+    {
+        private:
+            static const unsigned int numSizeClasses = 17;
+            
+            typedef struct _arena_slot
+            {
+                struct _arena_slot* next;
+                unsigned int sizeClass;
+                ct_event event;
+                // Memory ops follow
+            } arena_slot, *parena_slot;
+            
+            parena_slot freeList[numSizeClasses];
+            std::vector<void*> slabs;
+            uint64_t liveEvents;
+            bool detached;
+            bool shared;
+            pthread_mutex_t lock;
+            
+            static parena_slot slotOf(pct_event);
+            static unsigned int sizeClassOf(unsigned int);
+            void refill(unsigned int);
+            ~EventArena();
+            
+        public:
+            EventArena(bool = false);
+            pct_event allocEvent(unsigned int);
+            pct_event resizeEvent(pct_event, unsigned int);
+            void freeEvent(pct_event);
+            
+            // The arena is deleted once every event it handed out has been freed
+            void detach();
+    };
+    
     class EventLib
     {
         private:
@@ -187,7 +236,6 @@ namespace contech
             unsigned int lastID;
             unsigned int lastBBID;
             unsigned int lastType;
-            uint64_t lastBBIDPos;
             uint32_t next_basic_block_id;
             
             typedef struct _ct_event_debug
@@ -232,9 +280,9 @@ namespace contech
             {
                 unsigned int len;
                 int32_t next_basic_block_id;
-                int count;
-                uint32_t totalBytes;
                 pinternal_memory_op_info mem_op_info;
+                uint64_t* mem_op_plan;  // Static bits of each op, if every op's address is in the trace
+                uint32_t recordedBytes; // Of the ops whose address is in the trace
             } internal_basic_block_info, *pinternal_basic_block_info;
             
             typedef struct _internal_loop_track
@@ -243,29 +291,122 @@ namespace contech
                 uint32_t preLoopId;
                 ct_loop_base clb;
                 std::vector<ct_addr_t> baseAddr;
+                _internal_loop_track* outerSameLoop;  // Hidden by this track in its context's lookups
+                _internal_loop_track* outerSameStep;
             } internal_loop_track, *pinternal_loop_track;
             
-            std::map<uint32_t, std::vector<pinternal_loop_track> > loopTrack;
-            std::map<uint32_t, std::map<uint32_t, std::vector<pinternal_loop_track> > > loopBlock;
+            // The open loops of one contech, innermost last
+            typedef struct _internal_loop_context
+            {
+                std::vector<pinternal_loop_track> stack;
+                std::unordered_map<uint32_t, pinternal_loop_track> byLoop;  // Innermost track of each loop
+                std::unordered_map<uint32_t, pinternal_loop_track> byStep;  // Innermost track stepped by each block
+            } internal_loop_context, *pinternal_loop_context;
+            
+            std::vector<pinternal_loop_context> loopContexts;  // By contech id
+            std::vector<uint32_t> stepBlockRefs;  // Open loops stepped by each block, in any context
+            std::vector<pinternal_loop_track> loopTrackPool;
+            
+            inline pinternal_loop_context getLoopContext(uint32_t ctid)
+            {
+                if (ctid < loopContexts.size() && loopContexts[ctid] != NULL) return loopContexts[ctid];
+                return createLoopContext(ctid);
+            }
+            pinternal_loop_context createLoopContext(uint32_t);
+            void resetLoopContext(pinternal_loop_context);
+            pinternal_loop_track pushLoopTrack(pinternal_loop_context, pct_event);
+            void popLoopTrack(pinternal_loop_context);
+            void freeLoopTracking();
             
             pinternal_basic_block_info bb_info_table;
+            
+            // The block info is owned by another EventLib, see shareBlockInfo
+            bool sharedInfo;
+            
+            // Basic block events are returned without their memory ops
+            bool skipMemOps;
+            uint32_t lastMemOpBytes;
+            
+            // Mirrors the writer's table of recorded addresses, from CONTECH_DELTA_VERSION
+            pct_delta_table deltaTable;
+            uint64_t readDeltaAddrSlow(pct_delta_entry, FILE*);
+            void skipDeltaAddrs(unsigned int, FILE*);
+            inline uint64_t readDeltaAddr(uint32_t bbid, uint32_t op, FILE* a)
+            {
+                pct_delta_entry e = ct_delta_lookup(deltaTable, bbid, op);
+                uint64_t addr;
+                unsigned int n;
+                if (a == inFile && (n = ct_delta_decode(deltaTable, e, inPos, inEnd - inPos, &addr)) != 0)
+                {
+                    inPos += n;
+                    sum += n;
+                    return addr;
+                }
+                return readDeltaAddrSlow(e, a);
+            }
+            
+            // Expands packed 6 byte addresses and merges in a block's static bits
+            typedef void (*expand_mem_ops_fn)(pct_memory_op, const uint8_t*, const uint64_t*, unsigned int);
+            expand_mem_ops_fn expandMemOps;
+            void compileDecodePlan(unsigned int);
             ct_addr_t* constGVAddr;
             int maxConstGVId;
             
+            // The trace is decoded from an in-memory span, which is either the whole
+            //   file mapped or the latest block read from the stream.
+            FILE* inFile;
+            uint8_t* inPos;
+            uint8_t* inEnd;
+            uint8_t* inBase;
+            size_t inLen;
+            bool inMapped;
+            
+            void attachInput(FILE*);
+            void releaseInput();
+            size_t readInputSlow(void*, size_t, FILE*);
+            const uint8_t* readInputSpan(size_t, FILE*);
+            std::vector<uint8_t> inScratch;
+            inline size_t readInput(void* x, size_t len, FILE* a)
+            {
+                if (a == inFile && (size_t)(inEnd - inPos) >= len)
+                {
+                    memcpy(x, inPos, len);
+                    inPos += len;
+                    return len;
+                }
+                return readInputSlow(x, len, a);
+            }
+            
             int unpack(uint8_t *buf, char const fmt[], ...);
             void dumpAndTerminate(FILE *fptr);
             void fread_check(void* x, size_t y, size_t z, FILE* a);
+            static void releaseEvent(pct_event);
     
         public:
             EventLib();
             ~EventLib();
             pct_event createContechEvent(FILE*);
+            pct_event createContechEvent(FILE*, EventArena*);
             static void deleteContechEvent(pct_event);
+            static unsigned int getMemOpRange(const ct_basic_block*, unsigned int, uint64_t*);
             void displayContechEventDebugInfo();
             void displayContechEventDiagInfo();
             void displayContechEventStats();
             void resetEventLib();
             uint64_t getSum() {return sum;}
+            // Bytes of the addresses read for the last basic block event
+            uint32_t getLastMemOpBytes() {return lastMemOpBytes;}
+            
+            // Only the control events are needed, basic blocks are returned with no memory ops
+            void setSkipMemOps(bool s) {skipMemOps = s;}
+            
+            // Support for decoding the buffer chunks of a mapped trace separately
+            bool isInputMapped(FILE*);
+            bool nextIsChunk();
+            const uint8_t* getInputSpan(size_t*);
+            void shareBlockInfo(EventLib*);
+            void setInputChunk(FILE*, const uint8_t*, size_t, unsigned int);
+            bool seekInput(FILE*, uint64_t);
     };
     
     
@@ -0,0 +1,210 @@
+#include "ct_event.h"
+#include <time.h>
+
+#include <vector>
+
+using namespace contech;
+
+//
+// Decode benchmark on a synthetic loop-heavy trace.  Each contech runs a nest of
+//   loops, and the innermost body's memory ops are mostly elided against the
+//   loops, so decoding is dominated by loop address reconstruction.
+//
+//   ct_event_bench [contechs] [chunks per contech] [loop depth]
+//
+
+// Per level of the nest: loop i has its preheader at block 2i and its body at 2i + 1
+#define BENCH_LOOP_OPS 2     // Elided ops of each level in the innermost body
+#define BENCH_RECORDED_OPS 2 // Ops of the innermost body that are in the trace
+#define BENCH_ITERATIONS 2048
+
+static void put(std::vector<uint8_t>& b, const void* v, size_t len)
+{
+    b.insert(b.end(), (const uint8_t*)v, (const uint8_t*)v + len);
+}
+
+static void put8(std::vector<uint8_t>& b, uint8_t v) {put(b, &v, sizeof(v));}
+static void put16(std::vector<uint8_t>& b, uint16_t v) {put(b, &v, sizeof(v));}
+static void put32(std::vector<uint8_t>& b, uint32_t v) {put(b, &v, sizeof(v));}
+static void put64(std::vector<uint8_t>& b, uint64_t v) {put(b, &v, sizeof(v));}
+
+static void putEventType(std::vector<uint8_t>& b, uint8_t type)
+{
+    put8(b, type);
+    put8(b, 0); put8(b, 0); put8(b, 0);
+}
+
+static void putBasicBlock(std::vector<uint8_t>& b, uint32_t id, unsigned int recorded, uint64_t addr)
+{
+    put8(b, id & 0x7f);
+    put16(b, id >> 7);
+    for (unsigned int i = 0; i < recorded; i++)
+    {
+        uint64_t a = addr + i * 8;
+        put(b, &a, 6);
+    }
+}
+
+static void writeHeader(FILE* f, unsigned int depth)
+{
+    std::vector<uint8_t> b;
+    uint32_t bbCount = 2 * depth;
+
+    put32(b, 0);
+    put32(b, ct_event_version);
+    put32(b, CONTECH_DELTA_VERSION - 1);  // Raw addresses
+    put32(b, bbCount);
+
+    putEventType(b, ct_event_rank);
+    put32(b, 0);
+
+    for (uint32_t id = 0; id < bbCount; id++)
+    {
+        put8(b, ct_event_basic_block_info);
+        put32(b, id);
+        put32(b, -1);   // Next block
+        put32(b, 0);    // Flags
+        put32(b, id);   // Line
+        put32(b, 4);    // Ops
+        put32(b, 2);    // Critical path
+        put32(b, 5); put(b, "bench", 5);
+        put32(b, 5); put(b, "bench", 5);
+        put32(b, 0);
+
+        // Only the innermost body has memory ops
+        if (id != bbCount - 1)
+        {
+            put32(b, 0);
+            continue;
+        }
+
+        put32(b, depth * BENCH_LOOP_OPS + BENCH_RECORDED_OPS);
+        for (unsigned int l = 0; l < depth; l++)
+        {
+            for (unsigned int j = 0; j < BENCH_LOOP_OPS; j++)
+            {
+                put8(b, BBI_FLAG_MEM_LOOP | BBI_FLAG_MEM_DUP | (j & 0x1));
+                put8(b, 3);
+                put32(b, 8);        // IV size
+                put32(b, 2 * l);    // Header loop
+                put16(b, j);        // Loop memop
+                put32(b, 16 * j);   // Offset
+            }
+        }
+        for (unsigned int j = 0; j < BENCH_RECORDED_OPS; j++)
+        {
+            put8(b, j & 0x1);
+            put8(b, 3);
+        }
+    }
+
+    fwrite(b.data(), 1, b.size(), f);
+}
+
+static void writeChunk(FILE* f, uint32_t ctid, unsigned int depth, uint64_t seed)
+{
+    std::vector<uint8_t> b;
+
+    // Open the nest, each loop has an event per base address
+    for (unsigned int l = 0; l < depth; l++)
+    {
+        for (unsigned int j = 0; j < BENCH_LOOP_OPS; j++)
+        {
+            putEventType(b, ct_event_loop);
+            put8(b, 1);
+            put32(b, 2 * l);
+            put32(b, 1);        // Step
+            put32(b, 2 * l + 1);
+            put64(b, 0);        // Start value
+            put16(b, j);
+            put64(b, (seed << 24) + (l << 16) + (j << 12));
+        }
+    }
+
+    for (unsigned int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        putBasicBlock(b, 2 * depth - 1, BENCH_RECORDED_OPS, (seed << 24) + i * 8);
+
+        // Step the next loop out every few iterations
+        if (depth > 1 && (i % 16) == 15)
+        {
+            putBasicBlock(b, 2 * depth - 3, 0, 0);
+        }
+    }
+
+    for (unsigned int l = depth; l > 0; l--)
+    {
+        putEventType(b, ct_event_loop);
+        put8(b, 0);
+        put32(b, 2 * (l - 1));
+    }
+
+    uint32_t head[3] = {ct_event_buffer, ctid, (uint32_t)b.size()};
+    fwrite(head, sizeof(head), 1, f);
+    fwrite(b.data(), 1, b.size(), f);
+}
+
+static double elapsed(struct timespec* s)
+{
+    struct timespec e;
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    return (e.tv_sec - s->tv_sec) + (e.tv_nsec - s->tv_nsec) / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int contechs = (argc > 1) ? atoi(argv[1]) : 16;
+    unsigned int chunks = (argc > 2) ? atoi(argv[2]) : 64;
+    unsigned int depth = (argc > 3) ? atoi(argv[3]) : 4;
+    if (contechs == 0 || chunks == 0 || depth == 0)
+    {
+        fprintf(stderr, "Usage: %s [contechs] [chunks per contech] [loop depth]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* f = tmpfile();
+    if (f == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to create the benchmark trace\n");
+        return 1;
+    }
+
+    writeHeader(f, depth);
+    for (unsigned int c = 0; c < chunks; c++)
+    {
+        for (uint32_t ctid = 0; ctid < contechs; ctid++)
+        {
+            writeChunk(f, ctid, depth, ctid * chunks + c);
+        }
+    }
+    fflush(f);
+    rewind(f);
+
+    EventLib el;
+    EventArena* arena = new EventArena;
+    uint64_t events = 0, ops = 0, check = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (pct_event e = el.createContechEvent(f, arena))
+    {
+        if (e->event_type == ct_event_basic_block)
+        {
+            for (unsigned int i = 0; i < e->bb.len; i++)
+            {
+                check += e->bb.mem_op_array[i].addr;
+            }
+            ops += e->bb.len;
+        }
+        events++;
+        EventLib::deleteContechEvent(e);
+    }
+
+    double t = elapsed(&start);
+    printf("Decoded %lu events, %lu memory ops, %lu bytes in %f s\n", events, ops, el.getSum(), t);
+    printf("%f M events/s\t%f M ops/s\t%f MB/s\t(check %lx)\n", events / t / 1e6, ops / t / 1e6, el.getSum() / t / 1e6, check);
+
+    arena->detach();
+    fclose(f);
+    return 0;
+}
@@ -5,7 +5,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#define CONTECH_EVENT_VERSION 9
+#define CONTECH_EVENT_VERSION 10
+// From this version, the recorded addresses of memory ops are delta encoded, see ct_delta.h
+#define CONTECH_DELTA_VERSION 10
 
 typedef uint64_t ct_tsc_t;
 typedef uint64_t ct_addr_t;
@@ -19,6 +21,8 @@ typedef struct _ct_memory_op {
         uint64_t rank : 8;
         uint64_t is_write : 1;
         uint64_t pow_size : 3; // the size of the op is 2^pow_size
+        uint64_t range_cont : 1; // op continues the contiguous access of the previous op
+        uint64_t is_atomic : 1; // op is a thread-local atomic recorded as a memory op
     };
     uint64_t data;
     uint32_t data32[2];
@@ -60,5 +64,9 @@ typedef enum _ct_sync_type ct_sync_type;
 #define BBI_FLAG_MEM_DUP 0x2
 #define BBI_FLAG_MEM_GV 0x4
 #define BBI_FLAG_MEM_LOOP 0x8
+// Memory op accesses the bytes immediately following the previous memory op in the block
+#define BBI_FLAG_MEM_RANGE 0x10
+// Memory op is an atomic that the instrumentation proved to be thread-local
+#define BBI_FLAG_MEM_ATOMIC 0x20
 
 #endif
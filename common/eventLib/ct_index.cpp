@@ -0,0 +1,242 @@
+#include "ct_index.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <set>
+
+using namespace contech;
+using namespace std;
+
+// Identifies the sidecar file, followed by its format version
+#define CT_INDEX_MAGIC 0x58495443
+#define CT_INDEX_VERSION 1
+
+//
+// Start time of an event, or 0 for events that are not timed
+//
+static ct_tsc_t eventStartTime(pct_event e)
+{
+    switch (e->event_type)
+    {
+        case ct_event_sync: return e->sy.start_time;
+        case ct_event_barrier: return e->bar.start_time;
+        case ct_event_task_create: return e->tc.start_time;
+        case ct_event_task_join: return e->tj.start_time;
+        case ct_event_delay: return e->dly.start_time;
+        case ct_event_roi: return e->roi.start_time;
+        case ct_event_mpi_transfer: return e->mpixf.start_time;
+        case ct_event_mpi_wait: return e->mpiw.start_time;
+        default: return 0;
+    }
+}
+
+TraceIndex::TraceIndex()
+{
+    headerLen = 0;
+    traceLen = 0;
+}
+
+string TraceIndex::sidecarName(const char* trace)
+{
+    return string(trace) + ".idx";
+}
+
+//
+// Decode the whole trace from its start to build the index
+//
+bool TraceIndex::build(FILE* f)
+{
+    EventLib el;
+    int totalOpenLoops = 0;
+    set<unsigned int> pendingCreates;   // By the created contech
+
+    chunks.clear();
+    headerLen = 0;
+
+    while (true)
+    {
+        uint64_t offset = el.getSum();
+        pct_event e = el.createContechEvent(f);
+        if (e == NULL) break;
+
+        if (e->event_type == ct_event_buffer)
+        {
+            trace_chunk c;
+            memset(&c, 0, sizeof(c));
+            c.offset = offset;
+            c.contech_id = e->contech_id;
+            c.len = e->buf.pos;
+            c.minTicket = ~0ULL;
+            c.minBarrier = ~0ULL;
+            c.resumable = (totalOpenLoops == 0 && pendingCreates.empty());
+
+            if (chunks.empty()) headerLen = offset;
+            chunks.push_back(c);
+        }
+        else if (!chunks.empty())
+        {
+            trace_chunk& c = chunks.back();
+            c.events++;
+
+            switch (e->event_type)
+            {
+                case ct_event_sync:
+                {
+                    if (e->sy.ticketNum < c.minTicket) c.minTicket = e->sy.ticketNum;
+                    if (e->sy.ticketNum > c.maxTicket) c.maxTicket = e->sy.ticketNum;
+                }
+                break;
+                case ct_event_barrier:
+                {
+                    if (e->bar.barrierNum < c.minBarrier) c.minBarrier = e->bar.barrierNum;
+                    if (e->bar.barrierNum > c.maxBarrier) c.maxBarrier = e->bar.barrierNum;
+                }
+                break;
+                case ct_event_loop:
+                {
+                    totalOpenLoops += (e->loop.start) ? 1 : -1;
+                }
+                break;
+                case ct_event_task_create:
+                {
+                    // Each create is recorded by both the creator and the created contech
+                    unsigned int child = (e->tc.approx_skew == 0) ? e->tc.other_id : e->contech_id;
+                    if (e->tc.other_id == e->contech_id) break;
+                    if (pendingCreates.erase(child) == 0) pendingCreates.insert(child);
+                }
+                break;
+                default:
+                break;
+            }
+
+            ct_tsc_t t = eventStartTime(e);
+            if (t != 0)
+            {
+                if (c.firstTime == 0 || t < c.firstTime) c.firstTime = t;
+                if (t > c.lastTime) c.lastTime = t;
+            }
+        }
+
+        EventLib::deleteContechEvent(e);
+    }
+    traceLen = el.getSum();
+
+    // A chunk is only resumable if every earlier ticket and barrier precedes the later ones
+    vector<uint64_t> minTicketAfter(chunks.size() + 1, ~0ULL);
+    vector<uint64_t> minBarrierAfter(chunks.size() + 1, ~0ULL);
+    for (size_t i = chunks.size(); i > 0; i--)
+    {
+        minTicketAfter[i - 1] = min(minTicketAfter[i], chunks[i - 1].minTicket);
+        minBarrierAfter[i - 1] = min(minBarrierAfter[i], chunks[i - 1].minBarrier);
+    }
+
+    uint64_t nextTicket = 0, nextBarrier = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        chunks[i].resumeTicket = nextTicket;
+        chunks[i].resumeBarrier = nextBarrier;
+        if ((minTicketAfter[i] != ~0ULL && minTicketAfter[i] < nextTicket) ||
+            (minBarrierAfter[i] != ~0ULL && minBarrierAfter[i] < nextBarrier))
+        {
+            chunks[i].resumable = 0;
+        }
+
+        if (chunks[i].minTicket != ~0ULL) nextTicket = max(nextTicket, chunks[i].maxTicket + 1);
+        if (chunks[i].minBarrier != ~0ULL) nextBarrier = max(nextBarrier, chunks[i].maxBarrier + 1);
+    }
+
+    return !chunks.empty();
+}
+
+bool TraceIndex::write(const char* fileName)
+{
+    FILE* f = fopen(fileName, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Unable to write trace index: %s\n", fileName);
+        return false;
+    }
+
+    uint32_t head[2] = {CT_INDEX_MAGIC, CT_INDEX_VERSION};
+    uint64_t count = chunks.size();
+    ct_write(head, sizeof(head), f);
+    ct_write(&headerLen, sizeof(uint64_t), f);
+    ct_write(&traceLen, sizeof(uint64_t), f);
+    ct_write(&count, sizeof(uint64_t), f);
+    if (count > 0) ct_write(chunks.data(), sizeof(trace_chunk) * count, f);
+    fclose(f);
+
+    return true;
+}
+
+bool TraceIndex::read(const char* fileName)
+{
+    FILE* f = fopen(fileName, "rb");
+    if (f == NULL) return false;
+
+    uint32_t head[2] = {0, 0};
+    uint64_t count = 0;
+    bool valid = (ct_read(head, sizeof(head), f) == sizeof(head) &&
+                  head[0] == CT_INDEX_MAGIC &&
+                  head[1] == CT_INDEX_VERSION &&
+                  ct_read(&headerLen, sizeof(uint64_t), f) == sizeof(uint64_t) &&
+                  ct_read(&traceLen, sizeof(uint64_t), f) == sizeof(uint64_t) &&
+                  ct_read(&count, sizeof(uint64_t), f) == sizeof(uint64_t));
+    if (valid)
+    {
+        chunks.resize(count);
+        valid = (count == 0 ||
+                 ct_read(chunks.data(), sizeof(trace_chunk) * count, f) == sizeof(trace_chunk) * count);
+    }
+    fclose(f);
+
+    if (!valid)
+    {
+        fprintf(stderr, "Invalid trace index: %s\n", fileName);
+        chunks.clear();
+    }
+    return valid;
+}
+
+//
+// Does the index describe this trace, as far as its length can tell
+//
+bool TraceIndex::matches(FILE* trace)
+{
+    struct stat st;
+    if (fstat(fileno(trace), &st) != 0) return false;
+    return ((uint64_t)st.st_size == traceLen);
+}
+
+//
+// The last resumable chunk at or before chunk k
+//
+size_t TraceIndex::findResumeChunk(size_t k)
+{
+    if (chunks.empty()) return 0;
+    if (k >= chunks.size()) k = chunks.size() - 1;
+    while (k > 0 && chunks[k].resumable == 0) k--;
+    return k;
+}
+
+//
+// Find the chunks [first, end) that cover the times from t0 to t1.  first is resumable.
+//
+void TraceIndex::getTimeWindow(ct_tsc_t t0, ct_tsc_t t1, size_t* first, size_t* end)
+{
+    size_t f = 0, e = 0;
+
+    while (f < chunks.size() && chunks[f].lastTime < t0) f++;
+    f = findResumeChunk(f);
+
+    for (size_t i = f; i < chunks.size(); i++)
+    {
+        if (chunks[i].firstTime != 0 && chunks[i].firstTime > t1) break;
+        e = i + 1;
+    }
+    if (e < f) e = f;
+
+    *first = f;
+    *end = e;
+}
@@ -0,0 +1,51 @@
+#ifndef CT_INDEX_H
+#define CT_INDEX_H
+
+#include "ct_event.h"
+
+#include <string>
+#include <vector>
+
+namespace contech
+{
+    //
+    // Sidecar index of the buffer chunks in a trace.  Built by decoding the trace once,
+    //   it lets a reader seek to a chunk instead of decoding everything before it.
+    //
+    //   A chunk is resumable when decoding can start there with only the trace header:
+    //   no contech has an open loop, no task create is split across the boundary, and
+    //   every earlier ticket and barrier number precedes every later one.
+    //
+    class TraceIndex
+    {
+        public:
+            typedef struct _trace_chunk
+            {
+                uint64_t offset;        // Of the chunk's buffer event in the trace
+                uint32_t contech_id;
+                uint32_t len;           // Bytes following the buffer event
+                uint64_t events;        // Not counting the buffer event
+                uint64_t minTicket, maxTicket;    // ~0 and 0 if no sync in the chunk
+                uint64_t minBarrier, maxBarrier;  // ~0 and 0 if no barrier in the chunk
+                ct_tsc_t firstTime, lastTime;     // Of timed events, 0 if none
+                uint64_t resumeTicket;  // Next ticket and barrier when starting here
+                uint64_t resumeBarrier;
+                uint32_t resumable;
+            } trace_chunk, *ptrace_chunk;
+
+            std::vector<trace_chunk> chunks;
+            uint64_t headerLen;   // Offset of the first chunk
+            uint64_t traceLen;
+
+            TraceIndex();
+            static std::string sidecarName(const char*);
+            bool build(FILE*);
+            bool write(const char*);
+            bool read(const char*);
+            bool matches(FILE*);
+            size_t findResumeChunk(size_t);
+            void getTimeWindow(ct_tsc_t, ct_tsc_t, size_t*, size_t*);
+    };
+}
+
+#endif
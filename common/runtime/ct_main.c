@@ -3,6 +3,7 @@
 #define __USE_GNU
 #endif
 #include "ct_runtime.h"
+#include "../eventLib/ct_delta.h"
 #include "rdtsc.h"
 #include <stdlib.h>
 #include <pthread.h>
@@ -197,6 +198,163 @@ int main(int argc, char** argv)
 
 static size_t totalWritten = 0;
 static unsigned int maxBuffersAlloc = 0;
+
+//
+// Delta encoding of the recorded addresses, enabled by CONTECH_DELTA_ADDR.
+//   The writer walks each buffer with the block info to find the addresses, as
+//   the instrumentation stores them at fixed offsets while the program runs.
+//
+static int32_t* __ctDeltaNext = NULL;        // Block whose event may follow with no id, or -1
+static uint32_t* __ctDeltaRecorded = NULL;   // Ops whose address is in the trace
+static unsigned int __ctDeltaBlocks = 0;
+
+static uint32_t __ctDeltaRead32(uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+//
+// Read the recorded op count and next block of each block from the info laid out by the pass
+//
+static void __ctDeltaLoadInfo(uint8_t* bb_info, uint8_t* end)
+{
+    __ctDeltaBlocks = __ctDeltaRead32(bb_info);
+    __ctDeltaNext = (int32_t*) malloc(sizeof(int32_t) * (__ctDeltaBlocks + 1));
+    __ctDeltaRecorded = (uint32_t*) calloc(__ctDeltaBlocks + 1, sizeof(uint32_t));
+    if (__ctDeltaNext == NULL || __ctDeltaRecorded == NULL)
+    {
+        fprintf(stderr, "Failure to allocate the delta encoding tables\n");
+        exit(-1);
+    }
+    memset(__ctDeltaNext, 0xff, sizeof(int32_t) * (__ctDeltaBlocks + 1));
+    
+    bb_info += 4;
+    while (bb_info < end)
+    {
+        // type, id, next id, flags, line, ops, critical path, then 3 strings
+        uint32_t id = __ctDeltaRead32(bb_info + 1);
+        int32_t nbi = (int32_t)__ctDeltaRead32(bb_info + 5);
+        uint32_t i, len;
+        
+        bb_info += 1 + 6 * sizeof(uint32_t);
+        for (i = 0; i < 3; i++)
+        {
+            bb_info += sizeof(uint32_t) + __ctDeltaRead32(bb_info);
+        }
+        
+        len = __ctDeltaRead32(bb_info);
+        bb_info += sizeof(uint32_t);
+        if (id >= __ctDeltaBlocks)
+        {
+            fprintf(stderr, "Basic block info for %u exceeds the block count %u\n", id, __ctDeltaBlocks);
+            exit(-1);
+        }
+        __ctDeltaNext[id] = nbi;
+        
+        for (i = 0; i < len; i++)
+        {
+            char memFlags = bb_info[0];
+            bb_info += 2;
+            if ((memFlags & BBI_FLAG_MEM_LOOP) == BBI_FLAG_MEM_LOOP)
+            {
+                bb_info += 2 * sizeof(uint32_t) + sizeof(uint16_t) + sizeof(int);
+            }
+            else if ((memFlags & (BBI_FLAG_MEM_DUP | BBI_FLAG_MEM_GV)) != 0)
+            {
+                bb_info += sizeof(uint16_t) + sizeof(int);
+            }
+            else
+            {
+                __ctDeltaRecorded[id]++;
+            }
+        }
+    }
+}
+
+//
+// Size of a non basic block event in a thread's buffer, or 0 if it should not be there
+//
+static unsigned int __ctDeltaEventSize(uint8_t* p)
+{
+    switch (p[0])
+    {
+        case ct_event_memory: return 21;
+        case ct_event_sync: return 40;
+        case ct_event_barrier: return 37;
+        case ct_event_task_create: return 32;
+        case ct_event_task_join: return 25;
+        case ct_event_bulk_memory_op: return 28;
+        case ct_event_delay: return 20;
+        case ct_event_mpi_transfer: return 54;
+        case ct_event_mpi_wait: return 28;
+        case ct_event_roi: return 1 + sizeof(ct_tsc_t);
+        case ct_event_loop: return (p[4] != 0) ? 35 : 9;
+        default: return 0;
+    }
+}
+
+//
+// Copy the len bytes of a buffer to dst with each recorded address delta encoded.
+//   dst must hold len * 7 / 6 bytes.  Returns the bytes in dst.
+//
+static unsigned int __ctDeltaEncodeBuffer(uint8_t* src, unsigned int len, uint8_t* dst, pct_delta_table t)
+{
+    unsigned int p = 0, q = 0;
+    int32_t chain = -1;
+    
+    ct_delta_reset(t);
+    while (p < len)
+    {
+        uint32_t id, i;
+        
+        if (chain != -1)
+        {
+            id = chain;
+        }
+        else if (src[p] < ct_event_basic_block_info)
+        {
+            uint16_t high;
+            memcpy(&high, src + p + 1, sizeof(high));
+            id = src[p] | (((uint32_t)high) << 7);
+            memcpy(dst + q, src + p, 3);
+            p += 3;
+            q += 3;
+        }
+        else
+        {
+            unsigned int sz = __ctDeltaEventSize(src + p);
+            if (sz == 0 || p + sz > len)
+            {
+                fprintf(stderr, "Unable to delta encode event %d at %u of %u in buffer\n", src[p], p, len);
+                exit(-1);
+            }
+            memcpy(dst + q, src + p, sz);
+            p += sz;
+            q += sz;
+            continue;
+        }
+        
+        if (id >= __ctDeltaBlocks)
+        {
+            fprintf(stderr, "Unable to delta encode block %u at %u of %u in buffer\n", id, p, len);
+            exit(-1);
+        }
+        
+        for (i = 0; i < __ctDeltaRecorded[id]; i++)
+        {
+            uint64_t addr = 0;
+            memcpy(&addr, src + p, 6);
+            q += ct_delta_encode(t, ct_delta_lookup(t, id, i), addr, dst + q);
+            p += 6;
+        }
+        chain = __ctDeltaNext[id];
+    }
+    
+    return q;
+}
+
 void* __ctBackgroundThreadWriter(void* d)
 {
     FILE* serialFile;
@@ -208,6 +366,9 @@ void* __ctBackgroundThreadWriter(void* d)
     unsigned long long totalLimitTime = 0, startLimitTime, endLimitTime;
     int mpiRank = __ctGetMPIRank();
     int mpiPresent = __ctIsMPIPresent();
+    bool deltaAddr = (getenv("CONTECH_DELTA_ADDR") != NULL);
+    pct_delta_table deltaTable = NULL;
+    uint8_t* deltaBuffer = NULL;
     // TODO: Create MPI event
     // TODO: Modify filename with MPI rank
     // TODO: Only do the above when MPI is present
@@ -243,9 +404,21 @@ void* __ctBackgroundThreadWriter(void* d)
     {
         unsigned int id = 0;
         ct_event_id ty = ct_event_version;
-        unsigned int version = CONTECH_EVENT_VERSION;
+        unsigned int version = (deltaAddr) ? CONTECH_EVENT_VERSION : CONTECH_DELTA_VERSION - 1;
         uint8_t* bb_info = _binary_contech_bin_start;
         
+        if (deltaAddr)
+        {
+            __ctDeltaLoadInfo(_binary_contech_bin_start, _binary_contech_bin_end);
+            deltaTable = (pct_delta_table) malloc(sizeof(ct_delta_table));
+            deltaBuffer = (uint8_t*) malloc(SERIAL_BUFFER_SIZE + SERIAL_BUFFER_SIZE / 6 + CT_DELTA_MAX_BYTES);
+            if (deltaTable == NULL || deltaBuffer == NULL)
+            {
+                fprintf(stderr, "Failure to allocate the delta encoding buffer\n");
+                exit(-1);
+            }
+        }
+        
         fwrite(&id, sizeof(unsigned int), 1, serialFile); 
         fwrite(&ty, sizeof(unsigned int), 1, serialFile);
         fwrite(&version, sizeof(unsigned int), 1, serialFile);
@@ -327,6 +500,14 @@ void* __ctBackgroundThreadWriter(void* d)
             size_t tl = 0;
             size_t wl = 0;
             pct_serial_buffer qb = __ctQueuedBuffers;
+            char* wdata = qb->data;
+            unsigned int wlen = qb->basePos;
+            
+            if (deltaAddr)
+            {
+                wlen = __ctDeltaEncodeBuffer((uint8_t*)qb->data, qb->pos, deltaBuffer, deltaTable);
+                wdata = (char*)deltaBuffer;
+            }
             
             // First craft the marker event that indicates a new buffer in the event list
             //   This event tells eventLib which contech created the next set of bytes
@@ -334,7 +515,7 @@ void* __ctBackgroundThreadWriter(void* d)
                 unsigned int buf[3];
                 buf[0] = ct_event_buffer;
                 buf[1] = __ctQueuedBuffers->id;
-                buf[2] = __ctQueuedBuffers->basePos;
+                buf[2] = wlen;
                 //fprintf(stderr, "%d, %llx, %d\n", __ctQueuedBuffers->id, totalWritten, __ctQueuedBuffers->pos);
                 do
                 {
@@ -366,11 +547,11 @@ void* __ctBackgroundThreadWriter(void* d)
             {
                 fprintf(stderr, "Illegal buffer size - %d\n", qb->pos);
             }
-            while (tl < __ctQueuedBuffers->pos)
+            while (tl < wlen)
             {
-                wl = fwrite(__ctQueuedBuffers->data + tl, 
+                wl = fwrite(wdata + tl, 
                             sizeof(char), 
-                            (__ctQueuedBuffers->pos) - tl, 
+                            wlen - tl, 
                             serialFile);
                 // if (wl < 0)
                 // {
@@ -382,9 +563,9 @@ void* __ctBackgroundThreadWriter(void* d)
                     fprintf(stderr, "Tampering with __ctQueuedBuffers!\n");
                 }
             }
-            if (tl != __ctQueuedBuffers->pos)
+            if (tl != wlen)
             {
-                fprintf(stderr, "Write quantity(%lu) is not bytes in buffer(%d)\n", tl, __ctQueuedBuffers->pos);
+                fprintf(stderr, "Write quantity(%lu) is not bytes in buffer(%d)\n", tl, wlen);
             }
             totalWritten += tl;
             
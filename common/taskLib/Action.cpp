@@ -11,6 +11,7 @@ Action::Action(BasicBlockAction a) : data(a.data) {};
 Action::Action(MemoryAction a) : data(a.data) {};
 action_type Action::getType() const { return (action_type)type; }
 bool Action::isMemOp() const { return type == action_type_mem_read || type == action_type_mem_write; }
+bool Action::isMemRange() const { return isMemOp() && MemoryAction(*this).is_range == 1; }
 bool Action::isMemoryAction() const { return type != action_type_basicBlock; }
 bool Action::isBasicBlockAction() const { return type == action_type_basicBlock; }
 bool Action::operator==(const Action& rhs) const { return data == rhs.data; }
@@ -34,13 +35,13 @@ std::string Action::toString() const
         case action_type_mem_write:
         {
             MemoryAction mem = *this;
-            out << " ST " << std::hex << mem.addr;
+            out << (mem.is_range ? " ST range " : " ST ") << (mem.is_atomic ? "atomic " : "") << std::hex << mem.addr;
             break;
         }
         case action_type_mem_read:
         {
             MemoryAction mem = *this;
-            out << " LD " << std::hex << mem.addr;
+            out << (mem.is_range ? " LD range " : " LD ") << std::hex << mem.addr;
             break;
         }
         case action_type_malloc:
@@ -18,7 +18,7 @@ enum action_type
     action_type_mem_write = 2,
     action_type_free = 3,
     action_type_malloc = 4,
-    action_type_size = 5,
+    action_type_size = 5, // follows malloc, memcpy and range read / write actions
     action_type_basicBlock = 6,
     action_type_memcpy = 7
     // If you add more action types, recheck the methods of Action to ensure no assumptions are broken
@@ -32,7 +32,8 @@ struct MemoryAction
     union {
         struct {
             uint64_t addr : 48;
-            uint64_t resrv : 2;
+            uint64_t is_range : 1; // read / write is followed by a size action with its length in bytes
+            uint64_t is_atomic : 1; // write is an atomic that did not require a sync task
             uint64_t rank : 8;
             uint64_t pow_size : 3; // the size of the read or write is 2^pow_size
             uint64_t type : 3;
@@ -79,6 +80,7 @@ struct Action
     Action(MemoryAction a);
     action_type getType() const;
     bool isMemOp() const;
+    bool isMemRange() const;
     bool isMemoryAction() const;
     bool isBasicBlockAction() const;
     bool operator==(const Action& rhs) const;
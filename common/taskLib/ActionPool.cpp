@@ -0,0 +1,63 @@
+#include "ActionPool.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+using namespace std;
+using namespace contech;
+
+ActionPool::ActionPool()
+{
+    pthread_mutex_init(&lock, NULL);
+    allocated = 0;
+}
+
+ActionPool::~ActionPool()
+{
+    // Chunks still held by tasks are not freed
+    for (Action* c : freeChunks)
+    {
+        free(c);
+    }
+    pthread_mutex_destroy(&lock);
+}
+
+Action* ActionPool::getChunk()
+{
+    Action* c = NULL;
+
+    pthread_mutex_lock(&lock);
+    if (!freeChunks.empty())
+    {
+        c = freeChunks.back();
+        freeChunks.pop_back();
+    }
+    else
+    {
+        allocated++;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (c == NULL)
+    {
+        c = (Action*) malloc(ACTION_CHUNK_SIZE * sizeof(Action));
+        
+        // The caller may recover, as middle does by splitting the task
+        if (c == NULL)
+        {
+            pthread_mutex_lock(&lock);
+            allocated--;
+            pthread_mutex_unlock(&lock);
+            throw std::bad_alloc();
+        }
+    }
+
+    return c;
+}
+
+void ActionPool::putChunk(Action* c)
+{
+    pthread_mutex_lock(&lock);
+    freeChunks.push_back(c);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,40 @@
+#ifndef ACTION_POOL_HPP
+#define ACTION_POOL_HPP
+
+#include "Action.hpp"
+#include <assert.h>
+#include <pthread.h>
+#include <vector>
+
+namespace contech {
+
+// Actions in each chunk, tasks smaller than this keep their actions in a vector
+#define ACTION_CHUNK_SIZE 4096
+
+//
+// Fixed size chunks of actions for tasks that are still being recorded.  A task's
+//   actions grow by whole chunks, so they are never reallocated and copied, and the
+//   chunks of written tasks are reused by the tasks that follow.
+//
+class ActionPool
+{
+public:
+    ActionPool();
+    ~ActionPool();
+
+    // Throws std::bad_alloc if a new chunk cannot be allocated
+    Action* getChunk();
+    void putChunk(Action* c);
+
+    size_t getAllocatedChunks() const {return allocated;}
+
+private:
+    // Chunks are taken and returned by the recording workers and the writer
+    pthread_mutex_t lock;
+    std::vector<Action*> freeChunks;
+    size_t allocated;
+};
+
+}
+
+#endif
@@ -4,6 +4,8 @@
 using namespace std;
 using namespace contech;
 
+ActionPool* Task::actionPool = NULL;
+
 // TODO Remove default constructor
 Task::Task()
 {
@@ -22,12 +24,56 @@ Task::Task(TaskId taskId, task_type type)
     p.clear();
 }
 
+// Copies hold their actions in a, so that no chunk has two owners
+Task::Task(const Task& t)
+{
+    *this = t;
+}
+
+Task& Task::operator=(const Task& t)
+{
+    if (this == &t) return *this;
+
+    taskId = t.taskId;
+    startTime = t.startTime;
+    endTime = t.endTime;
+    s = t.s;
+    p = t.p;
+    type = t.type;
+    syncType = t.syncType;
+    bbCount = t.bbCount;
+
+    releaseChunks();
+    a.clear();
+    a.reserve(t.getActionCount());
+    vector<pair<const Action*, size_t> > runs;
+    t.getActionRuns(runs);
+    for (auto r : runs)
+    {
+        a.insert(a.end(), r.first, r.first + r.second);
+    }
+
+    return *this;
+}
+
+Task::~Task()
+{
+    releaseChunks();
+}
+
 bool Task::operator==(const Task& rhs) const
 {
+    vector<pair<const Action*, size_t> > runs, rhsRuns;
+    getActionRuns(runs);
+    rhs.getActionRuns(rhsRuns);
+    vector<Action> all, rhsAll;
+    for (auto r : runs) all.insert(all.end(), r.first, r.first + r.second);
+    for (auto r : rhsRuns) rhsAll.insert(rhsAll.end(), r.first, r.first + r.second);
+
     return  taskId == rhs.taskId &&
             startTime == rhs.startTime &&
             endTime == rhs.endTime &&
-            a == rhs.a &&
+            all == rhsAll &&
             s == rhs.s &&
             p == rhs.p &&
             type == rhs.type;
@@ -54,6 +100,8 @@ void Task::appendTask(Task* app, vector<Task*>* app_t)
     // Tasks are the same type and this is pred to app
     assert(type == app->type &&
            (find(app->p.begin(), app->p.end(), taskId) != app->p.end()));
+    flattenActions();
+    app->flattenActions();
     a.insert(a.end(), app->a.begin(), app->a.end());
     bbCount += app->bbCount;
     s = app->s;
@@ -142,61 +190,201 @@ bool Task::removeTask(Task* rem, vector<Task*>* p, vector<Task*>* s)
 void Task::recordMemOpAction(bool is_write, short pow_size, uint64 addr)
 {
     MemoryAction mem;
+    mem.data = 0;
     mem.type = is_write ? action_type_mem_write : action_type_mem_read;
     mem.pow_size = pow_size;
     mem.addr = addr;
-    this->a.push_back(mem);
+    *appendActions(1) = mem;
+}
+
+// Record a contiguous run of loads or stores as a single access of size bytes
+void Task::recordMemRangeAction(bool is_write, uint64 addr, uint64 size)
+{
+    Action* r = appendActions(2);
+    MemoryAction mem;
+    mem.data = 0;
+    mem.type = is_write ? action_type_mem_write : action_type_mem_read;
+    mem.is_range = 1;
+    mem.addr = addr;
+    r[0] = mem;
+    mem.data = 0;
+    mem.type = action_type_size;
+    mem.addr = size;
+    r[1] = mem;
+}
+
+// Record an atomic that is not represented by its own sync task
+void Task::recordAtomicMemOpAction(short pow_size, uint64 addr)
+{
+    MemoryAction mem;
+    mem.data = 0;
+    mem.type = action_type_mem_write;
+    mem.is_atomic = 1;
+    mem.pow_size = pow_size;
+    mem.addr = addr;
+    *appendActions(1) = mem;
 }
 
 // Record that a malloc occurred in this task
 void Task::recordMallocAction(uint64 addr, uint64 size)
 {
+    Action* r = appendActions(2);
     MemoryAction mem;
+    mem.data = 0;
     mem.type = action_type_malloc;
     mem.addr = addr;
-    this->a.push_back(mem);
+    r[0] = mem;
     mem.type = action_type_size;
     mem.addr = size;
-    this->a.push_back(mem);
+    r[1] = mem;
 }
 
 // Record that a free occurred in this task
 void Task::recordFreeAction(uint64 addr)
 {
     MemoryAction mem;
+    mem.data = 0;
     mem.type = action_type_free;
     mem.addr = addr;
-    this->a.push_back(mem);
+    *appendActions(1) = mem;
 }
 
 void Task::recordMemCpyAction(uint64 size, uint64 dst, uint64 src)
 {
+    Action* r = appendActions(3);
     MemoryAction mem;
+    mem.data = 0;
     mem.type = action_type_memcpy;
     mem.addr = dst;
-    this->a.push_back(mem);
+    r[0] = mem;
     mem.addr = src;
-    this->a.push_back(mem);
+    r[1] = mem;
     mem.type = action_type_size;
     mem.addr = size;
-    this->a.push_back(mem);
+    r[2] = mem;
 }
 
 // Record that a basic block occurred in this task
 void Task::recordBasicBlockAction(uint id)
 {
     BasicBlockAction bb;
+    bb.data = 0;
     bb.type = action_type_basicBlock;
     bb.basic_block_id = id;
-    this->a.push_back(bb);
+    *appendActions(1) = bb;
     bbCount++;
 }
 
+void Task::setActionPool(ActionPool* pool) { actionPool = pool; }
+
+// Return space for the next n actions, which may not be more than a chunk.  Actions
+//   stay in a until it would pass a chunk, unless there is no pool.
+Action* Task::appendActions(uint n)
+{
+    if (chunks.empty() && (actionPool == NULL || a.size() + n <= ACTION_CHUNK_SIZE))
+    {
+        size_t o = a.size();
+        a.resize(o + n);
+        return &a[o];
+    }
+
+    assert(n <= ACTION_CHUNK_SIZE);
+    if (chunks.empty() || chunks.back().used + n > ACTION_CHUNK_SIZE) addChunk();
+    action_chunk& c = chunks.back();
+    Action* r = c.actions + c.used;
+    c.used += n;
+    return r;
+}
+
+void Task::reserveActions(uint n)
+{
+    if (n > ACTION_CHUNK_SIZE) return;
+    if (chunks.empty() && (actionPool == NULL || a.size() + n <= ACTION_CHUNK_SIZE))
+    {
+        if (a.capacity() < a.size() + n) a.reserve(max(a.size() + n, 2 * a.capacity()));
+        return;
+    }
+
+    // The rest of the last chunk is left unused
+    if (chunks.empty() || chunks.back().used + n > ACTION_CHUNK_SIZE) addChunk();
+}
+
+void Task::addChunk()
+{
+    assert(actionPool != NULL);
+    action_chunk c;
+    c.actions = actionPool->getChunk();
+    c.used = 0;
+    chunks.push_back(c);
+}
+
+// Move the actions in chunks to the end of a
+void Task::flattenActions()
+{
+    if (chunks.empty()) return;
+
+    a.reserve(getActionCount());
+    for (action_chunk& c : chunks)
+    {
+        a.insert(a.end(), c.actions, c.actions + c.used);
+    }
+    releaseChunks();
+}
+
+void Task::releaseChunks()
+{
+    if (chunks.empty()) return;
+
+    assert(actionPool != NULL);
+    for (action_chunk& c : chunks)
+    {
+        actionPool->putChunk(c.actions);
+    }
+    vector<action_chunk>().swap(chunks);
+}
+
+uint64 Task::getActionCount() const
+{
+    uint64 count = a.size();
+    for (const action_chunk& c : chunks)
+    {
+        count += c.used;
+    }
+    return count;
+}
+
+uint64 Task::getActionBytes() const
+{
+    return (a.capacity() + chunks.size() * ACTION_CHUNK_SIZE) * sizeof(Action);
+}
+
+void Task::getActionRuns(vector<pair<const Action*, size_t> >& runs) const
+{
+    runs.clear();
+    if (!a.empty()) runs.push_back(make_pair(a.data(), a.size()));
+    for (const action_chunk& c : chunks)
+    {
+        if (c.used > 0) runs.push_back(make_pair((const Action*)c.actions, (size_t)c.used));
+    }
+}
+
+void Task::clearActions()
+{
+    vector<Action>().swap(a);
+    releaseChunks();
+}
+
 // Get all the actions that occurred in this task
-vector<Action>& Task::getActions() { return a; }
+vector<Action>& Task::getActions() { flattenActions(); return a; }
+
+uint64_t Task::getAccessSize(vector<Action>::const_iterator a)
+{
+    if (a->isMemRange()) return MemoryAction(*(a + 1)).addr;
+    return 1ULL << MemoryAction(*a).pow_size;
+}
 
 // Get all the memOps (reads/writes) that occurred in this task
-Task::memOpCollection Task::getMemOps() { return memOpCollection(a.begin(), a.end()); }
+Task::memOpCollection Task::getMemOps() { flattenActions(); return memOpCollection(a.begin(), a.end()); }
 
 Task::memOpCollection::memOpCollection(){}
 Task::memOpCollection::memOpCollection(vector<Action>::iterator f, vector<Action>::iterator e) : first(f), last(e)
@@ -214,7 +402,7 @@ uint Task::memOpCollection::size()
 }
 
 // Get all the memory actions that occurred in this task
-Task::memoryActionCollection Task::getMemoryActions() { return memoryActionCollection(a.begin(), a.end()); }
+Task::memoryActionCollection Task::getMemoryActions() { flattenActions(); return memoryActionCollection(a.begin(), a.end()); }
 
 Task::memoryActionCollection::memoryActionCollection(){}
 Task::memoryActionCollection::memoryActionCollection(vector<Action>::iterator f, vector<Action>::iterator e) : first(f), last(e)
@@ -232,7 +420,7 @@ uint Task::memoryActionCollection::size()
 }
 
 // Get all the basic block actions that occurred in this task
-Task::basicBlockActionCollection Task::getBasicBlockActions() { return basicBlockActionCollection(a.begin(), a.end()); }
+Task::basicBlockActionCollection Task::getBasicBlockActions() { flattenActions(); return basicBlockActionCollection(a.begin(), a.end()); }
 
 Task::basicBlockActionCollection::basicBlockActionCollection(){}
 Task::basicBlockActionCollection::basicBlockActionCollection(vector<Action>::iterator f, vector<Action>::iterator e) : first(f), last(e)
@@ -395,9 +583,21 @@ Task* Task::readContechTaskUnlock(FILE* in)
 
 // Serialize a Task to a file
 size_t Task::writeContechTask(Task& task, FILE* out)
+{
+    vector<uint8_t> record;
+    size_t recordSize = encodeContechTask(task, record);
+    
+    ct_write(record.data(), record.size(), out);
+    
+    return recordSize;
+}
+
+// Serialize and compress a Task into the bytes of its record in a file
+//   Touches no shared state, so tasks can be encoded concurrently
+size_t Task::encodeContechTask(Task& task, vector<uint8_t>& record)
 {
     // Calculate record length
-    uint asize = task.a.size();
+    uint asize = task.getActionCount();
     uint ssize = task.s.size();
     uint psize = task.p.size();
 
@@ -429,11 +629,9 @@ size_t Task::writeContechTask(Task& task, FILE* out)
     assert(recordLength < ((unsigned long long)2 * 1024 * 1024 * 1024));
         
     unsigned char* src = (unsigned char*) malloc(recordLength);
-    unsigned char* dst = (unsigned char*) malloc(recordLength+12);
     uint srcPos = 0;
         
     assert(src != NULL);
-    assert(dst != NULL);
     
     if (task.type == task_type_join)
         assert(task.p.size() > task.s.size());
@@ -464,12 +662,14 @@ size_t Task::writeContechTask(Task& task, FILE* out)
     //ct_write(&asize, sizeof(uint), out);
     memcpy(src + srcPos, &asize, sizeof(uint));
     srcPos += sizeof(uint);
-    // action list
-    for (Action a : task.a)
+    // action list, copied a run at a time from the vector and any chunks
+    vector<pair<const Action*, size_t> > runs;
+    task.getActionRuns(runs);
+    for (auto r : runs)
     {
         //ct_write(&a.data, sizeof(uint64), out);
-        memcpy(src + srcPos, &a.data, sizeof(uint64));
-        srcPos += sizeof(uint64);
+        memcpy(src + srcPos, r.first, r.second * sizeof(uint64));
+        srcPos += r.second * sizeof(uint64);
     }
 
     // Size of s list
@@ -509,20 +709,80 @@ size_t Task::writeContechTask(Task& task, FILE* out)
     //memcpy(src + srcPos, &task.fileOffset, sizeof(uint64));
     //srcPos += sizeof(uint64);
     
+    // The record is its length, its compressed length, and then the compressed task
     uint64 dstLen = recordLength + 12;
-    compress(dst, (uLongf*)&dstLen, src, recordLength);
-    ct_write(&recordLength, sizeof(recordLength), out);
-    ct_write(&dstLen, sizeof(dstLen), out);
-    ct_write(dst, dstLen, out);
+    size_t headerLen = sizeof(recordLength) + sizeof(dstLen);
+    record.resize(headerLen + dstLen);
+    compress(record.data() + headerLen, (uLongf*)&dstLen, src, recordLength);
+    memcpy(record.data(), &recordLength, sizeof(recordLength));
+    memcpy(record.data() + sizeof(recordLength), &dstLen, sizeof(dstLen));
+    record.resize(headerLen + dstLen);
     //printf("%u, %lu, %f\n", recordLength, dstLen, ((float)dstLen )/ ((float)recordLength));
     
-    free(dst);
     free(src);
     
     //account for the recordLength itself with the addition
     return recordLength + sizeof(recordLength) + sizeof(dstLen);
 }
 
+// Save a Task, which may be incomplete, to a checkpoint
+void Task::saveContechTask(Task& task, FILE* out)
+{
+    uint64 asize = task.getActionCount();
+    uint32_t ssize = task.s.size();
+    uint32_t psize = task.p.size();
+
+    ct_write(&task.taskId, sizeof(TaskId), out);
+    ct_write(&task.startTime, sizeof(ct_timestamp), out);
+    ct_write(&task.endTime, sizeof(ct_timestamp), out);
+    ct_write(&task.type, sizeof(task_type), out);
+    ct_write(&task.syncType, sizeof(sync_type), out);
+    ct_write(&task.bbCount, sizeof(int), out);
+
+    ct_write(&asize, sizeof(uint64), out);
+    vector<pair<const Action*, size_t> > runs;
+    task.getActionRuns(runs);
+    for (auto r : runs)
+    {
+        ct_write(r.first, r.second * sizeof(Action), out);
+    }
+
+    ct_write(&ssize, sizeof(uint32_t), out);
+    ct_write(task.s.data(), ssize * sizeof(TaskId), out);
+    ct_write(&psize, sizeof(uint32_t), out);
+    ct_write(task.p.data(), psize * sizeof(TaskId), out);
+}
+
+Task* Task::loadContechTask(FILE* in)
+{
+    Task* task = new Task();
+    uint64 asize;
+    uint32_t ssize, psize;
+
+    ct_read(&task->taskId, sizeof(TaskId), in);
+    ct_read(&task->startTime, sizeof(ct_timestamp), in);
+    ct_read(&task->endTime, sizeof(ct_timestamp), in);
+    ct_read(&task->type, sizeof(task_type), in);
+    ct_read(&task->syncType, sizeof(sync_type), in);
+    ct_read(&task->bbCount, sizeof(int), in);
+
+    // A truncated task must not size its vectors from the bytes that were not read
+    if (ct_read(&asize, sizeof(uint64), in) != sizeof(uint64)) { delete task; return NULL;}
+    task->a.resize(asize);
+    ct_read(task->a.data(), asize * sizeof(Action), in);
+
+    if (ct_read(&ssize, sizeof(uint32_t), in) != sizeof(uint32_t)) { delete task; return NULL;}
+    task->s.resize(ssize);
+    ct_read(task->s.data(), ssize * sizeof(TaskId), in);
+    if (ct_read(&psize, sizeof(uint32_t), in) != sizeof(uint32_t)) { delete task; return NULL;}
+    task->p.resize(psize);
+    ct_read(task->p.data(), psize * sizeof(TaskId), in);
+
+    if (feof(in) != 0) { delete task; return NULL;}
+
+    return task;
+}
+
 /*
 string Task::taskTypeToString(task_type taskType)
 {
@@ -586,9 +846,14 @@ string Task::toString() const {
     out << "Type:" << type << endl;
 
     out << "a:";
-    for (Action action : a)
+    vector<pair<const Action*, size_t> > runs;
+    getActionRuns(runs);
+    for (auto r : runs)
     {
-        out << action.toString();
+        for (size_t i = 0; i < r.second; i++)
+        {
+            out << r.first[i].toString();
+        }
     }
     out << endl;
 
@@ -3,6 +3,7 @@
 
 #include "TaskId.hpp"
 #include "Action.hpp"
+#include "ActionPool.hpp"
 #include "ct_file.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,6 +47,15 @@ private:
 
     // Internal list of actions (memOp's, mallocs, frees, and basic blocks)
     vector<Action> a;
+    // While an action pool is set, a task that outgrows one chunk appends its later
+    //   actions to chunks from the pool, which follow the actions in a
+    typedef struct _action_chunk
+    {
+        Action* actions;
+        uint used;
+    } action_chunk;
+    vector<action_chunk> chunks;
+    static ActionPool* actionPool;
     // Internal list of successor tasks
     vector<TaskId> s;
     // Internal list of predecessor tasks
@@ -59,6 +69,11 @@ private:
     //uint64 fileOffset;
 
     int bbCount;
+
+    Action* appendActions(uint n);
+    void addChunk();
+    void flattenActions();
+    void releaseChunks();
     
 public:
 
@@ -66,6 +81,9 @@ public:
     Task();
     // Constructs a task with the given taskId and start time
     Task(TaskId taskId, task_type type);
+    Task(const Task& t);
+    Task& operator=(const Task& t);
+    ~Task();
 
     // Compares the contents of two tasks
     bool operator==(const Task& rhs) const;
@@ -83,11 +101,24 @@ public:
     void setEndTime(ct_timestamp time);
 
     void recordMemOpAction(bool is_write, short pow_size, uint64 addr);
+    void recordMemRangeAction(bool is_write, uint64 addr, uint64 size);
+    void recordAtomicMemOpAction(short pow_size, uint64 addr);
     void recordMallocAction(uint64 addr, uint64 size);
     void recordFreeAction(uint64 addr);
     void recordMemCpyAction(uint64 size, uint64 dst, uint64 src);
     void recordBasicBlockAction(uint id);
 
+    // While a pool is set, tasks that outgrow one chunk record into its chunks
+    static void setActionPool(ActionPool* pool);
+    // Make room for the next n actions, so that they are stored together
+    void reserveActions(uint n);
+    uint64 getActionCount() const;
+    // Bytes held for the actions
+    uint64 getActionBytes() const;
+    // The actions as runs of consecutive actions, in order
+    void getActionRuns(vector<pair<const Action*, size_t> >& runs) const;
+    void clearActions();
+
     // List of all successors to this task.
     vector<TaskId>& getSuccessorTasks();
     void addSuccessor(TaskId succ);
@@ -114,6 +145,10 @@ public:
     
     //returns the record size written
     static size_t writeContechTask(Task& task, FILE* out);
+    static size_t encodeContechTask(Task& task, vector<uint8_t>& record);
+    // Uncompressed copy of every field, including those of tasks still being built
+    static void saveContechTask(Task& task, FILE* out);
+    static Task* loadContechTask(FILE* in);
 
     // Wraps the internal list of actions, presenting it as an iterable collection of only memory reads and writes
     // Internally, we skip past actions that we don't care about on increment
@@ -149,6 +184,9 @@ public:
                     pointer operator->() { return it; }
                     bool operator==(const self_type& rhs) { return it == rhs.it; }
                     bool operator!=(const self_type& rhs) { return it != rhs.it; }
+                    
+                    // Bytes accessed by this read or write, a range's length is in the size action after it
+                    uint64_t getAccessSize() { return Task::getAccessSize(it); }
                 private:
                     pointer it;
                     memOpCollection* parent; // We need to know where the end of the underlying list is, so we don't try to skip past it
@@ -192,6 +230,8 @@ public:
                     self_type& operator++()
                     {
                         // Advance the iterator to the next memory action, skipping basic blocks
+                        //   and the size action of a range, which is part of the range
+                        if (it->isMemRange() && it + 1 != parent->last) ++it;
                         do { ++it; }
                         while ( it != parent->last && !it->isMemoryAction());
                         return *this;
@@ -200,6 +240,9 @@ public:
                     pointer operator->() { return it; }
                     bool operator==(const self_type& rhs) { return it == rhs.it; }
                     bool operator!=(const self_type& rhs) { return it != rhs.it; }
+                    
+                    // Bytes accessed by this read or write, a range's length is in the size action after it
+                    uint64_t getAccessSize() { return Task::getAccessSize(it); }
                 private:
                     pointer it;
                     memoryActionCollection* parent; // We need to know where the end of the underlying list is, so we don't try to skip past it
@@ -280,6 +323,10 @@ public:
 
     };
 
+    // Bytes accessed by the read or write at a, which is 2^pow_size unless it is a range
+    static uint64_t getAccessSize(vector<Action>::const_iterator a);
+
+    // These first move any chunks into one list of actions
     vector<Action>& getActions();
     memOpCollection getMemOps();
     memoryActionCollection getMemoryActions();
@@ -71,9 +71,21 @@ inline static std::ostream& operator<<(std::ostream& os, const TaskId& i) { os <
 
 } // end namespace contech
 
-// overload std::hash for TaskId so it can be used in hash maps
+// overload std::hash for TaskId and ContextId so they can be used in hash maps
 namespace std
 {
+    template <>
+    struct hash<contech::ContextId>
+    {
+        typedef size_t result_type;
+        typedef contech::ContextId argument_type;
+
+        result_type operator()(contech::ContextId const & in) const noexcept
+        {
+            return hash<uint32_t>()((uint32_t)in);
+        }
+    };
+
     template <>
     struct hash<contech::TaskId>
     {
@@ -24,6 +24,7 @@ size_t ct_write(const void * ptr, size_t size, FILE* handle)
     do {
         size_t w = fwrite((char*)ptr + written, 1, size - written, handle);
         written += w * 1;
+        if ((w == 0) && (ferror(handle) != 0)) break;
     } while (written < size);
     return written;
 }
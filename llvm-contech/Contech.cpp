@@ -46,11 +46,18 @@
 
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 
 #include "BufferCheckAnalysis.h"
 #include "Contech.h"
 #include "LoopIV.h"
 
+#include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
 using namespace llvm;
 using namespace std;
 
@@ -63,8 +70,122 @@ cl::opt<string> ContechStateFilename("ContechState", cl::desc("File with current
 cl::opt<bool> ContechMarkFrontend("ContechMarkFE", cl::desc("Generate a minimal marked output"));
 cl::opt<bool> ContechMinimal("ContechMinimal", cl::desc("Generate a minimally instrumented output"));
 
+// Atomics on thread-local memory do not order contexts, so they can be recorded as memory ops
+cl::opt<bool> ContechLocalAtomics("ContechLocalAtomics", cl::desc("Record thread-local atomics as memory ops instead of syncs"));
+
+// Functions dispatch to an uninstrumented clone when CONTECH_ROI_ENABLE is set and the ROI is not active
+cl::opt<bool> ContechROIClone("ContechROIClone", cl::desc("Run uninstrumented clones of functions outside of the ROI"));
+
+// The cost report lists the trace bytes of every block and function, and which elisions applied.
+//   Adding the execution count of each block and the run time gives a budget profile.
+cl::opt<string> ContechCostReport("ContechCostReport", cl::desc("Append the instrumentation cost of each block to file"), cl::value_desc("filename"));
+cl::opt<string> ContechBudgetProfile("ContechBudgetProfile", cl::desc("Profile of block executions used to meet ContechBudgetRate"), cl::value_desc("filename"));
+cl::opt<double> ContechBudgetRate("ContechBudgetRate", cl::desc("Target trace rate in bytes per second"), cl::init(0.0));
+
 uint64_t tailCount = 0;
 
+// Basic block ids are reserved from the state file in blocks of this size, so that
+//   several instances of the pass can instrument modules concurrently.  Unused ids
+//   leave holes in the basic block table.
+#define CONTECH_BBID_RESERVE 1024
+
+//
+// The first word of the state file is the next free basic block id, followed by the
+//   basic block info of every instrumented module.  All accesses to the file are made
+//   while holding an exclusive lock on it.
+//
+static int lockContechState()
+{
+    int fd = open(ContechStateFilename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+    {
+        report_fatal_error("Contech: unable to open state file " + ContechStateFilename);
+    }
+
+    while (flock(fd, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+        {
+            report_fatal_error("Contech: unable to lock state file " + ContechStateFilename);
+        }
+    }
+
+    // New state file starts with the basic block count
+    if (lseek(fd, 0, SEEK_END) < (off_t)sizeof(unsigned int))
+    {
+        unsigned int zero = 0;
+        if (pwrite(fd, &zero, sizeof(unsigned int), 0) != sizeof(unsigned int))
+        {
+            report_fatal_error("Contech: unable to initialize state file " + ContechStateFilename);
+        }
+    }
+
+    return fd;
+}
+
+static void unlockContechState(int fd)
+{
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static unsigned int readContechStateCount(int fd)
+{
+    unsigned int count = 0;
+    if (pread(fd, &count, sizeof(unsigned int), 0) != sizeof(unsigned int))
+    {
+        report_fatal_error("Contech: unable to read state file " + ContechStateFilename);
+    }
+    return count;
+}
+
+static void writeContechStateCount(int fd, unsigned int count)
+{
+    if (pwrite(fd, &count, sizeof(unsigned int), 0) != sizeof(unsigned int))
+    {
+        report_fatal_error("Contech: unable to write state file " + ContechStateFilename);
+    }
+}
+
+// Reserve the next n basic block ids, returns the first id of the range
+static unsigned int reserveBasicBlockIds(unsigned int n)
+{
+    int fd = lockContechState();
+    unsigned int first = readContechStateCount(fd);
+    writeContechStateCount(fd, first + n);
+    unlockContechState(fd);
+
+    return first;
+}
+
+//
+// Does memory op t access the bytes immediately following prev, the memory op at
+//   position prevPos in the same block?  Only ops whose address is derived from
+//   the same base can be compared statically.
+//
+static bool continuesMemRange(const llvm_mem_op* prev, unsigned short prevPos, const llvm_mem_op* t)
+{
+    if (prev == NULL || t->isDep == false || t->isLoopElide || prev->isLoopElide) return false;
+    if (t->isWrite != prev->isWrite) return false;
+    
+    int prevEnd = prev->depMemOpDelta + (1 << prev->size);
+    if (t->isGlobal)
+    {
+        // Both are offsets from the same elided global
+        return (prev->isDep && prev->isGlobal && 
+                prev->depMemOp == t->depMemOp && t->depMemOpDelta == prevEnd);
+    }
+    else if (prev->isDep)
+    {
+        // Both are offsets from the same recorded op
+        return (prev->isGlobal == false && 
+                prev->depMemOp == t->depMemOp && t->depMemOpDelta == prevEnd);
+    }
+    
+    // The previous op is the recorded base of t
+    return (t->depMemOp == prevPos && t->depMemOpDelta == (1 << prev->size));
+}
+
 namespace llvm {
 #define STORE_AND_LEN(x) x, sizeof(x)
 #define FUNCTIONS_INSTRUMENT_SIZE 60
@@ -378,32 +499,25 @@ ScalarEvolution* Contech::getAnalysisSCEV(Function& F)
 //
 bool Contech::runOnModule(Module &M)
 {
+    // Ids in [bb_count, bb_reserve_end) are reserved for this module
     unsigned int bb_count = 0;
-    int length = 0;
-    char* buffer = NULL;
+    unsigned int bb_reserve_end = 0;
     doInitialization(M);
 
-    ifstream* icontechStateFile = new ifstream(ContechStateFilename.c_str(), ios_base::in | ios_base::binary);
-    if (icontechStateFile != NULL && icontechStateFile->good())
+    // Blocks (by function and position) that will not record addresses to meet the budget
+    set<pair<string, unsigned int> > budgetNoAddrBlocks;
+    if (!ContechBudgetProfile.empty() && ContechBudgetRate > 0.0)
     {
-        icontechStateFile->seekg(0, icontechStateFile->end);
-        length = icontechStateFile->tellg();
-        icontechStateFile->seekg(0, icontechStateFile->beg);
-        buffer = new char[length];
-        icontechStateFile->read(buffer, length);
-        bb_count = *(unsigned int*)buffer;
+        loadBudgetProfile(ContechBudgetProfile.c_str(), ContechBudgetRate, budgetNoAddrBlocks);
     }
-    else
+
+    set<Function*> roiCloneExclude;
+    bool roiClone = (ContechROIClone == true && ContechMarkFrontend == false && ContechMinimal == false);
+    if (roiClone == true)
     {
-        //errs() << contechStateFile->rdstate() << "\t" << contechStateFile->fail() << "\n";
-        //errs() << ContechStateFilename.c_str() << "\n";
+        collectROICloneExclusions(M, roiCloneExclude);
     }
 
-    // for unknown reasons, a file that does not exist needs to clear all bits and not
-    // just eof for writing
-    icontechStateFile->close();
-    delete icontechStateFile;
-
     for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
         int status;
         const char* fmn = F->getName().data();
@@ -466,7 +580,13 @@ bool Contech::runOnModule(Module &M)
         }
         errs() << fmn << "\n";
         
-
+        // The clone is made before any changes to the function
+        Function* roiCloneF = NULL;
+        if (roiClone == true && inMain == false && F->isVarArg() == false &&
+            roiCloneExclude.find(&*F) == roiCloneExclude.end())
+        {
+            roiCloneF = createROIClone(&*F, M);
+        }
 
         // "Normalize" every basic block to have only one function call in it
         for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ) {
@@ -538,17 +658,45 @@ bool Contech::runOnModule(Module &M)
         // whether is a loop entry
         unordered_map<Loop*, int> loopEntry{ collectLoopEntry(pF, LI) };
 
+        // Thread-local atomics are found before instrumentation, which passes the
+        //   addresses of memory ops to the runtime
+        threadLocalAtomics.clear();
+        if (ContechLocalAtomics == true)
+        {
+            for (inst_iterator I = inst_begin(pF), E = inst_end(pF); I != E; ++I)
+            {
+                if (isThreadLocalAtomic(&*I))
+                {
+                    threadLocalAtomics.insert(&*I);
+                }
+            }
+        }
+
         map<int, llvm_inst_block> costPerBlock;
         int num_checks = 0;
         int origin_checks = 0;
         // Now instrument each basic block in the function
-        for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ++B) 
+        unsigned int blockOrdinal = 0;
+        for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ++B, ++blockOrdinal) 
         {
             BasicBlock &pB = *B;
+            if (bb_count == bb_reserve_end)
+            {
+                bb_count = reserveBasicBlockIds(CONTECH_BBID_RESERVE);
+                bb_reserve_end = bb_count + CONTECH_BBID_RESERVE;
+            }
+            budgetNoAddr = (budgetNoAddrBlocks.find(make_pair(string(fmn), blockOrdinal)) != budgetNoAddrBlocks.end());
             internalRunOnBasicBlock(pB, M, bb_count, ContechMarkFrontend, fmn, 
                                     costPerBlock, num_checks, origin_checks);
+            
+            auto bi = cfgInfoMap.find(&pB);
+            if (bi != cfgInfoMap.end())
+            {
+                bi->second->ordinal = blockOrdinal;
+            }
             bb_count++;
         }
+        budgetNoAddr = false;
 
         // run the check analysis
         BufferCheckAnalysis bufferCheckAnalysis{
@@ -661,6 +809,12 @@ bool Contech::runOnModule(Module &M)
         }
         loopInfoTrack.clear();
         
+        // The dispatch is added after instrumentation, so that it does not record events
+        if (roiCloneF != NULL)
+        {
+            addROIDispatch(&*F, roiCloneF, M);
+        }
+        
         // If fmn is fn, then it was allocated by the demangle routine and we are required to free
         if (fmn == fn)
         {
@@ -677,21 +831,13 @@ bool Contech::runOnModule(Module &M)
     if (ContechMarkFrontend == true) goto cleanup;
 
 cleanup:
-    ofstream* contechStateFile = new ofstream(ContechStateFilename.c_str(), ios_base::out | ios_base::binary);
-    //contechStateFile->seekp(0, ios_base::beg);
-    if (buffer == NULL)
+    if (!ContechCostReport.empty())
     {
-        // New state file starts with the basic block count
-        contechStateFile->write((char*)&bb_count, sizeof(unsigned int));
+        writeCostReport(ContechCostReport.c_str());
     }
-    else
-    {
-        // Write the existing data back out
-        //   First, put a new basic block count at the start of the existing data
-        *(unsigned int*) buffer = bb_count;
-        contechStateFile->write(buffer, length);
-    }
-    //contechStateFile->seekp(0, ios_base::end);
+
+    // The basic block info is assembled in memory and then appended under the lock
+    ostringstream* contechStateFile = new ostringstream(ios_base::out | ios_base::binary);
 
     if (ContechMarkFrontend == false && ContechMinimal == false)
     {
@@ -730,15 +876,23 @@ cleanup:
             // Number of memory operations
             contechStateFile->write((char*)&bi->second->len, sizeof(unsigned int));
 
+            // The previous op is kept to detect contiguous runs of accesses
+            llvm_mem_op prevOp;
+            unsigned short pos = 0;
             while (t != NULL)
             {
                 pllvm_mem_op tn = t->next;
                 char memFlags = (t->isDep)?BBI_FLAG_MEM_DUP:0x0;
                 memFlags |= (t->isWrite)?0x1:0x0;
+                memFlags |= (t->isAtomic)?BBI_FLAG_MEM_ATOMIC:0x0;
                 if (t->isDep)
                 {
                     memFlags |= (t->isGlobal)?BBI_FLAG_MEM_GV:0x0;
                     memFlags |= (t->isLoopElide)?BBI_FLAG_MEM_LOOP:0x0;
+                    if (continuesMemRange((pos > 0)?&prevOp:NULL, pos - 1, t))
+                    {
+                        memFlags |= BBI_FLAG_MEM_RANGE;
+                    }
                 }
 
                 contechStateFile->write((char*)&memFlags, sizeof(char));
@@ -762,6 +916,8 @@ cleanup:
                     }
                 }
                 
+                prevOp = *t;
+                pos++;
                 delete (t);
                 t = tn;
             }
@@ -771,7 +927,29 @@ cleanup:
     }
     //errs() << "Wrote: " << wcount << " basic blocks\n";
     cfgInfoMap.clear();
-    contechStateFile->close();
+
+    {
+        int fd = lockContechState();
+
+        // If no other module has reserved ids since this module's last reservation,
+        //   then the unused portion of the reservation can be returned.
+        if (bb_reserve_end != 0 &&
+            readContechStateCount(fd) == bb_reserve_end)
+        {
+            writeContechStateCount(fd, bb_count);
+        }
+
+        string bbInfo = contechStateFile->str();
+        if (!bbInfo.empty())
+        {
+            lseek(fd, 0, SEEK_END);
+            if (write(fd, bbInfo.data(), bbInfo.size()) != (ssize_t)bbInfo.size())
+            {
+                report_fatal_error("Contech: unable to append to state file " + ContechStateFilename);
+            }
+        }
+        unlockContechState(fd);
+    }
     delete contechStateFile;
 
     errs() << "Tail Dup Count: " << tailCount << "\n";
@@ -980,6 +1158,11 @@ bool Contech::internalRunOnBasicBlock(BasicBlock &B,  Module &M, int bbid, const
             numIROps --;
             continue;
         }
+        else if (budgetNoAddr == true &&
+                 (dyn_cast<LoadInst>(&*I) != NULL || dyn_cast<StoreInst>(&*I) != NULL))
+        {
+            // The budget excludes this block's addresses from the trace
+        }
         else if (LoadInst *li = dyn_cast<LoadInst>(&*I))
         {
             int addrOffset = 0;
@@ -1024,6 +1207,10 @@ bool Contech::internalRunOnBasicBlock(BasicBlock &B,  Module &M, int bbid, const
                 memOpCount ++;
             }
         }
+        else if (threadLocalAtomics.find(&*I) != threadLocalAtomics.end())
+        {
+            memOpCount ++;
+        }
         else if (ContechMinimal == true)
         {
             if (CallInst* ci = dyn_cast<CallInst>(&*I))
@@ -1104,6 +1291,7 @@ bool Contech::internalRunOnBasicBlock(BasicBlock &B,  Module &M, int bbid, const
     bi->fnName.assign(fnName);
     bi->fileName = fileName;
     bi->fileNameSize = fileNameSize;
+    bi->ordinal = 0;
     //bi->fileName = B.getDebugLoc().getScope().getFilename();//M.getModuleIdentifier().data();
     bi->critPathLen = getCriticalPathLen(B);
 
@@ -1162,6 +1350,7 @@ bool Contech::internalRunOnBasicBlock(BasicBlock &B,  Module &M, int bbid, const
         tMemOp->isWrite = true;
         tMemOp->size = 7;
         tMemOp->isDep = false;
+        tMemOp->isAtomic = false;
         tMemOp->depMemOp = 0;
         tMemOp->depMemOpDelta = 0;
 
@@ -1303,6 +1492,12 @@ bool Contech::internalRunOnBasicBlock(BasicBlock &B,  Module &M, int bbid, const
             continue;
         }
 
+        if (budgetNoAddr == true &&
+            (dyn_cast<LoadInst>(&*I) != NULL || dyn_cast<StoreInst>(&*I) != NULL))
+        {
+            continue;
+        }
+        
         // <result> = load [volatile] <ty>* <pointer>[, align <alignment>][, !nontemporal !<index>][, !invariant.load !<index>]
         // Load and store are identical except the cIsWrite is set accordingly.
         //
@@ -1435,6 +1630,25 @@ bool Contech::internalRunOnBasicBlock(BasicBlock &B,  Module &M, int bbid, const
                 t->next = tMemOp;
             }
         }
+        // Thread-local atomics are recorded as writes and tagged in the basic block info
+        else if (threadLocalAtomics.find(&*I) != threadLocalAtomics.end())
+        {
+            assert(memOpPos < memOpCount);
+            pllvm_mem_op tMemOp = insertMemOp(&*I, getAtomicPointerOperand(&*I), true, memOpPos, posValue, elideBasicBlockId, M, loopIVOp);
+            tMemOp->isAtomic = true;
+            memOpPos ++;
+            
+            if (bi->first_op == NULL) bi->first_op = tMemOp;
+            else
+            {
+                pllvm_mem_op t = bi->first_op;
+                while (t->next != NULL)
+                {
+                    t = t->next;
+                }
+                t->next = tMemOp;
+            }
+        }
         else if (AtomicCmpXchgInst *xchgI = dyn_cast<AtomicCmpXchgInst>(&*I))
         {
             bi->containAtomic = true;
@@ -1540,6 +1754,10 @@ bool Contech::internalRunOnBasicBlock(BasicBlock &B,  Module &M, int bbid, const
     //   If it has 
     bi->containCall = (bi->containCall)?true:(!hasUninstCall);
     bi->len = memOpCount + dupMemOps.size() + memOpGVElide;
+    // Delta encoded addresses vary in size, this is the size without encoding
+    bi->bytesPerExec = memOpCount * 6 + ((elideBasicBlockId == true)? 0 : 3);
+    bi->idElided = elideBasicBlockId;
+    bi->budgetNoAddr = budgetNoAddr;
     
     {
         hash<BasicBlock*> blockHash{};
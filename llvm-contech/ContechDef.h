@@ -38,6 +38,7 @@ namespace llvm {
         bool isGlobal;
         bool isDep;
         bool isLoopElide;
+        bool isAtomic;
         char size;
         union {
             unsigned short depMemOp;
@@ -65,6 +66,13 @@ namespace llvm {
         //const char* fnName;
         const char* fileName;
         unsigned int fileNameSize;
+        
+        // Instrumentation cost of the block, see -ContechCostReport.  bytesPerExec
+        //   is for unencoded addresses, which usually overstates a delta encoded trace.
+        unsigned int ordinal;
+        unsigned int bytesPerExec;
+        bool idElided;
+        bool budgetNoAddr;
     } llvm_basic_block, *pllvm_basic_block;
 
     typedef struct _llvm_inst_block {
@@ -231,9 +239,12 @@ namespace llvm {
         std::vector <llvm_loopiv_block*> LoopMemoryOps;
         std::map<Value*, int> loopMemOps;
         std::map<BasicBlock*, llvm_loop_track*> loopInfoTrack;
+        std::set<Instruction*> threadLocalAtomics;
+        bool budgetNoAddr;
 
         Contech() : ModulePass(ID) {
             lastAssignedElidedGVId = -1;
+            budgetNoAddr = false;
         }
 
         virtual bool doInitialization(Module &M);
@@ -263,6 +274,14 @@ namespace llvm {
         bool blockContainsFunctionName(BasicBlock* B, _CONTECH_FUNCTION_TYPE cft);
 
         Value* findSimilarMemoryInst(Instruction*, Value*, int*);
+        Value* getAtomicPointerOperand(Instruction*);
+        bool isThreadLocalAtomic(Instruction*);
+        void collectROICloneExclusions(Module &M, std::set<Function*>& exclude);
+        Function* createROIClone(Function* F, Module &M);
+        void addROIDispatch(Function* F, Function* clone, Module &M);
+        void writeCostReport(const char* fileName);
+        void loadBudgetProfile(const char* fileName, double bytesPerSec, 
+                               std::set<std::pair<std::string, unsigned int> >& noAddr);
         _CONTECH_FUNCTION_TYPE classifyFunctionName(const char* fn);
 
         void getAnalysisUsage(AnalysisUsage &AU) const;
@@ -33,12 +33,22 @@
 
 #include "llvm/Analysis/Interval.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Support/CommandLine.h"
 
 #include "BufferCheckAnalysis.h"
 #include "Contech.h"
+
+#include <sstream>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
 using namespace llvm;
 using namespace std;
 
@@ -172,6 +182,7 @@ pllvm_mem_op Contech::insertMemOp(Instruction* li, Value* addr, bool isWrite, un
     tMemOp->isDep = false;
     tMemOp->isGlobal = false;
     tMemOp->isLoopElide = false;
+    tMemOp->isAtomic = false;
     tMemOp->depMemOp = 0;
     tMemOp->depMemOpDelta = 0;
     tMemOp->size = getSimpleLog(getSizeofType(addr->getType()->getPointerElementType()));
@@ -274,6 +285,346 @@ pllvm_mem_op Contech::insertMemOp(Instruction* li, Value* addr, bool isWrite, un
     return tMemOp;
 }
 
+//
+// Find the functions that cannot run as an uninstrumented clone outside of the ROI.
+//   A function is excluded if it makes an indirect call, calls a function that Contech
+//   must record events for, or directly or transitively reaches the ROI markers.  Allocations
+//   are permitted, as their events are discarded outside of the ROI.
+//
+//   Only this module is visible, so a function defined elsewhere may reach the ROI markers,
+//   unless it is an intrinsic or a library function.
+//
+void Contech::collectROICloneExclusions(Module &M, set<Function*>& exclude)
+{
+    map<Function*, set<Function*> > callers;
+    vector<Function*> roiReach;
+    TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+    TargetLibraryInfo TLI(TLII);
+    
+    for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+    {
+        if (F->isDeclaration()) continue;
+        for (inst_iterator I = inst_begin(&*F), E = inst_end(&*F); I != E; ++I)
+        {
+            Value* cv = NULL;
+            if (CallInst* ci = dyn_cast<CallInst>(&*I)) cv = ci->getCalledValue();
+            else if (InvokeInst* ii = dyn_cast<InvokeInst>(&*I)) cv = ii->getCalledValue();
+            else continue;
+            
+            Function* f = dyn_cast<Function>(cv->stripPointerCasts());
+            if (f == NULL)
+            {
+                exclude.insert(&*F);
+                continue;
+            }
+            callers[f].insert(&*F);
+            
+            int status;
+            const char* fmn = f->getName().data();
+            char* fdn = abi::__cxa_demangle(fmn, 0, 0, &status);
+            const char* fn = (status == 0)?fdn:fmn;
+            
+            if (__ctStrCmp(fn, "__parsec_roi") == 0)
+            {
+                roiReach.push_back(&*F);
+            }
+            else
+            {
+                CONTECH_FUNCTION_TYPE funTy = classifyFunctionName(fn);
+                LibFunc::Func lf;
+                if (funTy != NONE && funTy != MALLOC && funTy != MALLOC2 &&
+                    funTy != REALLOC && funTy != FREE)
+                {
+                    exclude.insert(&*F);
+                }
+                else if (funTy == NONE && f->isDeclaration() && !f->isIntrinsic() &&
+                         !TLI.getLibFunc(f->getName(), lf))
+                {
+                    roiReach.push_back(&*F);
+                }
+            }
+            
+            if (status == 0)
+            {
+                free(fdn);
+            }
+        }
+    }
+    
+    // Any caller of a function that reaches the ROI markers also reaches them
+    set<Function*> reached;
+    while (!roiReach.empty())
+    {
+        Function* f = roiReach.back();
+        roiReach.pop_back();
+        if (reached.insert(f).second == false) continue;
+        
+        auto it = callers.find(f);
+        if (it == callers.end()) continue;
+        roiReach.insert(roiReach.end(), it->second.begin(), it->second.end());
+    }
+    exclude.insert(reached.begin(), reached.end());
+}
+
+//
+// Create an uninstrumented copy of F.  The __ct prefix ensures the copy is not instrumented.
+//
+Function* Contech::createROIClone(Function* F, Module &M)
+{
+    Function* clone = Function::Create(F->getFunctionType(),
+                                       GlobalValue::InternalLinkage,
+                                       Twine("__ctNoROI", F->getName()),
+                                       &M);
+    ValueToValueMapTy VMap;
+    auto cArg = clone->arg_begin();
+    for (auto A = F->arg_begin(), AE = F->arg_end(); A != AE; ++A, ++cArg)
+    {
+        cArg->setName(A->getName());
+        VMap[&*A] = &*cArg;
+    }
+    
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(clone, F, VMap, false, returns);
+    
+    return clone;
+}
+
+//
+// Insert a new entry block into the instrumented F that calls the uninstrumented clone when
+//   the ROI is enabled and not active.
+//
+void Contech::addROIDispatch(Function* F, Function* clone, Module &M)
+{
+    LLVMContext& ctx = M.getContext();
+    BasicBlock* instEntry = &F->getEntryBlock();
+    BasicBlock* dispatch = BasicBlock::Create(ctx, "ctROIDispatch", F, instEntry);
+    BasicBlock* native = BasicBlock::Create(ctx, "ctROINative", F, instEntry);
+    
+    Constant* roiEnabled = M.getOrInsertGlobal("__ctIsROIEnabled", cct.int8Ty);
+    Constant* roiActive = M.getOrInsertGlobal("__ctIsROIActive", cct.int8Ty);
+    Constant* cZero = ConstantInt::get(cct.int8Ty, 0);
+    
+    LoadInst* enabledV = new LoadInst(roiEnabled, "roiEnabled", dispatch);
+    MarkInstAsContechInst(enabledV);
+    LoadInst* activeV = new LoadInst(roiActive, "roiActive", dispatch);
+    MarkInstAsContechInst(activeV);
+    Instruction* enabledC = new ICmpInst(*dispatch, CmpInst::ICMP_NE, enabledV, cZero, "isEnabled");
+    MarkInstAsContechInst(enabledC);
+    Instruction* inactiveC = new ICmpInst(*dispatch, CmpInst::ICMP_EQ, activeV, cZero, "isInactive");
+    MarkInstAsContechInst(inactiveC);
+    Instruction* outsideROI = BinaryOperator::Create(Instruction::And, enabledC, inactiveC, "outsideROI", dispatch);
+    MarkInstAsContechInst(outsideROI);
+    Instruction* br = BranchInst::Create(native, instEntry, outsideROI, dispatch);
+    MarkInstAsContechInst(br);
+    
+    vector<Value*> args;
+    for (auto A = F->arg_begin(), AE = F->arg_end(); A != AE; ++A)
+    {
+        args.push_back(&*A);
+    }
+    CallInst* nativeCall = CallInst::Create(clone, args, "", native);
+    nativeCall->setCallingConv(clone->getCallingConv());
+    nativeCall->setAttributes(clone->getAttributes());
+    nativeCall->setTailCall();
+    MarkInstAsContechInst(nativeCall);
+    
+    Instruction* ret = NULL;
+    if (F->getReturnType()->isVoidTy())
+    {
+        ret = ReturnInst::Create(ctx, native);
+    }
+    else
+    {
+        ret = ReturnInst::Create(ctx, nativeCall, native);
+    }
+    MarkInstAsContechInst(ret);
+}
+
+//
+// Append the cost of each instrumented block in this module to the report.  Each block
+//   line gives the trace bytes per execution and how many memory ops each elision removed:
+//   BLOCK <id> <function> <ordinal> <bytes> <recorded ops> <dup> <gv> <loop> <id elided> <budget>
+//   FUNCTION <function> <blocks> <bytes if each block executes once>
+//   Fields are separated by tabs, as function names may contain spaces.
+//
+//   The bytes are those of an unencoded trace, with 6 byte addresses.  With CONTECH_DELTA_ADDR,
+//   the runtime encodes each address in 1 to 7 bytes depending on the addresses seen, which
+//   is usually far fewer, so the bytes then overstate the trace and a budget is conservative.
+//
+void Contech::writeCostReport(const char* fileName)
+{
+    ostringstream report;
+    map<string, pair<unsigned int, uint64_t> > fnCost;
+    
+    for (auto bi = cfgInfoMap.begin(), bie = cfgInfoMap.end(); bi != bie; ++bi)
+    {
+        pllvm_basic_block b = bi->second;
+        unsigned int recorded = 0, dup = 0, gv = 0, loop = 0;
+        
+        for (pllvm_mem_op t = b->first_op; t != NULL; t = t->next)
+        {
+            if (t->isLoopElide) loop++;
+            else if (t->isDep && t->isGlobal) gv++;
+            else if (t->isDep) dup++;
+            else recorded++;
+        }
+        
+        report << "BLOCK\t" << b->id << "\t" << b->fnName << "\t" << b->ordinal << "\t"
+               << b->bytesPerExec << "\t" << recorded << "\t" << dup << "\t" << gv << "\t" 
+               << loop << "\t" << b->idElided << "\t" << b->budgetNoAddr << "\n";
+        
+        auto& fc = fnCost[b->fnName];
+        fc.first++;
+        fc.second += b->bytesPerExec;
+    }
+    
+    for (auto it = fnCost.begin(), et = fnCost.end(); it != et; ++it)
+    {
+        report << "FUNCTION\t" << it->first << "\t" << it->second.first << "\t" << it->second.second << "\n";
+    }
+    
+    // Other modules may be appending concurrently, so the report is appended while
+    //   holding an exclusive lock on the file, as the state file is
+    string r = report.str();
+    int fd = open(fileName, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1)
+    {
+        errs() << "Unable to open cost report: " << fileName << "\n";
+        return;
+    }
+    
+    while (flock(fd, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+        {
+            errs() << "Unable to lock cost report: " << fileName << "\n";
+            close(fd);
+            return;
+        }
+    }
+    
+    const char* p = r.data();
+    size_t left = r.size();
+    while (left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0)
+        {
+            errs() << "Unable to write cost report: " << fileName << "\n";
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+//
+// Load a budget profile, which is the cost report with the execution count appended to each
+//   block line and a line with the run time:
+//   SECONDS <run time>
+//   BLOCK <id> <function> <ordinal> <bytes> ... <executions>
+//   The hottest blocks stop recording addresses until the profile's trace rate is within
+//   the budget.  Every module makes the same choice, as it depends only on the profile.
+//
+void Contech::loadBudgetProfile(const char* fileName, double bytesPerSec, 
+                                set<pair<string, unsigned int> >& noAddr)
+{
+    ifstream profile(fileName);
+    if (!profile.good())
+    {
+        errs() << "Unable to open budget profile: " << fileName << "\n";
+        return;
+    }
+    
+    double seconds = 0.0;
+    uint64_t totalBytes = 0;
+    
+    // (bytes in the profile, (executions, (function, ordinal)))
+    vector<pair<uint64_t, pair<uint64_t, pair<string, unsigned int> > > > blocks;
+    
+    string line;
+    while (getline(profile, line))
+    {
+        vector<string> fields;
+        istringstream ls(line);
+        string field;
+        while (getline(ls, field, '\t'))
+        {
+            fields.push_back(field);
+        }
+        if (fields.empty()) continue;
+        
+        if (fields[0] == "SECONDS" && fields.size() > 1)
+        {
+            seconds = strtod(fields[1].c_str(), NULL);
+        }
+        else if (fields[0] == "BLOCK" && fields.size() > 5)
+        {
+            unsigned int ordinal = strtoul(fields[3].c_str(), NULL, 10);
+            uint64_t bytes = strtoull(fields[4].c_str(), NULL, 10);
+            uint64_t execs = strtoull(fields.back().c_str(), NULL, 10);
+            
+            blocks.push_back(make_pair(bytes * execs, make_pair(execs, make_pair(fields[2], ordinal))));
+            totalBytes += bytes * execs;
+        }
+    }
+    
+    if (seconds <= 0.0)
+    {
+        errs() << "Budget profile has no SECONDS line: " << fileName << "\n";
+        return;
+    }
+    
+    sort(blocks.rbegin(), blocks.rend());
+    double target = bytesPerSec * seconds;
+    for (auto it = blocks.begin(), et = blocks.end(); it != et && totalBytes > target; ++it)
+    {
+        // Without addresses, the block still records its id
+        uint64_t idBytes = it->second.first * 3;
+        if (idBytes >= it->first) continue;
+        
+        noAddr.insert(it->second.second);
+        totalBytes -= it->first - idBytes;
+    }
+    
+    errs() << "Budget: " << noAddr.size() << " of " << blocks.size() << " blocks will not record addresses\n";
+}
+
+//
+// Return the address operated on by an atomic instruction, or NULL
+//
+Value* Contech::getAtomicPointerOperand(Instruction* I)
+{
+    if (AtomicRMWInst *armw = dyn_cast<AtomicRMWInst>(I))
+    {
+        return armw->getPointerOperand();
+    }
+    else if (AtomicCmpXchgInst *xchgI = dyn_cast<AtomicCmpXchgInst>(I))
+    {
+        return xchgI->getPointerOperand();
+    }
+    return NULL;
+}
+
+//
+// An atomic is thread-local if it operates on a stack object whose address is never
+//   captured.  No other context can access the object, so the atomic cannot order contexts.
+//
+bool Contech::isThreadLocalAtomic(Instruction* I)
+{
+    Value* addr = getAtomicPointerOperand(I);
+    if (addr == NULL) return false;
+    
+    Value* base = GetUnderlyingObject(addr, *currentDataLayout);
+    if (dyn_cast<AllocaInst>(base) == NULL) return false;
+    
+    return !PointerMayBeCaptured(base, true, true);
+}
+
 //
 // Check each predecessor for whether current block's ID can be elided
 //   - All predecessors have no function calls or atomics (that require events)
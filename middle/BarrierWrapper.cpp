@@ -4,153 +4,80 @@ using namespace contech;
 
 BarrierWrapper::BarrierWrapper()
 {
-    entryBarrierTask = NULL;
-    exitBarrierTasks.clear();
+    entry.t = NULL;
 }
 
 Task* BarrierWrapper::onEnter(Task& arrivingTask, ct_tsc_t arrivalTime, ct_addr_t addr)
 {
-    // If there are exits, first can the arriving task be part of an exit?
-    if (!exitBarrierTasks.empty())
+    ContextId cid = arrivingTask.getContextId();
+    
+    // If this task's context has not entered an "exit" barrier, the oldest such barrier
+    //   is the one it arrives at, rather than a new enter barrier
+    for (barrier_instance& ebt : exits)
     {
-        ContextId cid = arrivingTask.getContextId();
-        bool hasExitedBarrier = false;
-        Task* ebt = NULL;
-        
-        // For each exit barrier, is arriving task present?
-        for (auto ebtt = exitBarrierTasks.begin(), ebtet = exitBarrierTasks.end(); ebtt != ebtet; ++ebtt)
-        {
-            ebt = *ebtt;
-            auto exitPred = ebt->getPredecessorTasks();
-            hasExitedBarrier = false;
-            for (auto it = exitPred.begin(), et = exitPred.end(); it != et; ++it)
-            {
-                if (it->getContextId() == cid)
-                {
-                    hasExitedBarrier = true;
-                    break;
-                }
-            }
-            
-            // Arriving task was not present in exit barrier
-            if (hasExitedBarrier == false) break;
-        }
-        
-        // If this task's context has not entered the "exit" barrier
-        //   attach it to the exit barrier, rather than a new enter barrier
-        if (hasExitedBarrier == false)
+        if (ebt.arrived.find(cid) == ebt.arrived.end())
         {
-            arrivingTask.addSuccessor(ebt->getTaskId());
-            ebt->addPredecessor(arrivingTask.getTaskId());
+            arrivingTask.addSuccessor(ebt.t->getTaskId());
+            ebt.t->addPredecessor(arrivingTask.getTaskId());
             arrivingTask.setEndTime(arrivalTime);
-            return ebt;
+            ebt.arrived[cid] = false;
+            return ebt.t;
         }
     }
     
     // If this is the first entry to the barrier, create a new barrier task
-    if (entryBarrierTask == NULL)
+    if (entry.t == NULL)
     {
-        entryBarrierTask = new Task(arrivingTask.getTaskId().getNext(), task_type_barrier);
-        entryBarrierTask->recordMemOpAction(true, 8, addr);
+        entry.t = new Task(arrivingTask.getTaskId().getNext(), task_type_barrier);
+        entry.t->recordMemOpAction(true, 8, addr);
     }
 
     // Start time of the barrier is the time when the latest task arrived
-    entryBarrierTask->setStartTime(std::max((ct_timestamp)arrivalTime, entryBarrierTask->getStartTime()));
+    entry.t->setStartTime(std::max((ct_timestamp)arrivalTime, entry.t->getStartTime()));
 
     // Set the barrier task as the arriving task's child
-    arrivingTask.addSuccessor(entryBarrierTask->getTaskId());
+    arrivingTask.addSuccessor(entry.t->getTaskId());
     arrivingTask.setEndTime(arrivalTime);
     
     // Set the arriving task as a parent of the barrier
-    entryBarrierTask->addPredecessor(arrivingTask.getTaskId());
+    entry.t->addPredecessor(arrivingTask.getTaskId());
+    entry.arrived.emplace(cid, false);
 
     // Record entry to the barrier
-    return entryBarrierTask;
+    return entry.t;
 }
 
 Task* BarrierWrapper::onExit(Task* departingTask, ct_tsc_t exitTime, bool* finished)
 {
-    Task* exitT = NULL;
+    ContextId cid = departingTask->getContextId();
+    size_t e = 0;
     
-    // Find the oldest exit barrier and add depart to the barrier
-    if (!exitBarrierTasks.empty())
+    // Find the oldest exit barrier that this context arrived at but has not left
+    for (; e < exits.size(); e++)
     {
-        ContextId cid = departingTask->getContextId();
-        bool hasArrivedBarrier = false;
-        bool hasExitedBarrier = false;
-        
-        // For each exit barrier, is departing task present?
-        for (auto ebtt = exitBarrierTasks.begin(), ebtet = exitBarrierTasks.end(); ebtt != ebtet; ++ebtt)
-        {
-            exitT = *ebtt;
-            auto exitPred = exitT->getPredecessorTasks();
-            hasArrivedBarrier = false;
-            for (auto it = exitPred.begin(), et = exitPred.end(); it != et; ++it)
-            {
-                if (it->getContextId() == cid)
-                {
-                    hasArrivedBarrier = true;
-                    break;
-                }
-            }
-            
-            // Task has not arrived at this barrier
-            if (hasArrivedBarrier == false) continue;
-            
-            auto exitSucc = exitT->getSuccessorTasks();
-            hasExitedBarrier = false;
-            for (auto it = exitSucc.begin(), et = exitSucc.end(); it != et; ++it)
-            {
-                if (it->getContextId() == cid)
-                {
-                    hasExitedBarrier = true;
-                    break;
-                }
-            }
-            
-            // Departing task arrived but did not exit barrier
-            if (hasExitedBarrier == false) break;
-        }
-        
-        // If this task's context has arrived but not exited the barrier
-        //   then this is the exit barrier
-        // Otherwise, the entry barrier might be a candidate
-        if (hasArrivedBarrier != true ||
-            hasExitedBarrier != false)
-        {
-            exitT = NULL;
-        }
+        auto it = exits[e].arrived.find(cid);
+        if (it != exits[e].arrived.end() && it->second == false) break;
     }
     
-    if (exitT == NULL)
+    // Otherwise, the entry barrier is added to the exit list
+    if (e == exits.size())
     {
-        // There should be an entry barrier to add to the exit list
-        assert(entryBarrierTask != NULL);
-        
-        auto entryPred = entryBarrierTask->getPredecessorTasks();
-        bool hasEntered = false;
-        ContextId cid = departingTask->getContextId();
-        for (auto it = entryPred.begin(), et = entryPred.end(); it != et; ++it)
-        {
-            if (it->getContextId() == cid)
-            {
-                hasEntered = true;
-                break;
-            }
-        }
-        assert(hasEntered == true);
+        assert(entry.t != NULL);
+        assert(entry.arrived.find(cid) != entry.arrived.end());
         
         // End time of barrier is the time when the first task departs
-        entryBarrierTask->setEndTime(exitTime);
-        
-        exitT = entryBarrierTask;
+        entry.t->setEndTime(exitTime);
         
-        exitBarrierTasks.push_back(entryBarrierTask);
+        exits.push_back(barrier_instance());
+        exits.back().t = entry.t;
+        exits.back().arrived.swap(entry.arrived);
         
-        entryBarrierTask = NULL;
+        entry.t = NULL;
     }
     
-    // Record that this thread arrived
+    // Record that this thread left
+    Task* exitT = exits[e].t;
+    exits[e].arrived[cid] = true;
     *finished = false;
 
     // If this was the last thread to arrive, clear out
@@ -158,15 +85,29 @@ Task* BarrierWrapper::onExit(Task* departingTask, ct_tsc_t exitTime, bool* finis
     //     context creates its continuation
     if (exitT->getPredecessorTasks().size() == (1 + exitT->getSuccessorTasks().size()))
     {
-        exitBarrierTasks.remove(exitT);
+        exits.erase(exits.begin() + e);
      
         // This barrier has finished, let the caller know
         *finished = true;
     }
-    else
-    {
-        //printf("\t%d != %d\n", exitT->getPredecessorTasks().size(), exitT->getSuccessorTasks().size());
-    }
 
     return exitT;
 }
+
+//
+// A context has arrived at a barrier task once it is a predecessor, and has left once
+//   its continuation is a successor
+//
+void BarrierWrapper::restoreArrivals()
+{
+    vector<barrier_instance*> all;
+    if (entry.t != NULL) all.push_back(&entry);
+    for (barrier_instance& ebt : exits) all.push_back(&ebt);
+    
+    for (barrier_instance* b : all)
+    {
+        b->arrived.clear();
+        for (TaskId p : b->t->getPredecessorTasks()) b->arrived[p.getContextId()] = false;
+        for (TaskId s : b->t->getSuccessorTasks()) b->arrived[s.getContextId()] = true;
+    }
+}
@@ -4,10 +4,16 @@
 #include "../common/taskLib/Task.hpp"
 #include "../common/eventLib/ct_event.h"
 #include <assert.h>
-#include <list>
+#include <unordered_map>
+#include <vector>
 
 namespace contech {
 
+//
+// The barrier tasks of one barrier address.  Each barrier task keeps a hash map of the
+//   contexts that have arrived, and whether each has left, so that arriving and leaving
+//   take constant time rather than a walk of the barrier task's edges.
+//
 class BarrierWrapper
 {
 public:
@@ -15,8 +21,22 @@ public:
     Task* onEnter(Task& arrivingTask, ct_tsc_t arrivalTime, ct_addr_t addr);
     Task* onExit(Task*, ct_tsc_t exitTime, bool*);
 private:
-    Task* entryBarrierTask;
-    list<Task*> exitBarrierTasks;
+    friend class Checkpoint;
+
+    typedef struct _barrier_instance
+    {
+        Task* t;
+        unordered_map<ContextId, bool> arrived;    // Context -> has it left
+    } barrier_instance;
+
+    // The barrier being entered, its task is NULL until the first arrival
+    barrier_instance entry;
+    
+    // Barriers that contexts are leaving, oldest first
+    vector<barrier_instance> exits;
+
+    // Rebuild the contexts of each barrier from the edges of its task
+    void restoreArrivals();
 };
 
 } // end namespace contech
@@ -0,0 +1,297 @@
+#include "BlockPipeline.hpp"
+#include "taskWrite.hpp"
+
+using namespace std;
+using namespace contech;
+
+// Actions handed to a worker at once, and batches queued before the main loop waits
+#define BLOCK_BATCH_SIZE 1024
+#define BLOCK_BATCH_LIMIT 16
+
+BlockPipeline::BlockPipeline(unsigned int numWorkers, bool r)
+{
+    recordRanges = r;
+    for (unsigned int i = 0; i < numWorkers; i++)
+    {
+        pblock_worker w = new block_worker;
+        w->bp = this;
+        w->current = new vector<block_work>;
+        w->current->reserve(BLOCK_BATCH_SIZE);
+        w->stopping = false;
+        w->busy = false;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->workCond, NULL);
+        pthread_cond_init(&w->spaceCond, NULL);
+
+        int ret = pthread_create(&w->thread, NULL, workerMain, w);
+        assert(ret == 0);
+        workers.push_back(w);
+    }
+}
+
+BlockPipeline::~BlockPipeline()
+{
+    stopWorkers();
+}
+
+//
+// Record the memory ops of a basic block event into t, as the serial middle layer does
+//
+void BlockPipeline::recordMemOps(Task* t, pct_event e, bool recordRanges)
+{
+    for (uint i = 0; i < e->bb.len; i++)
+    {
+        ct_memory_op memOp = e->bb.mem_op_array[i];
+
+        if (recordRanges)
+        {
+            uint64_t rangeLen = 0;
+            unsigned int rangeOps = EventLib::getMemOpRange(&e->bb, i, &rangeLen);
+            if (rangeOps > 1)
+            {
+                t->recordMemRangeAction(memOp.is_write, memOp.data, rangeLen);
+                i += rangeOps - 1;
+                continue;
+            }
+        }
+
+        if (memOp.is_atomic)
+        {
+            t->recordAtomicMemOpAction(memOp.pow_size, memOp.data);
+            continue;
+        }
+
+        t->recordMemOpAction(memOp.is_write, memOp.pow_size, memOp.data);
+    }
+}
+
+void BlockPipeline::run(block_work& w)
+{
+    switch (w.type)
+    {
+        case work_block:
+            w.t->reserveActions(1 + w.e->bb.len);
+            w.t->recordBasicBlockAction(w.e->bb.basic_block_id);
+            recordMemOps(w.t, w.e, recordRanges);
+            EventLib::deleteContechEvent(w.e);
+            break;
+        case work_malloc:
+            w.t->recordMallocAction(w.addr, w.size);
+            break;
+        case work_free:
+            w.t->recordFreeAction(w.addr);
+            break;
+        case work_memcpy:
+            w.t->recordMemCpyAction(w.size, w.addr, w.src);
+            break;
+        case work_atomic:
+            w.t->recordAtomicMemOpAction(3, w.addr);
+            break;
+        case work_queue:
+            backgroundQueueTaskNow(w.t);
+            break;
+    }
+}
+
+//
+// Each task's actions go to the worker of its context, so they stay in trace order
+//
+void BlockPipeline::add(block_work& w)
+{
+    if (workers.empty())
+    {
+        run(w);
+        return;
+    }
+
+    pblock_worker bw = workers[(uint32_t)w.t->getContextId() % workers.size()];
+    bw->current->push_back(w);
+    if (bw->current->size() >= BLOCK_BATCH_SIZE) submit(bw);
+}
+
+void BlockPipeline::submit(pblock_worker w)
+{
+    if (w->current->empty()) return;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->batches.size() >= BLOCK_BATCH_LIMIT)
+    {
+        pthread_cond_wait(&w->spaceCond, &w->lock);
+    }
+    exception_ptr error = w->error;
+    w->error = nullptr;
+    if (error == nullptr)
+    {
+        w->batches.push_back(w->current);
+        pthread_cond_signal(&w->workCond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    if (error != nullptr) rethrow_exception(error);
+
+    w->current = new vector<block_work>;
+    w->current->reserve(BLOCK_BATCH_SIZE);
+}
+
+void* BlockPipeline::workerMain(void* v)
+{
+    pblock_worker w = (pblock_worker)v;
+    bool failed = false;
+
+    while (true)
+    {
+        pthread_mutex_lock(&w->lock);
+        while (w->batches.empty() && !w->stopping)
+        {
+            pthread_cond_wait(&w->workCond, &w->lock);
+        }
+        if (w->batches.empty())
+        {
+            pthread_mutex_unlock(&w->lock);
+            break;
+        }
+        vector<block_work>* batch = w->batches.front();
+        w->batches.pop_front();
+        w->busy = true;
+        pthread_cond_signal(&w->spaceCond);
+        pthread_mutex_unlock(&w->lock);
+
+        // After a failure, batches are only taken so that the main loop does not wait
+        try
+        {
+            for (auto it = batch->begin(), et = batch->end(); it != et && !failed; ++it)
+            {
+                w->bp->run(*it);
+            }
+        }
+        catch (...)
+        {
+            pthread_mutex_lock(&w->lock);
+            w->error = current_exception();
+            pthread_mutex_unlock(&w->lock);
+            failed = true;
+        }
+        delete batch;
+        
+        pthread_mutex_lock(&w->lock);
+        w->busy = false;
+        pthread_cond_signal(&w->spaceCond);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    return NULL;
+}
+
+void BlockPipeline::recordBlock(Task* t, pct_event e)
+{
+    block_work w;
+    w.t = t;
+    w.e = e;
+    w.type = work_block;
+    add(w);
+}
+
+void BlockPipeline::recordMalloc(Task* t, uint64 addr, uint64 size)
+{
+    block_work w;
+    w.t = t;
+    w.type = work_malloc;
+    w.addr = addr;
+    w.size = size;
+    add(w);
+}
+
+void BlockPipeline::recordFree(Task* t, uint64 addr)
+{
+    block_work w;
+    w.t = t;
+    w.type = work_free;
+    w.addr = addr;
+    add(w);
+}
+
+void BlockPipeline::recordMemCpy(Task* t, uint64 size, uint64 dst, uint64 src)
+{
+    block_work w;
+    w.t = t;
+    w.type = work_memcpy;
+    w.addr = dst;
+    w.size = size;
+    w.src = src;
+    add(w);
+}
+
+void BlockPipeline::recordAtomic(Task* t, uint64 addr)
+{
+    block_work w;
+    w.t = t;
+    w.type = work_atomic;
+    w.addr = addr;
+    add(w);
+}
+
+void BlockPipeline::queueTask(Task* t)
+{
+    block_work w;
+    w.t = t;
+    w.type = work_queue;
+    add(w);
+}
+
+void BlockPipeline::drain()
+{
+    for (auto it = workers.begin(), et = workers.end(); it != et; ++it)
+    {
+        pblock_worker w = *it;
+        submit(w);
+
+        pthread_mutex_lock(&w->lock);
+        while (!w->batches.empty() || w->busy)
+        {
+            pthread_cond_wait(&w->spaceCond, &w->lock);
+        }
+        exception_ptr error = w->error;
+        w->error = nullptr;
+        pthread_mutex_unlock(&w->lock);
+        if (error != nullptr) rethrow_exception(error);
+    }
+}
+
+void BlockPipeline::finish()
+{
+    exception_ptr error = stopWorkers();
+    if (error != nullptr) rethrow_exception(error);
+}
+
+//
+// Join every worker, returning the first exception that one threw and that has not
+//   been rethrown.  The destructor must not throw, so it only stops the workers.
+//
+exception_ptr BlockPipeline::stopWorkers()
+{
+    exception_ptr error = nullptr;
+    for (auto it = workers.begin(), et = workers.end(); it != et; ++it)
+    {
+        pblock_worker w = *it;
+
+        // The last batch may exceed the limit, as the worker is stopping
+        pthread_mutex_lock(&w->lock);
+        if (!w->current->empty())
+        {
+            w->batches.push_back(w->current);
+            w->current = new vector<block_work>;
+        }
+        w->stopping = true;
+        pthread_cond_signal(&w->workCond);
+        pthread_mutex_unlock(&w->lock);
+
+        pthread_join(w->thread, NULL);
+        if (error == nullptr) error = w->error;
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->workCond);
+        pthread_cond_destroy(&w->spaceCond);
+        delete w->current;
+        delete w;
+    }
+    workers.clear();
+    return error;
+}
@@ -0,0 +1,100 @@
+#ifndef BLOCK_PIPELINE_HPP
+#define BLOCK_PIPELINE_HPP
+
+#include "../common/taskLib/Task.hpp"
+#include "../common/eventLib/ct_event.h"
+#include <pthread.h>
+#include <deque>
+#include <exception>
+#include <vector>
+
+namespace contech {
+
+//
+// Records the actions of tasks on worker threads, while the main loop resolves the
+//   create, join, sync and barrier edges between tasks in trace order.  Every action
+//   of a context is recorded by the same worker, in the order it was given, and a
+//   task is only queued for writing once its worker has reached it.
+//
+//   With no workers, actions are recorded immediately by the calling thread.
+//
+//   An exception thrown while recording, such as std::bad_alloc, stops that worker's
+//   recording and is rethrown on the main loop's thread by the next submit, drain or
+//   finish.  Unlike the serial middle layer, which splits a task when its actions
+//   cannot be allocated, the workers cannot split a task, as only the main loop may
+//   change a context's tasks, so running out of memory ends the run.
+//
+class BlockPipeline
+{
+public:
+    BlockPipeline(unsigned int numWorkers, bool recordRanges);
+    ~BlockPipeline();
+
+    bool isParallel() const {return !workers.empty();}
+
+    // Record the basic block and memory ops of e into t, and then free e
+    void recordBlock(Task* t, pct_event e);
+    void recordMalloc(Task* t, uint64 addr, uint64 size);
+    void recordFree(Task* t, uint64 addr);
+    void recordMemCpy(Task* t, uint64 size, uint64 dst, uint64 src);
+    void recordAtomic(Task* t, uint64 addr);
+
+    // Queue t for writing, once the actions given for it are recorded
+    void queueTask(Task* t);
+
+    // Wait for the actions given so far to be recorded, workers keep running
+    void drain();
+    
+    // Wait for every action to be recorded and every task to be queued
+    void finish();
+
+    static void recordMemOps(Task* t, pct_event e, bool recordRanges);
+
+private:
+    enum block_work_type
+    {
+        work_block,
+        work_malloc,
+        work_free,
+        work_memcpy,
+        work_atomic,
+        work_queue
+    };
+
+    typedef struct _block_work
+    {
+        Task* t;
+        pct_event e;
+        block_work_type type;
+        uint64 addr;
+        uint64 size;
+        uint64 src;
+    } block_work, *pblock_work;
+
+    typedef struct _block_worker
+    {
+        BlockPipeline* bp;
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t workCond;
+        pthread_cond_t spaceCond;
+        std::deque<std::vector<block_work>*> batches;
+        std::vector<block_work>* current;    // Filled by the main loop
+        bool stopping;
+        bool busy;                           // Recording a batch taken from batches
+        std::exception_ptr error;            // Thrown while recording, until rethrown
+    } block_worker, *pblock_worker;
+
+    std::vector<pblock_worker> workers;
+    bool recordRanges;
+
+    void add(block_work&);
+    void submit(pblock_worker);
+    void run(block_work&);
+    std::exception_ptr stopWorkers();
+    static void* workerMain(void*);
+};
+
+}
+
+#endif
@@ -0,0 +1,376 @@
+#include "Checkpoint.hpp"
+#include "middle.hpp"
+#include "taskWrite.hpp"
+#include <unistd.h>
+
+using namespace std;
+using namespace contech;
+
+// Task references that are not set
+#define NO_TASK UINT64_MAX
+
+Checkpoint::Checkpoint(const char* taskGraphPath)
+{
+    path = string(taskGraphPath) + ".ckpt";
+    tmpPath = path + ".tmp";
+    f = NULL;
+}
+
+Checkpoint::~Checkpoint()
+{
+    if (f != NULL) fclose(f);
+}
+
+FILE* Checkpoint::beginSave()
+{
+    assert(f == NULL);
+    f = fopen(tmpPath.c_str(), "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to create checkpoint %s\n", tmpPath.c_str());
+        exit(1);
+    }
+    return f;
+}
+
+//
+// A failed write leaves the error set on f, so the checkpoint is only renamed over the
+//   last one if every write, the flush and the close succeeded
+//
+void Checkpoint::commitSave()
+{
+    bool failed = (ferror(f) != 0 || fflush(f) != 0 || fsync(fileno(f)) != 0);
+    if (fclose(f) != 0) failed = true;
+    f = NULL;
+    if (failed) writeError();
+    taskNumbers.clear();
+    taskTable.clear();
+
+    if (rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to replace checkpoint %s\n", path.c_str());
+        exit(1);
+    }
+}
+
+FILE* Checkpoint::beginLoad()
+{
+    assert(f == NULL);
+    f = fopen(path.c_str(), "rb");
+    return f;
+}
+
+void Checkpoint::endLoad()
+{
+    fclose(f);
+    f = NULL;
+    taskNumbers.clear();
+    taskTable.clear();
+}
+
+void Checkpoint::remove()
+{
+    unlink(path.c_str());
+    unlink(tmpPath.c_str());
+}
+
+void Checkpoint::writeError()
+{
+    fprintf(stderr, "ERROR: Failed writing checkpoint %s\n", tmpPath.c_str());
+    exit(1);
+}
+
+void Checkpoint::readError()
+{
+    fprintf(stderr, "ERROR: Checkpoint %s is truncated\n", path.c_str());
+    exit(1);
+}
+
+void Checkpoint::addTask(Task* t)
+{
+    if (t == NULL || taskNumbers.find(t) != taskNumbers.end()) return;
+    taskNumbers[t] = taskTable.size();
+    taskTable.push_back(t);
+}
+
+void Checkpoint::writeTaskRef(Task* t)
+{
+    uint64_t n = NO_TASK;
+    if (t != NULL)
+    {
+        auto it = taskNumbers.find(t);
+        assert(it != taskNumbers.end());
+        n = it->second;
+    }
+    write(n);
+}
+
+Task* Checkpoint::readTaskRef()
+{
+    uint64_t n;
+    read(n);
+    if (n == NO_TASK) return NULL;
+    assert(n < taskTable.size());
+    return taskTable[n];
+}
+
+void Checkpoint::writeTaskQueue(mpi_task_queue& q)
+{
+    uint64_t count = 0;
+    for (auto& src : q)
+    {
+        for (auto& dst : src.second) count += dst.second.size();
+    }
+    write(count);
+
+    for (auto& src : q)
+    {
+        for (auto& dst : src.second)
+        {
+            for (auto& tag : dst.second)
+            {
+                write(src.first);
+                write(dst.first);
+                write(tag.first);
+                writeTaskRef(tag.second);
+            }
+        }
+    }
+}
+
+void Checkpoint::readTaskQueue(mpi_task_queue& q)
+{
+    uint64_t count;
+    read(count);
+    for (uint64_t i = 0; i < count; i++)
+    {
+        int src, dst, tag;
+        read(src);
+        read(dst);
+        read(tag);
+        q[src][dst][tag] = readTaskRef();
+    }
+}
+
+//
+// Save every task that is not yet written, and then the structures that refer to them.
+//   No actions may be in flight to these tasks.
+//
+void Checkpoint::saveState(ContextTable& context, map<ct_addr_t, Task*>& ownerList,
+                           unordered_map<ct_addr_t, BarrierWrapper>& barrierList,
+                           mpi_task_queue& mpiSendQ, mpi_task_queue& mpiRecvQ, mpi_req_table& mpiReq)
+{
+    vector<ContextId> contextIds = context.getIds();
+
+    for (ContextId cid : contextIds)
+    {
+        Context& c = context[cid];
+        for (Task* t : c.tasks) addTask(t);
+        for (auto& jm : c.joinMap) addTask(jm.second);
+    }
+    for (auto& ol : ownerList) addTask(ol.second);
+    for (auto& bl : barrierList)
+    {
+        addTask(bl.second.entry.t);
+        for (auto& ebt : bl.second.exits) addTask(ebt.t);
+    }
+    for (mpi_task_queue* q : {&mpiSendQ, &mpiRecvQ})
+    {
+        for (auto& src : *q)
+        {
+            for (auto& dst : src.second)
+            {
+                for (auto& tag : dst.second) addTask(tag.second);
+            }
+        }
+    }
+
+    uint64_t taskCount = taskTable.size();
+    write(taskCount);
+    for (Task* t : taskTable)
+    {
+        // The checkpoint holds every action, so a resumed run needs no spill file
+        if (taskSpill != NULL) taskSpill->restore(t);
+        Task::saveContechTask(*t, f);
+    }
+
+    uint64_t contextCount = contextIds.size();
+    write(contextCount);
+    for (ContextId cid : contextIds)
+    {
+        Context& c = context[cid];
+        write(cid);
+
+        uint64_t n = c.tasks.size();
+        write(n);
+        for (Task* t : c.tasks) writeTaskRef(t);
+
+        n = c.creatorMap.size();
+        write(n);
+        for (auto& cm : c.creatorMap)
+        {
+            write(cm.first);
+            write(cm.second);
+        }
+        n = c.joinMap.size();
+        write(n);
+        for (auto& jm : c.joinMap)
+        {
+            write(jm.first);
+            writeTaskRef(jm.second);
+        }
+        n = c.joinCountMap.size();
+        write(n);
+        for (auto& jc : c.joinCountMap)
+        {
+            write(jc.first);
+            write(jc.second);
+        }
+
+        write(c.hasStarted);
+        write(c.startTime);
+        write(c.endTime);
+        write(c.timeOffset);
+        write(c.currentTime);
+        write(c.atomicRunValid);
+        write(c.atomicRunTask);
+        write(c.inBarrier);
+        write(c.countedTask);
+        write(c.countedBlocks);
+    }
+
+    uint64_t n = ownerList.size();
+    write(n);
+    for (auto& ol : ownerList)
+    {
+        write(ol.first);
+        writeTaskRef(ol.second);
+    }
+
+    n = barrierList.size();
+    write(n);
+    for (auto& bl : barrierList)
+    {
+        write(bl.first);
+        writeTaskRef(bl.second.entry.t);
+        uint64_t exits = bl.second.exits.size();
+        write(exits);
+        for (auto& ebt : bl.second.exits) writeTaskRef(ebt.t);
+    }
+
+    writeTaskQueue(mpiSendQ);
+    writeTaskQueue(mpiRecvQ);
+
+    n = 0;
+    for (auto& rank : mpiReq) n += rank.second.size();
+    write(n);
+    for (auto& rank : mpiReq)
+    {
+        for (auto& req : rank.second)
+        {
+            write(rank.first);
+            write(req.first);
+            write(req.second);
+        }
+    }
+}
+
+void Checkpoint::loadState(ContextTable& context, map<ct_addr_t, Task*>& ownerList,
+                           unordered_map<ct_addr_t, BarrierWrapper>& barrierList,
+                           mpi_task_queue& mpiSendQ, mpi_task_queue& mpiRecvQ, mpi_req_table& mpiReq)
+{
+    uint64_t taskCount;
+    read(taskCount);
+    for (uint64_t i = 0; i < taskCount; i++)
+    {
+        Task* t = Task::loadContechTask(f);
+        if (t == NULL) readError();
+        taskTable.push_back(t);
+    }
+
+    uint64_t contextCount;
+    read(contextCount);
+    for (uint64_t i = 0; i < contextCount; i++)
+    {
+        ContextId cid;
+        read(cid);
+        Context& c = context[cid];
+
+        uint64_t n;
+        read(n);
+        for (uint64_t k = 0; k < n; k++) c.tasks.push_back(readTaskRef());
+
+        read(n);
+        for (uint64_t k = 0; k < n; k++)
+        {
+            ContextId child;
+            TaskId creator;
+            read(child);
+            read(creator);
+            c.creatorMap[child] = creator;
+        }
+        read(n);
+        for (uint64_t k = 0; k < n; k++)
+        {
+            ContextId child;
+            read(child);
+            c.joinMap[child] = readTaskRef();
+        }
+        read(n);
+        for (uint64_t k = 0; k < n; k++)
+        {
+            TaskId join;
+            int count;
+            read(join);
+            read(count);
+            c.joinCountMap[join] = count;
+        }
+
+        read(c.hasStarted);
+        read(c.startTime);
+        read(c.endTime);
+        read(c.timeOffset);
+        read(c.currentTime);
+        read(c.atomicRunValid);
+        read(c.atomicRunTask);
+        read(c.inBarrier);
+        read(c.countedTask);
+        read(c.countedBlocks);
+    }
+
+    uint64_t n;
+    read(n);
+    for (uint64_t k = 0; k < n; k++)
+    {
+        ct_addr_t addr;
+        read(addr);
+        ownerList[addr] = readTaskRef();
+    }
+
+    read(n);
+    for (uint64_t k = 0; k < n; k++)
+    {
+        ct_addr_t addr;
+        read(addr);
+        BarrierWrapper& bw = barrierList[addr];
+        bw.entry.t = readTaskRef();
+        uint64_t exits;
+        read(exits);
+        bw.exits.resize(exits);
+        for (uint64_t e = 0; e < exits; e++) bw.exits[e].t = readTaskRef();
+        bw.restoreArrivals();
+    }
+
+    readTaskQueue(mpiSendQ);
+    readTaskQueue(mpiRecvQ);
+
+    read(n);
+    for (uint64_t k = 0; k < n; k++)
+    {
+        int rank;
+        ct_addr_t req;
+        read(rank);
+        read(req);
+        read(mpiReq[rank][req]);
+    }
+}
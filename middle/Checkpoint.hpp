@@ -0,0 +1,99 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "Context.hpp"
+#include "BarrierWrapper.hpp"
+#include "../common/taskLib/ct_file.h"
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct mpi_recv_req;
+
+namespace contech {
+
+#define CHECKPOINT_VERSION 1
+
+typedef std::map<int, std::map<int, std::map<int, Task*> > > mpi_task_queue;
+typedef std::map<int, std::map<ct_addr_t, mpi_recv_req> > mpi_req_table;
+
+//
+// A checkpoint of the middle layer, from which a run resumes with the same output.
+//   The trace position is the number of events the main loop has taken, as the EventQ
+//   returns the same events in the same order when they are replayed.  The tasks not
+//   yet written are saved whole, and every other reference to a task is saved as its
+//   number in the checkpoint, so tasks shared between contexts, sync owners and
+//   barriers are restored shared.
+//
+//   A checkpoint is written beside the taskgraph and then renamed over the last one,
+//   so the last complete checkpoint survives a run that dies while writing the next.
+//
+class Checkpoint
+{
+public:
+    Checkpoint(const char* taskGraphPath);
+    ~Checkpoint();
+
+    // Save is begun, the fields written, and then committed
+    FILE* beginSave();
+    void commitSave();
+
+    // Returns NULL if there is no checkpoint
+    FILE* beginLoad();
+    void endLoad();
+
+    // The checkpoint is not needed once the taskgraph is complete
+    void remove();
+
+    void saveState(ContextTable& context, std::map<ct_addr_t, Task*>& ownerList,
+                   std::unordered_map<ct_addr_t, BarrierWrapper>& barrierList,
+                   mpi_task_queue& mpiSendQ, mpi_task_queue& mpiRecvQ, mpi_req_table& mpiReq);
+    void loadState(ContextTable& context, std::map<ct_addr_t, Task*>& ownerList,
+                   std::unordered_map<ct_addr_t, BarrierWrapper>& barrierList,
+                   mpi_task_queue& mpiSendQ, mpi_task_queue& mpiRecvQ, mpi_req_table& mpiReq);
+
+    template <typename T> void write(const T& v)
+    {
+        if (ct_write(&v, sizeof(T), f) != sizeof(T)) writeError();
+    }
+
+    template <typename T> void read(T& v)
+    {
+        if (ct_read(&v, sizeof(T), f) != sizeof(T)) readError();
+    }
+
+    // Arrays of n values
+    template <typename T> void write(const T* v, size_t n)
+    {
+        if (ct_write(v, n * sizeof(T), f) != n * sizeof(T)) writeError();
+    }
+
+    template <typename T> void read(T* v, size_t n)
+    {
+        if (ct_read(v, n * sizeof(T), f) != n * sizeof(T)) readError();
+    }
+
+private:
+    std::string path;
+    std::string tmpPath;
+    FILE* f;
+
+    // Tasks by their number in the checkpoint
+    std::unordered_map<Task*, uint64_t> taskNumbers;
+    std::vector<Task*> taskTable;
+
+    void addTask(Task*);
+    void writeTaskRef(Task*);
+    Task* readTaskRef();
+    void writeTaskQueue(mpi_task_queue&);
+    void readTaskQueue(mpi_task_queue&);
+
+    void writeError();
+    void readError();
+};
+
+}
+
+#endif
@@ -1,16 +1,45 @@
 #include "Context.hpp"
 #include "taskWrite.hpp"
+#include <algorithm>
 
 using namespace contech;
 
+static bool taskIdLess(Task* t, TaskId tid)
+{
+    return t->getTaskId() < tid;
+}
+
 Context::Context()
 {
     tasks.clear();
 }
 
 // Returns the currently active task
-//Task* Context::activeTask() { return this->tasks.front(); }
-Task* Context::activeTask() { return this->tasks.rbegin()->second; }
+Task* Context::activeTask() { return this->tasks.back(); }
+
+//
+// Add a task to the queue, replacing any task with the same id.  New tasks nearly
+//   always have the largest id, so this is usually a push to the back.
+//
+void Context::addTask(Task* t)
+{
+    TaskId tid = t->getTaskId();
+    if (tasks.empty() || tasks.back()->getTaskId() < tid)
+    {
+        tasks.push_back(t);
+        return;
+    }
+    
+    auto it = lower_bound(tasks.begin(), tasks.end(), tid, taskIdLess);
+    if (it != tasks.end() && (*it)->getTaskId() == tid)
+    {
+        *it = t;
+    }
+    else
+    {
+        tasks.insert(it, t);
+    }
+}
 
 //
 // Which of this context's tasks created cid
@@ -39,42 +68,25 @@ TaskId Context::getCreator(ContextId cid)
 //
 bool Context::removeTask(Task* t)
 {
-    // Probably better to use rbegin, but erase only takes iterators and not reverse iterators
-    /*for (auto it = tasks.begin(), et = tasks.end(); it != et; ++it)
-    {
-        if (*it == t) {tasks.erase(it); return true;}
-    }*/
-    
     if (t->getType() == task_type_join)
     {
         auto tjit = joinCountMap.find(t->getTaskId());
         assert(tjit == joinCountMap.end() || tjit->second == 0);
     }
     
-    auto it = tasks.find(t->getTaskId());
-    if (it == tasks.end()) return false;
+    TaskId tid = t->getTaskId();
+    auto it = lower_bound(tasks.begin(), tasks.end(), tid, taskIdLess);
+    if (it == tasks.end() || (*it)->getTaskId() != tid) return false;
     tasks.erase(it);
     
-    return true; // false;
+    return true;
 }
 
 Task* Context::getTask(TaskId tid)
 {
-    Task* r = NULL;
-    
-    // Probably better to use rbegin, but erase only takes iterators and not reverse iterators
-    /*for (auto it = tasks.begin(), et = tasks.end(); it != et; ++it)
-    {
-        r = *it;
-        if (r->getTaskId() == tid) {return r;}
-    }*/
-    
-    auto it = tasks.find(tid);
-    if (it == tasks.end()) return NULL;
-    return it->second;
-    
-    // Is it safe that r is equal to the last element in the list?
-    return r;
+    auto it = lower_bound(tasks.begin(), tasks.end(), tid, taskIdLess);
+    if (it == tasks.end() || (*it)->getTaskId() != tid) return NULL;
+    return *it;
 }
 
 Task* Context::childExits(TaskId childId)
@@ -95,7 +107,7 @@ Task* Context::childExits(TaskId childId)
         joinMap.erase(it);
         joinCountMap[r->getTaskId()] --;
         
-        if (tasks.find(r->getTaskId()) == tasks.end())
+        if (getTask(r->getTaskId()) == NULL)
         {
             printf("Child exiting on task that has already been removed: %s at %d\n", 
                 r->getTaskId().toString().c_str(), joinCountMap[r->getTaskId()]);
@@ -135,8 +147,7 @@ Task* Context::createBasicBlockContinuation()
     continuation->addPredecessor(activeTask()->getTaskId());
 
     // Make the continuation active
-    //tasks.push_front(continuation);
-    tasks[continuation->getTaskId()] = continuation;
+    addTask(continuation);
 
     return continuation;
 }
@@ -179,8 +190,7 @@ Task* Context::createContinuation(task_type type, ct_tsc_t tStartTime, ct_tsc_t
     continuation->addPredecessor(activeTask()->getTaskId());
 
     // Make the continuation active
-    //tasks.push_front(continuation);
-    tasks[continuation->getTaskId()] = continuation;
+    addTask(continuation);
 
     if (bbContinue != NULL)
     {
@@ -190,3 +200,56 @@ Task* Context::createContinuation(task_type type, ct_tsc_t tStartTime, ct_tsc_t
     
     return continuation;
 }
+
+ContextTable::~ContextTable()
+{
+    for (auto it = byRank.begin(), et = byRank.end(); it != et; ++it)
+    {
+        for (auto cit = it->begin(), cet = it->end(); cit != cet; ++cit)
+        {
+            delete *cit;
+        }
+    }
+}
+
+Context* ContextTable::create(uint32_t rank, uint32_t ctid)
+{
+    if (rank >= byRank.size()) byRank.resize(rank + 1);
+    vector<Context*>& contexts = byRank[rank];
+    if (ctid >= contexts.size()) contexts.resize(ctid + 1, NULL);
+    
+    // Contexts are allocated individually, so references to them survive later creates
+    if (contexts[ctid] == NULL) contexts[ctid] = new Context;
+    return contexts[ctid];
+}
+
+size_t ContextTable::count(ContextId cid) const
+{
+    uint32_t rank = (uint32_t)cid >> 24;
+    uint32_t ctid = (uint32_t)cid & 0xffffff;
+    return (rank < byRank.size() && ctid < byRank[rank].size() && byRank[rank][ctid] != NULL) ? 1 : 0;
+}
+
+vector<ContextId> ContextTable::getIds() const
+{
+    vector<ContextId> ids;
+    for (uint32_t rank = 0; rank < byRank.size(); rank++)
+    {
+        for (uint32_t ctid = 0; ctid < byRank[rank].size(); ctid++)
+        {
+            if (byRank[rank][ctid] != NULL) ids.push_back(ContextId((rank << 24) | ctid));
+        }
+    }
+    return ids;
+}
+
+//
+// A task of coalesced atomics owns their address, so it is kept like a sync task
+//   after it ends, until another contech synchronizes on the address.
+//
+bool Context::holdsAtomicRun(Task* t)
+{
+    return atomicRunValid &&
+           t->getType() == task_type_basic_blocks &&
+           t->getTaskId() == atomicRunTask;
+}
@@ -4,6 +4,8 @@
 #include <deque>
 #include <map>
 #include <list>
+#include <unordered_map>
+#include <vector>
 #include "../common/eventLib/ct_event.h"
 #include "../common/taskLib/Task.hpp"
 
@@ -19,24 +21,25 @@ public:
     Task* activeTask();
     Task* createBasicBlockContinuation();
     Task* createContinuation(task_type eventType, ct_tsc_t startTime, ct_tsc_t endTime);
+    void addTask(Task*);
     bool removeTask(Task*);
     Task* getTask(TaskId);
     TaskId getCreator(ContextId);
     void getChildJoin(ContextId, Task*);
     Task* childExits(TaskId);
     bool isCompleteJoin(TaskId);
+    bool holdsAtomicRun(Task*);
 
     // Queue of tasks that are running in this contech but have not been written to file yet. These tasks may have incomplete data.
-    // The front of the queue represents more recent tasks.
-    //list<Task*> tasks;
-    map<TaskId, Task*> tasks;
+    // The queue is in order of task id, so the back of the queue is the active task.
+    deque<Task*> tasks;
 
     // Map of ContextId -> TaskId, which task created which context
-    map<ContextId, TaskId> creatorMap;
+    unordered_map<ContextId, TaskId> creatorMap;
     // Map of child Context -> (childId -or- joinId)
-    map<ContextId, Task*> joinMap;
+    unordered_map<ContextId, Task*> joinMap;
     // How many joins are pending for this task, if 0 and not active then clear
-    map<TaskId, int> joinCountMap;
+    unordered_map<TaskId, int> joinCountMap;
     
     // Has this contech started running?
     bool hasStarted = false;
@@ -54,6 +57,52 @@ public:
     ct_tsc_t timeOffset = 0;
     
     ct_tsc_t currentTime = 0;
+    
+    // Task that owns the address of this contech's most recent atomic, which is its
+    //   sync task or the task its later atomics were coalesced into, valid if the last
+    //   sync was an atomic and no other contech has synchronized on the address since
+    bool atomicRunValid = false;
+    TaskId atomicRunTask = 0;
+    
+    // Between entering and leaving a barrier, the active task records nothing more
+    bool inBarrier = false;
+    
+    // Blocks given to countedTask, as the task's own count may still be recording
+    TaskId countedTask = 0;
+    unsigned int countedBlocks = 0;
+};
+
+//
+// Every context of every rank, indexed by the rank and then the contech id of the
+//   ContextId, (rank << 24) | ctid.  Contech ids are assigned densely by the runtime,
+//   so this replaces a tree walk per event with two array lookups.
+//
+class ContextTable
+{
+public:
+    ~ContextTable();
+
+    // As with map::operator[], a context is created on first use
+    Context& operator[](ContextId cid)
+    {
+        uint32_t rank = (uint32_t)cid >> 24;
+        uint32_t ctid = (uint32_t)cid & 0xffffff;
+        if (rank < byRank.size() && ctid < byRank[rank].size() && byRank[rank][ctid] != NULL)
+        {
+            return *byRank[rank][ctid];
+        }
+        return *create(rank, ctid);
+    }
+    
+    size_t count(ContextId) const;
+    
+    // Ids of the existing contexts, in increasing order
+    vector<ContextId> getIds() const;
+
+private:
+    vector<vector<Context*> > byRank;
+    
+    Context* create(uint32_t, uint32_t);
 };
 
 } // end namespace contech
@@ -0,0 +1,264 @@
+#include "TaskIndexGraph.hpp"
+#include "Checkpoint.hpp"
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <queue>
+
+using namespace std;
+using namespace contech;
+
+// Edges buffered before each append to the edge file
+#define EDGE_FILE_BATCH (1 << 20)
+
+TaskIndexGraph::TaskIndexGraph(uint64_t b)
+{
+    succBegin.push_back(0);
+    edgeFile = NULL;
+    edgeCount = 0;
+    budget = b;
+    edgeMap = NULL;
+}
+
+TaskIndexGraph::~TaskIndexGraph()
+{
+    if (edgeMap != NULL) munmap(edgeMap, edgeCount * sizeof(uint64_t));
+    if (edgeFile != NULL) fclose(edgeFile);
+}
+
+uint32_t TaskIndexGraph::addTask(Task* t)
+{
+    uint32_t n = ids.size();
+    assert(n != UINT32_MAX);
+
+    ids.push_back(t->getTaskId());
+    starts.push_back(t->getStartTime());
+    writePos.push_back(0);
+    preds.push_back(t->getPredecessorTasks().size());
+    types.push_back(t->getType());
+
+    vector<TaskId>& s = t->getSuccessorTasks();
+    for (TaskId succ : s)
+    {
+        edges.push_back((uint64_t)succ);
+    }
+    edgeCount += s.size();
+    succBegin.push_back(edgeCount);
+    checkEdges();
+
+    return n;
+}
+
+// Move the edges to the edge file, once they pass the budget
+void TaskIndexGraph::checkEdges()
+{
+    if (edgeFile == NULL && budget != 0 && edges.size() * sizeof(uint64_t) > budget)
+    {
+        edgeFile = tmpfile();
+        if (edgeFile == NULL)
+        {
+            fprintf(stderr, "ERROR: Unable to create the task index edge file\n");
+            exit(1);
+        }
+        flushEdges();
+    }
+    else if (edgeFile != NULL && edges.size() >= EDGE_FILE_BATCH)
+    {
+        flushEdges();
+    }
+}
+
+void TaskIndexGraph::flushEdges()
+{
+    if (ct_write(edges.data(), edges.size() * sizeof(uint64_t), edgeFile) != edges.size() * sizeof(uint64_t))
+    {
+        fprintf(stderr, "ERROR: Failed writing the task index edge file\n");
+        exit(1);
+    }
+    edges.clear();
+}
+
+uint64_t* TaskIndexGraph::mapEdges()
+{
+    if (edgeFile == NULL) return edges.data();
+    if (edgeCount == 0) return NULL;
+
+    flushEdges();
+    vector<uint64_t>().swap(edges);
+    fflush(edgeFile);
+
+    void* m = mmap(NULL, edgeCount * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fileno(edgeFile), 0);
+    if (m == MAP_FAILED)
+    {
+        fprintf(stderr, "ERROR: Unable to map the task index edge file\n");
+        exit(1);
+    }
+    edgeMap = (uint64_t*)m;
+    return edgeMap;
+}
+
+//
+// Replace each edge's TaskId with the number of that task, in one pass over the edges
+//
+void TaskIndexGraph::resolveEdges(uint64_t* e)
+{
+    vector<pair<uint64_t, uint32_t> > byId(ids.size());
+    for (uint32_t n = 0; n < ids.size(); n++)
+    {
+        byId[n] = make_pair((uint64_t)ids[n], n);
+    }
+    sort(byId.begin(), byId.end());
+    for (size_t i = 1; i < byId.size(); i++)
+    {
+        assert(byId[i - 1].first != byId[i].first);
+    }
+
+    for (uint64_t k = 0; k < edgeCount; k++)
+    {
+        auto it = lower_bound(byId.begin(), byId.end(), make_pair(e[k], (uint32_t)0));
+        if (it == byId.end() || it->first != e[k])
+        {
+            fprintf(stderr, "ERROR: Successor %s was never written\n", TaskId(e[k]).toString().c_str());
+            exit(1);
+        }
+        e[k] = it->second;
+    }
+}
+
+//
+// This reproduces the BFS algorithm that had been used for writing tasks
+//   It is much faster to sort the tasks on just the graph information than
+//   to indefinitely delay writing a task until the entire graph is available.
+//
+// taskSort is a priority queue, the top element is the oldest task that has all
+//   its prior tasks in the index.  Ties are broken by the heap alone, so the tasks
+//   are pushed in the same order as the original writer to keep the same index.
+//
+uint64_t TaskIndexGraph::writeIndex(FILE* out, TaskId* lastTid)
+{
+    typedef pair<ct_timestamp, uint32_t> index_entry;
+    struct index_later
+    {
+        bool operator()(const index_entry& a, const index_entry& b) const {return a.first > b.first;}
+    };
+
+    uint64_t* e = mapEdges();
+    resolveEdges(e);
+
+    auto first = find(ids.begin(), ids.end(), TaskId(0));
+    assert(first != ids.end());
+
+    priority_queue<index_entry, vector<index_entry>, index_later> taskSort;
+    taskSort.push(make_pair(starts[first - ids.begin()], (uint32_t)(first - ids.begin())));
+
+    uint64_t indexWriteCount = 0;
+    while (!taskSort.empty())
+    {
+        uint32_t n = taskSort.top().second;
+        taskSort.pop();
+
+        *lastTid = ids[n];
+        ct_write(&ids[n], sizeof(TaskId), out);
+        ct_write(&writePos[n], sizeof(uint64), out);
+
+        for (uint64_t k = succBegin[n]; k < succBegin[n + 1]; k++)
+        {
+            uint32_t s = e[k];
+            preds[s]--;
+            if (preds[s] == 0)
+            {
+                taskSort.push(make_pair(starts[s], s));
+            }
+        }
+
+        // Mark the task as written
+        types[n] = 0xff;
+        indexWriteCount++;
+    }
+
+    return indexWriteCount;
+}
+
+//
+// Save the graph with its edges, which are read back from the edge file if they
+//   were moved there
+//
+void TaskIndexGraph::save(Checkpoint& out)
+{
+    uint64_t n = ids.size();
+    out.write(n);
+    out.write(ids.data(), n);
+    out.write(starts.data(), n);
+    out.write(writePos.data(), n);
+    out.write(preds.data(), n);
+    out.write(types.data(), n);
+    out.write(succBegin.data(), n + 1);
+    out.write(edgeCount);
+
+    if (edgeFile == NULL)
+    {
+        out.write(edges.data(), edgeCount);
+        return;
+    }
+
+    flushEdges();
+    fflush(edgeFile);
+    vector<uint64_t> batch(EDGE_FILE_BATCH);
+    for (uint64_t k = 0; k < edgeCount; k += EDGE_FILE_BATCH)
+    {
+        size_t count = min((uint64_t)EDGE_FILE_BATCH, edgeCount - k);
+        size_t len = count * sizeof(uint64_t);
+        if (pread(fileno(edgeFile), batch.data(), len, k * sizeof(uint64_t)) != (ssize_t)len)
+        {
+            fprintf(stderr, "ERROR: Failed reading the task index edge file\n");
+            exit(1);
+        }
+        out.write(batch.data(), count);
+    }
+}
+
+void TaskIndexGraph::load(Checkpoint& in)
+{
+    uint64_t n;
+    in.read(n);
+    ids.resize(n);
+    starts.resize(n);
+    writePos.resize(n);
+    preds.resize(n);
+    types.resize(n);
+    succBegin.resize(n + 1);
+    in.read(ids.data(), n);
+    in.read(starts.data(), n);
+    in.read(writePos.data(), n);
+    in.read(preds.data(), n);
+    in.read(types.data(), n);
+    in.read(succBegin.data(), n + 1);
+    in.read(edgeCount);
+
+    // The edges go back to the edge file if they are over the budget
+    for (uint64_t k = 0; k < edgeCount; k += EDGE_FILE_BATCH)
+    {
+        size_t count = min((uint64_t)EDGE_FILE_BATCH, edgeCount - k);
+        size_t pos = edges.size();
+        edges.resize(pos + count);
+        in.read(edges.data() + pos, count);
+        checkEdges();
+    }
+}
+
+void TaskIndexGraph::printUnwritten()
+{
+    uint64_t* e = (edgeMap != NULL) ? edgeMap : edges.data();
+
+    for (uint32_t n = 0; n < ids.size(); n++)
+    {
+        if (types[n] == 0xff) continue;
+        printf("%s (type:%d) (pred:%d)\t", ids[n].toString().c_str(), types[n], preds[n]);
+        for (uint64_t k = succBegin[n]; k < succBegin[n + 1]; k++)
+        {
+            printf("%s\t", ids[e[k]].toString().c_str());
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef TASK_INDEX_GRAPH_HPP
+#define TASK_INDEX_GRAPH_HPP
+
+#include "../common/taskLib/Task.hpp"
+#include <stdio.h>
+#include <vector>
+
+namespace contech {
+
+class Checkpoint;
+
+//
+// The graph of the tasks written to a taskgraph file, kept only to order its index.
+//   Tasks are numbered in write order, and their fields are held in parallel arrays
+//   with the successor edges in compressed sparse row form, rather than in a map of
+//   per task wrappers.  Edges past the budget are appended to a temporary file, which
+//   is mapped back in to order the index.
+//
+class TaskIndexGraph
+{
+public:
+    TaskIndexGraph(uint64_t budget);
+    ~TaskIndexGraph();
+
+    // Add a task that is being written, returning its number
+    uint32_t addTask(Task* t);
+    void setWritePos(uint32_t n, uint64 pos) {writePos[n] = pos;}
+    size_t size() const {return ids.size();}
+
+    // Write the index entries from task 0 in the order of the original BFS writer,
+    //   returning how many were written
+    uint64_t writeIndex(FILE* out, TaskId* lastTid);
+
+    // Print the tasks that writeIndex could not reach
+    void printUnwritten();
+
+    // Copy the graph to or from a checkpoint, before the index is written
+    void save(Checkpoint& out);
+    void load(Checkpoint& in);
+
+private:
+    std::vector<TaskId> ids;
+    std::vector<ct_timestamp> starts;
+    std::vector<uint64> writePos;
+    std::vector<int32_t> preds;         // Predecessors not yet in the index
+    std::vector<uint8_t> types;
+    std::vector<uint64_t> succBegin;    // Edges of task n are [succBegin[n], succBegin[n + 1])
+
+    // Edges are the successors' TaskIds, which writeIndex replaces with their numbers
+    std::vector<uint64_t> edges;        // All edges, or those not yet in edgeFile
+    FILE* edgeFile;
+    uint64_t edgeCount;
+    uint64_t budget;
+    uint64_t* edgeMap;
+
+    void checkEdges();
+    void flushEdges();
+    uint64_t* mapEdges();
+    void resolveEdges(uint64_t*);
+};
+
+}
+
+#endif
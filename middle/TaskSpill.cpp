@@ -0,0 +1,207 @@
+#include "TaskSpill.hpp"
+#include <unistd.h>
+
+using namespace std;
+using namespace contech;
+
+// Smaller action lists are left in memory, as they would cost more to track than they hold
+#define SPILL_MIN_BYTES 4096
+
+TaskSpill::TaskSpill(uint64_t b)
+{
+    // The spill file is removed once it is closed
+    FILE* f = tmpfile();
+    if (f == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to create the task spill file\n");
+        assert(0);
+    }
+    fd = dup(fileno(f));
+    fclose(f);
+    assert(fd != -1);
+
+    budget = b;
+    spillEnd = 0;
+    fileBytes = 0;
+    spilledTasks = 0;
+    spilledBytes = 0;
+    pthread_mutex_init(&lock, NULL);
+}
+
+TaskSpill::~TaskSpill()
+{
+    close(fd);
+    pthread_mutex_destroy(&lock);
+}
+
+void TaskSpill::check(ContextTable& context)
+{
+    vector<ContextId> contextIds = context.getIds();
+    uint64_t held = 0;
+
+    for (ContextId cid : contextIds)
+    {
+        for (Task* t : context[cid].tasks)
+        {
+            held += t->getActionBytes();
+        }
+    }
+    if (held <= budget) return;
+
+    // The active task is still recording, unless its context waits in a barrier.  Every
+    //   older task is waiting on another context.
+    for (auto it = contextIds.begin(), et = contextIds.end(); it != et && held > budget; ++it)
+    {
+        Context& c = context[*it];
+        if (c.tasks.empty()) continue;
+        size_t waiting = (c.inBarrier) ? c.tasks.size() : c.tasks.size() - 1;
+        for (size_t i = 0; i < waiting && held > budget; i++)
+        {
+            held -= spill(c.tasks[i]);
+        }
+    }
+}
+
+//
+// Find len bytes of the spill file, first fit in the space released by restored tasks
+//   and otherwise at its end.  Called with lock held.
+//
+uint64_t TaskSpill::allocate(uint64_t len)
+{
+    for (auto it = freeSpace.begin(), et = freeSpace.end(); it != et; ++it)
+    {
+        if (it->second < len) continue;
+        uint64_t offset = it->first;
+        if (it->second > len) freeSpace[offset + len] = it->second - len;
+        freeSpace.erase(it);
+        return offset;
+    }
+
+    uint64_t offset = spillEnd;
+    spillEnd += len;
+    if (spillEnd > fileBytes) fileBytes = spillEnd;
+    return offset;
+}
+
+//
+// Return space to the spill file, merging it with the free space next to it.  Called
+//   with lock held.
+//
+void TaskSpill::release(uint64_t offset, uint64_t len)
+{
+    auto next = freeSpace.lower_bound(offset);
+    if (next != freeSpace.end() && next->first == offset + len)
+    {
+        len += next->second;
+        next = freeSpace.erase(next);
+    }
+    if (next != freeSpace.begin())
+    {
+        auto prev = next;
+        --prev;
+        if (prev->first + prev->second == offset)
+        {
+            offset = prev->first;
+            len += prev->second;
+            freeSpace.erase(prev);
+        }
+    }
+
+    // Space at the end is given back to the end, so the file only grows past its peak
+    if (offset + len == spillEnd) spillEnd = offset;
+    else freeSpace[offset] = len;
+}
+
+//
+// Write the actions of t to the spill file and release them, returning the bytes
+//   released.  A task spilled before only writes the actions recorded since, which
+//   follow its earlier extents.
+//
+uint64_t TaskSpill::spill(Task* t)
+{
+    uint64_t released = t->getActionBytes();
+    if (released < SPILL_MIN_BYTES) return 0;
+
+    spill_extent e;
+    e.count = t->getActionCount();
+    pthread_mutex_lock(&lock);
+    e.offset = allocate(e.count * sizeof(Action));
+    pthread_mutex_unlock(&lock);
+
+    // The actions are written a run at a time, so the chunks need not be copied
+    uint64_t offset = e.offset;
+    vector<pair<const Action*, size_t> > runs;
+    t->getActionRuns(runs);
+    for (auto r : runs)
+    {
+        size_t len = r.second * sizeof(Action);
+        size_t pos = 0;
+        while (pos < len)
+        {
+            ssize_t w = pwrite(fd, (const char*)r.first + pos, len - pos, offset + pos);
+            if (w <= 0)
+            {
+                fprintf(stderr, "ERROR: Failed writing the task spill file\n");
+                assert(0);
+            }
+            pos += w;
+        }
+        offset += len;
+    }
+    spilledTasks++;
+    spilledBytes += offset - e.offset;
+
+    pthread_mutex_lock(&lock);
+    spilled[t->getTaskId()].push_back(e);
+    pthread_mutex_unlock(&lock);
+
+    t->clearActions();
+    return released;
+}
+
+void TaskSpill::restore(Task* t)
+{
+    vector<spill_extent> extents;
+
+    pthread_mutex_lock(&lock);
+    auto it = spilled.find(t->getTaskId());
+    if (it == spilled.end())
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    extents.swap(it->second);
+    spilled.erase(it);
+    pthread_mutex_unlock(&lock);
+
+    size_t count = 0;
+    for (auto e : extents) count += e.count;
+    vector<Action> s(count);
+    char* dst = (char*)s.data();
+    for (auto e : extents)
+    {
+        size_t len = e.count * sizeof(Action);
+        size_t pos = 0;
+        while (pos < len)
+        {
+            ssize_t r = pread(fd, dst + pos, len - pos, e.offset + pos);
+            if (r <= 0)
+            {
+                fprintf(stderr, "ERROR: Failed reading the task spill file\n");
+                assert(0);
+            }
+            pos += r;
+        }
+        dst += len;
+    }
+
+    // The space can be reused once it is read
+    pthread_mutex_lock(&lock);
+    for (auto e : extents) release(e.offset, e.count * sizeof(Action));
+    pthread_mutex_unlock(&lock);
+
+    // A task that became active again may have recorded more actions since
+    vector<Action>& a = t->getActions();
+    s.insert(s.end(), a.begin(), a.end());
+    a.swap(s);
+}
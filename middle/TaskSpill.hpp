@@ -0,0 +1,67 @@
+#ifndef TASK_SPILL_HPP
+#define TASK_SPILL_HPP
+
+#include "Context.hpp"
+#include <pthread.h>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace contech {
+
+//
+// Bounds the memory held by tasks that wait in their contexts for joins or sync owners.
+//   Once the actions of every context's tasks exceed the budget, the action lists of
+//   the waiting tasks, and of the tasks of contexts in a barrier, which no longer change,
+//   are moved to a spill file.  The graph metadata stays in memory, and the actions are
+//   read back when the task is written.
+//
+//   A task spilled again only writes the actions recorded since, and the space of the
+//   restored tasks is reused, so the file holds at most the peak of the spilled actions,
+//   and some fragmentation.  The budget is middle's -m, which separately bounds the
+//   edges of the taskgraph index in memory, see TaskIndexGraph.
+//
+class TaskSpill
+{
+public:
+    TaskSpill(uint64_t budget);
+    ~TaskSpill();
+
+    // Spill waiting tasks if the contexts hold more than the budget.  No actions may
+    //   still be in flight to the tasks of these contexts.
+    void check(ContextTable& context);
+
+    // Read back the actions of t, if they were spilled
+    void restore(Task* t);
+
+    uint64_t getSpilledTasks() const {return spilledTasks;}
+    uint64_t getSpilledBytes() const {return spilledBytes;}
+    uint64_t getFileBytes() const {return fileBytes;}
+
+private:
+    typedef struct _spill_extent
+    {
+        uint64_t offset;
+        size_t count;
+    } spill_extent;
+
+    int fd;
+    uint64_t budget;
+    uint64_t spillEnd;
+    uint64_t fileBytes;
+    uint64_t spilledTasks;
+    uint64_t spilledBytes;
+
+    // Spilled tasks are restored by the writer thread
+    pthread_mutex_t lock;
+    unordered_map<TaskId, std::vector<spill_extent> > spilled;   // In action order
+    std::map<uint64_t, uint64_t> freeSpace;                       // Offset to bytes
+
+    uint64_t spill(Task*);
+    uint64_t allocate(uint64_t);
+    void release(uint64_t, uint64_t);
+};
+
+}
+
+#endif
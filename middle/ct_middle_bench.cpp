@@ -0,0 +1,186 @@
+#include "../common/eventLib/ct_event.h"
+
+#include <vector>
+
+using namespace contech;
+
+//
+// Writes a synthetic trace for timing the middle layer.  Context 0 creates every
+//   other context, which each run blocks with a few memory ops and some locks,
+//   and then exit and are joined.  The buffer chunks of the contexts are interleaved,
+//   so every chunk switches the active context, as in traces of many threads.
+//
+//   ct_middle_bench <trace> [contexts] [blocks per context]
+//
+
+#define BENCH_BLOCKS 64
+#define BENCH_RECORDED_OPS 2
+#define BENCH_CHUNK_BLOCKS 512   // Blocks of a context in each chunk
+#define BENCH_LOCKS 16
+
+static void put(std::vector<uint8_t>& b, const void* v, size_t len)
+{
+    b.insert(b.end(), (const uint8_t*)v, (const uint8_t*)v + len);
+}
+
+static void put8(std::vector<uint8_t>& b, uint8_t v) {put(b, &v, sizeof(v));}
+static void put16(std::vector<uint8_t>& b, uint16_t v) {put(b, &v, sizeof(v));}
+static void put32(std::vector<uint8_t>& b, uint32_t v) {put(b, &v, sizeof(v));}
+static void put64(std::vector<uint8_t>& b, uint64_t v) {put(b, &v, sizeof(v));}
+
+static void putEventType(std::vector<uint8_t>& b, uint8_t type)
+{
+    put8(b, type);
+    put8(b, 0); put8(b, 0); put8(b, 0);
+}
+
+static void putCreate(std::vector<uint8_t>& b, uint64_t t, uint32_t other, uint64_t skew)
+{
+    putEventType(b, ct_event_task_create);
+    put64(b, t);
+    put64(b, t + 10);
+    put32(b, other);
+    put64(b, skew);
+}
+
+static void putJoin(std::vector<uint8_t>& b, uint64_t t, uint32_t other, bool isExit)
+{
+    putEventType(b, ct_event_task_join);
+    put8(b, isExit);
+    put64(b, t);
+    put64(b, t + 10);
+    put32(b, other);
+}
+
+static void putSync(std::vector<uint8_t>& b, uint64_t t, uint64_t addr, uint64_t ticket)
+{
+    putEventType(b, ct_event_sync);
+    put64(b, t);
+    put64(b, t + 20);
+    put32(b, ct_sync_acquire);
+    put64(b, addr);
+    put64(b, ticket);
+}
+
+static void writeHeader(FILE* f)
+{
+    std::vector<uint8_t> b;
+
+    put32(b, 0);
+    put32(b, ct_event_version);
+    put32(b, CONTECH_DELTA_VERSION - 1);  // Raw addresses
+    put32(b, BENCH_BLOCKS);
+
+    putEventType(b, ct_event_rank);
+    put32(b, 0);
+
+    for (uint32_t id = 0; id < BENCH_BLOCKS; id++)
+    {
+        put8(b, ct_event_basic_block_info);
+        put32(b, id);
+        put32(b, -1);   // Next block
+        put32(b, 0);    // Flags
+        put32(b, id);   // Line
+        put32(b, 8);    // Ops
+        put32(b, 4);    // Critical path
+        put32(b, 5); put(b, "bench", 5);
+        put32(b, 5); put(b, "bench", 5);
+        put32(b, 0);
+        put32(b, BENCH_RECORDED_OPS);
+        for (unsigned int j = 0; j < BENCH_RECORDED_OPS; j++)
+        {
+            put8(b, j & 0x1);
+            put8(b, 3);
+        }
+    }
+
+    fwrite(b.data(), 1, b.size(), f);
+}
+
+static void writeChunk(FILE* f, uint32_t ctid, const std::vector<uint8_t>& b)
+{
+    uint32_t head[3] = {ct_event_buffer, ctid, (uint32_t)b.size()};
+    fwrite(head, sizeof(head), 1, f);
+    fwrite(b.data(), 1, b.size(), f);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <trace> [contexts] [blocks per context]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int contexts = (argc > 2) ? atoi(argv[2]) : 256;
+    unsigned int blocks = (argc > 3) ? atoi(argv[3]) : 20000;
+    if (contexts < 2 || blocks == 0)
+    {
+        fprintf(stderr, "Usage: %s <trace> [contexts] [blocks per context]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* f = fopen(argv[1], "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to create the benchmark trace: %s\n", argv[1]);
+        return 1;
+    }
+
+    writeHeader(f);
+
+    std::vector<uint8_t> b;
+    uint64_t t = 1000;
+    uint64_t ticket = 0;
+
+    putCreate(b, t, 0, 0);
+    for (uint32_t c = 1; c < contexts; c++)
+    {
+        t += 100;
+        putCreate(b, t, c, 0);
+    }
+    writeChunk(f, 0, b);
+
+    for (unsigned int done = 0; done < blocks; done += BENCH_CHUNK_BLOCKS)
+    {
+        for (uint32_t c = 1; c < contexts; c++)
+        {
+            b.clear();
+            if (done == 0) putCreate(b, t, 0, 100 * c);
+
+            for (unsigned int i = done; i < blocks && i < done + BENCH_CHUNK_BLOCKS; i++)
+            {
+                uint32_t id = (c + i) % BENCH_BLOCKS;
+                put8(b, id & 0x7f);
+                put16(b, id >> 7);
+                for (unsigned int j = 0; j < BENCH_RECORDED_OPS; j++)
+                {
+                    uint64_t a = ((uint64_t)c << 32) + i * 16 + j * 8;
+                    put(b, &a, 6);
+                }
+
+                t += 10;
+                if ((i % 64) == 63)
+                {
+                    putSync(b, t, 0x1000 + 64 * ((c + i) % BENCH_LOCKS), ticket++);
+                    t += 30;
+                }
+            }
+
+            if (done + BENCH_CHUNK_BLOCKS >= blocks) putJoin(b, t, 0, true);
+            writeChunk(f, c, b);
+        }
+    }
+
+    b.clear();
+    for (uint32_t c = 1; c < contexts; c++)
+    {
+        t += 100;
+        putJoin(b, t, c, false);
+    }
+    writeChunk(f, 0, b);
+    fclose(f);
+
+    printf("Wrote %u contexts of %u blocks to %s\n", contexts, blocks, argv[1]);
+    return 0;
+}
@@ -7,6 +7,11 @@
 using namespace std;
 using namespace contech;
 
+// Events each reader thread may decode ahead of the main loop, and events added
+//   or taken before the other side sees them
+#define EVENT_PREFETCH_SIZE 4096
+#define EVENT_PREFETCH_BATCH 256
+
 void eventDebugPrint(TaskId first, string verb, TaskId second, ct_tsc_t start, ct_tsc_t end)
 {
     cerr << start << " - " << end << ": ";
@@ -17,6 +22,11 @@ EventQ::EventQ()
 {
     currentTrace = traces.begin();
     totalSpace = 0;
+    strandedEvents = 0;
+    decodeThreads = 1;
+    skipMemOps = false;
+    sharedEvents = false;
+    prefetch = false;
 }
 
 EventQ::~EventQ()
@@ -35,7 +45,53 @@ void EventQ::printSpaceTime(ct_tsc_t tcyc)
 
 void EventQ::registerEventList(FILE* f)
 {
-    traces.push_back(new EventList(f));
+    EventList* el = new EventList(f, decodeThreads, sharedEvents, prefetch);
+    el->setSkipMemOps(skipMemOps);
+    traces.push_back(el);
+}
+
+//
+// Register a trace that is only read from the chunks [first, end) of its index.
+//   first should be resumable, see TraceIndex::findResumeChunk.
+//
+void EventQ::registerEventList(FILE* f, TraceIndex* index, size_t first, size_t end)
+{
+    EventList* el = new EventList(f, decodeThreads, sharedEvents, prefetch);
+    el->setSkipMemOps(skipMemOps);
+    el->setChunkRange(index, first, end);
+    traces.push_back(el);
+}
+
+//
+// Decode each trace with this many threads, applies to traces registered afterward
+//
+void EventQ::setDecodeThreads(unsigned int n)
+{
+    decodeThreads = n;
+}
+
+//
+// Decode basic blocks without their memory ops, applies to traces registered afterward
+//
+void EventQ::setSkipMemOps(bool s)
+{
+    skipMemOps = s;
+}
+
+//
+// Let events be freed by threads other than the reader, applies to traces registered afterward
+//
+void EventQ::setSharedEvents(bool s)
+{
+    sharedEvents = s;
+}
+
+//
+// Decode each trace ahead on its own reader thread, applies to traces registered afterward
+//
+void EventQ::setPrefetch(bool p)
+{
+    prefetch = p;
 }
 
 void EventQ::readyEvents(int rank, unsigned int context)
@@ -62,6 +118,7 @@ pct_event EventQ::getNextContechEvent(int* rank)
         {
             fclose((*currentTrace)->file);
             totalSpace += (*currentTrace)->getSpace();
+            strandedEvents += (*currentTrace)->getStrandedEvents();
             delete *currentTrace;
             currentTrace = traces.erase(currentTrace);
         }
@@ -76,48 +133,340 @@ pct_event EventQ::getNextContechEvent(int* rank)
     return event;
 }
 
-EventList::EventList(FILE* f)
+EventList::EventList(FILE* f, unsigned int threads, bool sharedEvents, bool p)
 {
     file = f;
     el = new EventLib;
+    // The reader thread's events are freed by the main loop
+    arena = new EventArena(sharedEvents || p);
+    pd = NULL;
+    decodeThreads = threads;
+    index = NULL;
+    firstChunk = endChunk = 0;
+    seekPending = false;
     currentQueuedCount = 0;
     maxQueuedCount = 0;
     barrierNum = 0;
     ticketNum = 0;
-    minQueuedTicket = 0;
-    resetMinTicket = false;
     mpiRank = 0;
-    eventQueueCurrent = queuedEvents.begin();
+    
+    prefetch = p;
+    readerStarted = false;
+    readEnd = false;
+    ring = NULL;
+    ringHead = ringTail = 0;
+    takeHead = cachedTail = 0;
+    addTail = cachedHead = 0;
+    readerWaiting = consumerWaiting = stopping = false;
+    resumePending = false;
+    resumeEvent = ~0ULL;
+    resumeTicket = resumeBarrier = 0;
+    eventsRead = eventsTaken = 0;
 }
 
 EventList::~EventList()
 {
+    stopReader();
+    
+    if (pd != NULL)
+    {
+        delete pd;
+        pd = NULL;
+    }
+    
     if (el != NULL)
     {
         delete el;
         el = NULL;
     }
+    
+    // Events may still be in use after the list is done
+    arena->detach();
 }
 
 uint64_t EventList::getSpace()
 {
+    if (pd != NULL) return el->getSum() + pd->getBytes();
     return el->getSum();
 }
 
-void EventList::rescanMinTicket()
+void EventList::setChunkRange(TraceIndex* idx, size_t first, size_t end)
 {
-    for (auto it = queuedEvents.begin(), et = queuedEvents.end(); it != et; ++it)
+    if (!idx->matches(file))
+    {
+        fprintf(stderr, "Trace index does not match the trace, reading the whole trace\n");
+        return;
+    }
+    if (end > idx->chunks.size()) end = idx->chunks.size();
+    if (first > end) first = end;
+    
+    index = idx;
+    firstChunk = first;
+    endChunk = end;
+    seekPending = true;
+}
+
+//
+// Read the next event from the trace.  Only a mapped trace can be indexed or have its
+//   chunks decoded in parallel, so other traces are always decoded serially from the start.
+//
+pct_event EventList::readContechEvent()
+{
+    if (pd != NULL) return pd->getNextEvent();
+    
+    if (decodeThreads > 1 || index != NULL)
+    {
+        if (!el->isInputMapped(file))
+        {
+            if (index != NULL) fprintf(stderr, "Trace cannot be mapped, reading the whole trace\n");
+            decodeThreads = 1;
+            index = NULL;
+        }
+        else if (el->nextIsChunk())
+        {
+            if (index != NULL)
+            {
+                // The header has been read, so go to the first chunk in the range
+                if (seekPending == true)
+                {
+                    seekPending = false;
+                    if (firstChunk == endChunk) return NULL;
+                    el->seekInput(file, index->chunks[firstChunk].offset);
+                    resumeTicket = index->chunks[firstChunk].resumeTicket;
+                    resumeBarrier = index->chunks[firstChunk].resumeBarrier;
+                    resumePending = true;
+                }
+                else if (endChunk < index->chunks.size() &&
+                         el->getSum() >= index->chunks[endChunk].offset)
+                {
+                    return NULL;
+                }
+            }
+            
+            if (decodeThreads > 1)
+            {
+                pd = new ParallelDecode(el, file, decodeThreads, 
+                                        (index != NULL) ? (endChunk - firstChunk) : ~0UL);
+                return pd->getNextEvent();
+            }
+        }
+    }
+    
+    return el->createContechEvent(file, arena);
+}
+
+//
+// Read the next event and number it, on the reader thread with prefetch
+//
+pct_event EventList::readEvent()
+{
+    pct_event event = readContechEvent();
+    if (resumePending)
+    {
+        resumePending = false;
+        __atomic_store_n(&resumeEvent, eventsRead, __ATOMIC_RELEASE);
+    }
+    eventsRead++;
+    return event;
+}
+
+//
+// The next event of the trace, in the order it was read.  Once the trace has
+//   ended, it stays ended.
+//
+pct_event EventList::takeEvent()
+{
+    if (readEnd) return NULL;
+    
+    pct_event event;
+    if (prefetch)
+    {
+        if (!readerStarted)
+        {
+            ring = new pct_event[EVENT_PREFETCH_SIZE];
+            pthread_mutex_init(&ringLock, NULL);
+            pthread_cond_init(&ringCond, NULL);
+            int r = pthread_create(&reader, NULL, readerMain, this);
+            assert(r == 0);
+            readerStarted = true;
+        }
+        event = popEvent();
+    }
+    else
+    {
+        event = readEvent();
+    }
+    
+    if (eventsTaken == __atomic_load_n(&resumeEvent, __ATOMIC_ACQUIRE))
+    {
+        ticketNum = resumeTicket;
+        barrierNum = resumeBarrier;
+    }
+    eventsTaken++;
+    
+    if (event == NULL) readEnd = true;
+    return event;
+}
+
+void* EventList::readerMain(void* v)
+{
+    EventList* list = (EventList*)v;
+    
+    while (!__atomic_load_n(&list->stopping, __ATOMIC_ACQUIRE))
+    {
+        pct_event event = list->readEvent();
+        list->pushEvent(event);
+        if (event == NULL) break;
+    }
+    
+    return NULL;
+}
+
+//
+// Each side works on its own copy of its index, and publishes it once per batch
+//   and before it sleeps.  The ring is only locked to sleep when it is full or
+//   empty.  Each side publishes its index before checking whether the other side
+//   sleeps, and each side checks the other's index after saying it sleeps, so no
+//   wakeup is lost.
+//
+void EventList::pushEvent(pct_event event)
+{
+    if (addTail - cachedHead >= EVENT_PREFETCH_SIZE)
+    {
+        cachedHead = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+        if (addTail - cachedHead >= EVENT_PREFETCH_SIZE)
+        {
+            publishTail();
+            
+            pthread_mutex_lock(&ringLock);
+            __atomic_store_n(&readerWaiting, true, __ATOMIC_SEQ_CST);
+            while (addTail - (cachedHead = __atomic_load_n(&ringHead, __ATOMIC_SEQ_CST)) >= EVENT_PREFETCH_SIZE &&
+                   !__atomic_load_n(&stopping, __ATOMIC_SEQ_CST))
+            {
+                pthread_cond_wait(&ringCond, &ringLock);
+            }
+            __atomic_store_n(&readerWaiting, false, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&ringLock);
+            
+            if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+            {
+                if (event != NULL) EventLib::deleteContechEvent(event);
+                return;
+            }
+        }
+    }
+    
+    ring[addTail % EVENT_PREFETCH_SIZE] = event;
+    addTail++;
+    if (event == NULL || addTail - ringTail >= EVENT_PREFETCH_BATCH) publishTail();
+}
+
+void EventList::publishTail()
+{
+    __atomic_store_n(&ringTail, addTail, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&consumerWaiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&ringLock);
+        pthread_cond_signal(&ringCond);
+        pthread_mutex_unlock(&ringLock);
+    }
+}
+
+pct_event EventList::popEvent()
+{
+    if (takeHead == cachedTail)
     {
-        pct_event event = it->second.front();
-        if (event->event_type == ct_event_sync)
+        cachedTail = __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+        if (takeHead == cachedTail)
         {
-            printf("%u: on ticket %lu\n", event->contech_id, event->sy.ticketNum);
-            if (event->sy.ticketNum < minQueuedTicket)
+            publishHead();
+            
+            pthread_mutex_lock(&ringLock);
+            __atomic_store_n(&consumerWaiting, true, __ATOMIC_SEQ_CST);
+            while ((cachedTail = __atomic_load_n(&ringTail, __ATOMIC_SEQ_CST)) == takeHead)
             {
-                minQueuedTicket = event->sy.ticketNum;
+                pthread_cond_wait(&ringCond, &ringLock);
             }
+            __atomic_store_n(&consumerWaiting, false, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&ringLock);
         }
     }
+    
+    pct_event event = ring[takeHead % EVENT_PREFETCH_SIZE];
+    takeHead++;
+    if (takeHead - ringHead >= EVENT_PREFETCH_BATCH) publishHead();
+    
+    return event;
+}
+
+void EventList::publishHead()
+{
+    __atomic_store_n(&ringHead, takeHead, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&readerWaiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&ringLock);
+        pthread_cond_signal(&ringCond);
+        pthread_mutex_unlock(&ringLock);
+    }
+}
+
+//
+// Stop the reader, if the list is deleted before its trace ends, and free the
+//   events that were never taken
+//
+void EventList::stopReader()
+{
+    if (!readerStarted) return;
+    
+    pthread_mutex_lock(&ringLock);
+    __atomic_store_n(&stopping, true, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&ringCond);
+    pthread_mutex_unlock(&ringLock);
+    pthread_join(reader, NULL);
+    
+    for (uint64_t i = takeHead; i < addTail; i++)
+    {
+        if (ring[i % EVENT_PREFETCH_SIZE] != NULL) EventLib::deleteContechEvent(ring[i % EVENT_PREFETCH_SIZE]);
+    }
+    delete [] ring;
+    pthread_mutex_destroy(&ringLock);
+    pthread_cond_destroy(&ringCond);
+    readerStarted = false;
+}
+
+//
+// When reading part of a trace, the tickets and barriers before or after the range are
+//   never seen.  Once the range is exhausted, advance past the missing numbers to the
+//   lowest queued one.  Returns true if any queued event may now proceed.
+//
+bool EventList::skipTicketGap()
+{
+    unsigned long long minTicket = ~0ULL, minBarrier = ~0ULL;
+    
+    for (auto it = ticketQueues.begin(), et = ticketQueues.end(); it != et; ++it)
+    {
+        if (it->first < minTicket) minTicket = it->first;
+    }
+    for (auto it = barrierQueues.begin(), et = barrierQueues.end(); it != et; ++it)
+    {
+        if (it->first < minBarrier) minBarrier = it->first;
+    }
+    
+    bool skipped = false;
+    if (minTicket != ~0ULL && minTicket > ticketNum) 
+    {
+        ticketNum = minTicket - 1; 
+        nextTicket(); 
+        skipped = true;
+    }
+    if (minBarrier != ~0ULL && minBarrier > barrierNum) 
+    {
+        barrierNum = minBarrier - 1; 
+        nextBarrier(); 
+        skipped = true;
+    }
+    
+    return skipped;
 }
 
 void EventList::rescanMinTicketDeep()
@@ -152,16 +501,46 @@ void EventList::rescanMinTicketDeep()
     }
 }
 
-void EventList::barrierTicket()
+//
+// The queue of ctid has event at its head.  Syncs and barriers wait until their number
+//   is next, and any other event is ready.
+//
+void EventList::scheduleQueue(unsigned int ctid, pct_event event)
 {
-    for (auto it = queuedEvents.begin(), et = queuedEvents.end(); it != et; ++it)
+    if (event->event_type == ct_event_sync && event->sy.ticketNum != ticketNum)
     {
-        pct_event event = it->second.front();
-        if (event->event_type == ct_event_barrier)
-        {
-            printf("%u: on ticket %lu\n", event->contech_id, event->bar.barrierNum);
+        ticketQueues[event->sy.ticketNum] = ctid;
+    }
+    else if (event->event_type == ct_event_barrier && event->bar.barrierNum != barrierNum)
+    {
+        barrierQueues[event->bar.barrierNum] = ctid;
+    }
+    else
+    {
+        readyQueues.push_back(ctid);
+    }
+}
 
-        }
+// Advance the ticket number, readying any queue that waits for the new number
+void EventList::nextTicket()
+{
+    ticketNum++;
+    auto it = ticketQueues.find(ticketNum);
+    if (it != ticketQueues.end())
+    {
+        readyQueues.push_back(it->second);
+        ticketQueues.erase(it);
+    }
+}
+
+void EventList::nextBarrier()
+{
+    barrierNum++;
+    auto it = barrierQueues.find(barrierNum);
+    if (it != barrierQueues.end())
+    {
+        readyQueues.push_back(it->second);
+        barrierQueues.erase(it);
     }
 }
 
@@ -171,114 +550,44 @@ pct_event EventList::getNextContechEvent()
     pct_event event = NULL;
     
     //
-    // This loop checks if any of the queues of events can provide the next event.
-    //   Each queue is either blocked on a ticketed event, or is unblocked.
+    // Return the head of a ready queue.  A queue stays ready until it is empty or its
+    //   head must wait, so the events of one context are returned together.
     //
-    unsigned long long currMinTicket = ~0;
-    while (!queuedEvents.empty())
+    while (!readyQueues.empty())
     {
-        // Fast check whether a queued event may be removed.
-        if (ticketNum < minQueuedTicket && resetMinTicket == false) break;
-        if (eventQueueCurrent->second.empty())
+        unsigned int ctid = readyQueues.front();
+        auto qit = queuedEvents.find(ctid);
+        assert(qit != queuedEvents.end() && !qit->second.empty());
+        deque<pct_event>& q = qit->second;
+        
+        event = q.front();
+        q.pop_front();
+        assert(currentQueuedCount > 0);
+        currentQueuedCount--;
+        
+        if (event->event_type == ct_event_sync) nextTicket();
+        else if (event->event_type == ct_event_barrier) nextBarrier();
+        
+        if (q.empty())
         {
-            auto t = eventQueueCurrent;
-            ++eventQueueCurrent;
-            queuedEvents.erase(t);
-            // While this loops, the main loop guarantees that there will be at least one
-            //   queue with events.
-            if (eventQueueCurrent == queuedEvents.end())
-            {
-                eventQueueCurrent = queuedEvents.begin();
-            }
-            
-            continue;
+            queuedEvents.erase(qit);
+            readyQueues.pop_front();
+        }
+        else if ((q.front()->event_type == ct_event_sync && q.front()->sy.ticketNum != ticketNum) ||
+                 (q.front()->event_type == ct_event_barrier && q.front()->bar.barrierNum != barrierNum))
+        {
+            readyQueues.pop_front();
+            scheduleQueue(ctid, q.front());
         }
-        event = eventQueueCurrent->second.front();
-        //
-        // Currently, only syncs are blocking in the event queues, so any other type of
-        //   event is clear to be returned.  If the event is a sync, then it is only
-        //   clear when it is the next ticket number.
-        //
+        
         if (event->event_type == ct_event_rank)
         {
             mpiRank = event->rank.rank;
             EventLib::deleteContechEvent(event);
+            continue;
         }
-        else if (event->event_type == ct_event_barrier)
-        {
-            // Barriers have ordering numbers too
-            if (event->bar.barrierNum == barrierNum)
-            {
-                barrierNum++;
-                eventQueueCurrent->second.pop_front();
-                eventQueueCurrent = queuedEvents.begin();
-                assert(currentQueuedCount > 0);
-                currentQueuedCount--;
-                return event;
-            }
-            else
-            {
-                ++eventQueueCurrent;
-                if (eventQueueCurrent == queuedEvents.end())
-                {
-                    if (resetMinTicket == true)
-                    {
-                        resetMinTicket = false;
-                    }
-                    else
-                    {
-                        resetMinTicket = true;
-                    }
-                    eventQueueCurrent = queuedEvents.begin();
-                    break;
-                }
-            }
-        }
-        else if (event->event_type != ct_event_sync)
-        {
-            eventQueueCurrent->second.pop_front();
-            assert(currentQueuedCount > 0);
-            currentQueuedCount--;
-            return event;
-        }
-        else if (event->sy.ticketNum == ticketNum)
-        {
-            // This is the next ticket
-            ticketNum++;
-            eventQueueCurrent->second.pop_front();
-            eventQueueCurrent = queuedEvents.begin();
-            assert(currentQueuedCount > 0);
-            currentQueuedCount--;
-            return event;
-        }
-        else
-        {
-            // No valid events at this queue position
-            ++eventQueueCurrent;
-            
-            // Is this the lowest ticket we've seen so far
-            if (event->sy.ticketNum < currMinTicket) currMinTicket = event->sy.ticketNum;
-            
-            // End of the queue, next request should start over
-            if (eventQueueCurrent == queuedEvents.end())
-            {
-                // If true, then this was likely a single loop through each queue
-                //   to find the new minimum ticket number.
-                if (resetMinTicket == true)
-                {
-                    resetMinTicket = false;
-                    minQueuedTicket = currMinTicket;
-                }
-                else
-                {
-                    resetMinTicket = true;
-                    minQueuedTicket = 0;
-                }
-                
-                eventQueueCurrent = queuedEvents.begin();
-                break;
-            }
-        }
+        
+        return event;
     }
     
     //
@@ -288,24 +597,31 @@ pct_event EventList::getNextContechEvent()
     //
     while (!nextEvent)
     {
-        event = el->createContechEvent(file);
-        if (event == NULL) return NULL;
-        if (queuedEvents.find(event->contech_id) != queuedEvents.end())
+        event = takeEvent();
+        if (event == NULL)
         {
-            queuedEvents[event->contech_id].push_back(event);
+            if (index != NULL && skipTicketGap()) return getNextContechEvent();
+            return NULL;
+        }
+        auto qit = queuedEvents.find(event->contech_id);
+        if (qit != queuedEvents.end())
+        {
+            qit->second.push_back(event);
             currentQueuedCount++;
             if (currentQueuedCount > maxQueuedCount) maxQueuedCount = currentQueuedCount;
             continue;
         }
-        else if (waitingEvents.find(event->contech_id) != waitingEvents.end())
+        
+        auto wit = waitingEvents.find(event->contech_id);
+        if (wit != waitingEvents.end())
         {
-            if (waitingEvents[event->contech_id].front() == NULL)// if head is NULL, then clear queue
+            if (wit->second.front() == NULL)// if head is NULL, then clear queue
             {
                 ;
             }
             else
             {
-                waitingEvents[event->contech_id].push_back(event);
+                wit->second.push_back(event);
                 continue;
             }
         }
@@ -323,9 +639,7 @@ pct_event EventList::getNextContechEvent()
                 //printf("Delay :%llu %d %d\n", event->sy.ticketNum, event->contech_id, queuedEvents.size());
                 
                 queuedEvents[event->contech_id].push_back(event);
-                eventQueueCurrent = queuedEvents.begin();
-                resetMinTicket = true;
-                minQueuedTicket = 0;
+                scheduleQueue(event->contech_id, event);
                 currentQueuedCount++;
                 if (currentQueuedCount > maxQueuedCount) maxQueuedCount = currentQueuedCount;
                 // Yes, recursion
@@ -336,7 +650,7 @@ pct_event EventList::getNextContechEvent()
             }
             else {
                 //printf("Ticket:%llu %d, %u\n", event->sy.ticketNum, queuedEvents.size(), event->contech_id);
-                ticketNum ++;
+                nextTicket();
             }
             break;
         }
@@ -345,15 +659,14 @@ pct_event EventList::getNextContechEvent()
             if (event->bar.barrierNum > barrierNum)
             {
                 queuedEvents[event->contech_id].push_back(event);
-                eventQueueCurrent = queuedEvents.begin();
-                resetMinTicket = true;
+                scheduleQueue(event->contech_id, event);
                 currentQueuedCount++;
                 if (currentQueuedCount > maxQueuedCount) maxQueuedCount = currentQueuedCount;
                 event = getNextContechEvent();
             }
             else
             {
-                barrierNum++;
+                nextBarrier();
             }
         }
         break;
@@ -362,10 +675,10 @@ pct_event EventList::getNextContechEvent()
             // if approx_skew != 0, then this is the child (i.e. created context)
             if (event->tc.approx_skew != 0)
             {
-                if (waitingEvents.find(event->contech_id) != waitingEvents.end() &&
-                    waitingEvents[event->contech_id].front() == NULL)
+                auto wit = waitingEvents.find(event->contech_id);
+                if (wit != waitingEvents.end() && wit->second.front() == NULL)
                 {
-                    waitingEvents.erase(event->contech_id);
+                    waitingEvents.erase(wit);
                 }
                 else
                 {
@@ -391,6 +704,20 @@ pct_event EventList::getNextContechEvent()
     return event;
 }
 
+//
+// Events still held once the trace has ended, which wait on a ticket, barrier or
+//   create that the trace does not contain
+//
+uint64_t EventList::getStrandedEvents()
+{
+    uint64_t n = currentQueuedCount;
+    for (auto it = waitingEvents.begin(), et = waitingEvents.end(); it != et; ++it)
+    {
+        if (it->second.front() != NULL) n += it->second.size();
+    }
+    return n;
+}
+
 void EventList::readyEvents(unsigned int context)
 {
     auto deq = waitingEvents.find(context);
@@ -400,14 +727,14 @@ void EventList::readyEvents(unsigned int context)
         // This case is when the creator is before the create
         waitingEvents[context].push_back(NULL);
     }
-    else
+    else if (deq->second.front() != NULL)
     {
         currentQueuedCount += deq->second.size();
         if (currentQueuedCount > maxQueuedCount) maxQueuedCount = currentQueuedCount;
-        queuedEvents[context] = deq->second;
+        deque<pct_event>& q = queuedEvents[context];
+        q.swap(deq->second);
         waitingEvents.erase(deq);
         
-        // As the queues may go from empty to non-empty, the iterator needs to be initialized here
-        eventQueueCurrent = queuedEvents.begin();
+        scheduleQueue(context, q.front());
     }
 }
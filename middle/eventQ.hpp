@@ -3,8 +3,12 @@
 
 #include "../common/taskLib/Task.hpp"
 #include "../common/eventLib/ct_event.h"
+#include "../common/eventLib/ct_decode.h"
+#include "../common/eventLib/ct_index.h"
 #include <map>
 #include <deque>
+#include <unordered_map>
+#include <pthread.h>
 
 namespace contech {
 
@@ -12,27 +16,76 @@ namespace contech {
     {
         private:
         EventLib* el;
+        EventArena* arena;
+        
+        // Once the trace reaches its buffer chunks, they are decoded by pd
+        ParallelDecode* pd;
+        unsigned int decodeThreads;
+        
+        // With an index, only the chunks [firstChunk, endChunk) are read
+        TraceIndex* index;
+        size_t firstChunk, endChunk;
+        bool seekPending;
         
         unsigned long int currentQueuedCount ;
         unsigned long int maxQueuedCount ;
         unsigned long long ticketNum ;
         unsigned long long barrierNum;
-        unsigned long long minQueuedTicket ;
-        bool resetMinTicket;
         
-        map <unsigned int, deque <pct_event> > queuedEvents;
-        map <unsigned int, deque <pct_event> > waitingEvents;
-        map <unsigned int, deque <pct_event> >::iterator eventQueueCurrent;
+        // Queued events are held in slots of the arena.  A context has a queue while
+        //   any of its events are queued, and the queue is either ready, or parked on
+        //   the ticket or barrier number of its first event.
+        unordered_map <unsigned int, deque <pct_event> > queuedEvents;
+        unordered_map <unsigned int, deque <pct_event> > waitingEvents;
+        deque <unsigned int> readyQueues;
+        unordered_map <unsigned long long, unsigned int> ticketQueues;
+        unordered_map <unsigned long long, unsigned int> barrierQueues;
+        
+        // With prefetch, a reader thread decodes the trace ahead into the ring, which
+        //   only the reader fills and only getNextContechEvent empties
+        bool prefetch;
+        bool readerStarted;
+        bool readEnd;
+        pthread_t reader;
+        pct_event* ring;
+        uint64_t ringHead, ringTail;    // Events taken from and added to the ring, as published
+        uint64_t takeHead, cachedTail;  // Main loop's own
+        uint64_t addTail, cachedHead;   // Reader's own
+        bool readerWaiting, consumerWaiting, stopping;
+        pthread_mutex_t ringLock;
+        pthread_cond_t ringCond;
+        
+        // The index resumes the ticket and barrier numbers at its first chunk, which
+        //   apply from the event with this number.  With prefetch, resumeEvent is
+        //   stored by the reader after the numbers, and loaded by the main loop.
+        bool resumePending;
+        uint64_t resumeEvent;
+        unsigned long long resumeTicket, resumeBarrier;
+        uint64_t eventsRead, eventsTaken;
         
-        void rescanMinTicket();
         void rescanMinTicketDeep();
-        void barrierTicket();
+        void scheduleQueue(unsigned int, pct_event);
+        void nextTicket();
+        void nextBarrier();
+        pct_event readContechEvent();
+        pct_event readEvent();
+        pct_event takeEvent();
+        void pushEvent(pct_event);
+        pct_event popEvent();
+        void publishTail();
+        void publishHead();
+        void stopReader();
+        static void* readerMain(void*);
+        bool skipTicketGap();
         
         public:
-        EventList(FILE*);
+        EventList(FILE*, unsigned int, bool, bool);
+        void setChunkRange(TraceIndex*, size_t, size_t);
+        void setSkipMemOps(bool s) {el->setSkipMemOps(s);}
         ~EventList();
         pct_event getNextContechEvent();
         void readyEvents(unsigned int);
+        uint64_t getStrandedEvents();
         int mpiRank;
         uint64_t getSpace();
         FILE* file;
@@ -45,6 +98,11 @@ namespace contech {
             deque <EventList*> traces;
             deque <EventList*>::iterator currentTrace;
             uint64_t totalSpace;
+            uint64_t strandedEvents;
+            unsigned int decodeThreads;
+            bool skipMemOps;
+            bool sharedEvents;
+            bool prefetch;
             
             //pct_event getNextContechEvent(EventList*);
     
@@ -54,7 +112,13 @@ namespace contech {
             pct_event getNextContechEvent(int*);
             void readyEvents(int, unsigned int);
             void registerEventList(FILE*);
+            void registerEventList(FILE*, TraceIndex*, size_t, size_t);
+            void setDecodeThreads(unsigned int);
+            void setSkipMemOps(bool);
+            void setSharedEvents(bool);
+            void setPrefetch(bool);
             void printSpaceTime(ct_tsc_t);
+            uint64_t getStrandedEvents() {return strandedEvents;}
     };
 
 }
@@ -1,7 +1,10 @@
 #include "middle.hpp"
 #include "taskWrite.hpp"
+#include "Checkpoint.hpp"
 #include <sys/timeb.h>
+#include <sys/stat.h>
 #include <pthread.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace contech;
@@ -23,47 +26,170 @@ reset_middle:
     if (argc < 3)
     {
         fprintf(stderr, "Missing positional argument(s)\n");
-        fprintf(stderr, "%s <event trace>* <taskgraph> [-d]\n", argv[0]);
+        fprintf(stderr, "%s <event trace>* <taskgraph> [-d] [-r] [-a] [-c] [-j<threads>] [-p<threads>] [-w<threads>] [-m<MB>] [-k<Mevents>] [-K]\n", argv[0]);
         return 1;
     }
     
-    // Print debug statements?
+    // Options follow the taskgraph argument
+    //   -d Print debug statements
+    //   -r Record contiguous runs of memory ops as range actions
+    //   -a Coalesce runs of atomics by one contech on one address into a single sync task
+    //   -c Build the graph from the control events only, without memory ops
+    //   -j<threads> Decode the buffer chunks of each trace with this many threads
+    //   -p<threads> Record the actions of tasks with this many threads
+    //   -w<threads> Compress the tasks being written with this many threads
+    //   -m<MB> Spill the actions of waiting tasks once the contexts hold more than this,
+    //          and the edges of the taskgraph index once they take more than this.  Each
+    //          is held to it on its own, so together they may use twice this.
+    //   -k<Mevents> Checkpoint to <taskgraph>.ckpt every this many million events
+    //   -K Resume from <taskgraph>.ckpt, with the same traces and -r, -a and -c
     bool DEBUG = false;
-    if (!strcmp(argv[argc - 1], "-d"))
-    {        
-        DEBUG = true;
-        printf("Debug mode enabled.\n");
+    bool recordRanges = false;
+    bool coalesceAtomics = false;
+    bool controlOnly = false;
+    unsigned int blockThreads = 0;
+    uint64_t spillBudget = 0;
+    uint64 checkpointEvents = 0;
+    bool resume = false;
+    int outArgPos = argc - 1;
+    while (outArgPos > 2 && argv[outArgPos][0] == '-')
+    {
+        if (!strcmp(argv[outArgPos], "-d"))
+        {
+            DEBUG = true;
+            printf("Debug mode enabled.\n");
+        }
+        else if (!strcmp(argv[outArgPos], "-r"))
+        {
+            recordRanges = true;
+        }
+        else if (!strcmp(argv[outArgPos], "-a"))
+        {
+            coalesceAtomics = true;
+        }
+        else if (!strcmp(argv[outArgPos], "-c"))
+        {
+            controlOnly = true;
+            eventQ.setSkipMemOps(true);
+        }
+        else if (!strncmp(argv[outArgPos], "-j", 2) && atoi(argv[outArgPos] + 2) > 0)
+        {
+            eventQ.setDecodeThreads(atoi(argv[outArgPos] + 2));
+        }
+        else if (!strncmp(argv[outArgPos], "-p", 2) && atoi(argv[outArgPos] + 2) > 0)
+        {
+            blockThreads = atoi(argv[outArgPos] + 2);
+            eventQ.setSharedEvents(true);
+        }
+        else if (!strncmp(argv[outArgPos], "-w", 2) && atoi(argv[outArgPos] + 2) > 0)
+        {
+            taskWriteThreads = atoi(argv[outArgPos] + 2);
+        }
+        else if (!strncmp(argv[outArgPos], "-m", 2) && atoi(argv[outArgPos] + 2) > 0)
+        {
+            spillBudget = strtoull(argv[outArgPos] + 2, NULL, 10) << 20;
+            taskIndexBudget = spillBudget;
+        }
+        else if (!strncmp(argv[outArgPos], "-k", 2) && atoi(argv[outArgPos] + 2) > 0)
+        {
+            checkpointEvents = strtoull(argv[outArgPos] + 2, NULL, 10) * 1000000;
+        }
+        else if (!strcmp(argv[outArgPos], "-K"))
+        {
+            resume = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[outArgPos]);
+            return 1;
+        }
+        outArgPos--;
     }
     
-    int lastInPos = argc - 2;
+    int lastInPos = outArgPos - 1;
     int totalRanks = 0;
-    if (DEBUG == true) lastInPos--;
     
+    // With a trace per rank, each is decoded ahead on its own thread, rather than
+    //   the main loop stopping to read each rank in turn.  On one processor, the
+    //   threads would only take turns with the main loop.
+    if (lastInPos > 1 && sysconf(_SC_NPROCESSORS_ONLN) > 1) eventQ.setPrefetch(true);
+    
+    // The sizes of the traces identify them to a checkpoint
+    vector<uint64> traceSizes;
     for (int argPos = 1; argPos <= lastInPos; argPos++, totalRanks++)
     {
         FILE* in;
         in = fopen(argv[argPos], "rb");
         assert(in != NULL && "Could not open input file");
+        struct stat st;
+        fstat(fileno(in), &st);
+        traceSizes.push_back(st.st_size);
         eventQ.registerEventList(in);
     }
     
+    // Count the number of events processed
+    uint64 eventCount = 0;
+    
+    // A resumed run first reads the header of its checkpoint, which must be for these
+    //   traces and options, and then the state of the writer and of the main loop
+    Checkpoint checkpoint(argv[outArgPos]);
+    uint64 resumedEvents = 0;
+    uint8_t checkpointFlags = (recordRanges ? 1 : 0) | (coalesceAtomics ? 2 : 0) | (controlOnly ? 4 : 0);
+    if (resume)
+    {
+        if (checkpoint.beginLoad() == NULL)
+        {
+            fprintf(stderr, "ERROR: No checkpoint to resume %s from\n", argv[outArgPos]);
+            return 1;
+        }
+        
+        int version;
+        uint8_t flags;
+        uint64 traceCount;
+        checkpoint.read(version);
+        checkpoint.read(flags);
+        checkpoint.read(traceCount);
+        bool matches = (version == CHECKPOINT_VERSION && flags == checkpointFlags && traceCount == traceSizes.size());
+        for (uint64 i = 0; i < traceCount && matches; i++)
+        {
+            uint64 size;
+            checkpoint.read(size);
+            matches = (size == traceSizes[i]);
+        }
+        if (!matches)
+        {
+            fprintf(stderr, "ERROR: Checkpoint of %s is for other traces or options\n", argv[outArgPos]);
+            return 1;
+        }
+        checkpoint.read(eventCount);
+        checkpoint.read(roiEvent);
+        checkpoint.read(totalCycles);
+        resumedEvents = eventCount;
+        printf("Resuming after %lu events\n", eventCount);
+    }
+    
     // Open output file
     // Use command line argument or stdout
     //FILE* out;
     FILE* out;
-    int outArgPos = argc - 1;
-    if (DEBUG == true) outArgPos--;
-    out = fopen(argv[outArgPos], "wb");
+    out = fopen(argv[outArgPos], (resume) ? "r+b" : "wb");
     assert(out != NULL && "Could not open output file");
     
     int taskGraphVersion = TASK_GRAPH_VERSION;
     unsigned long long space = 0;
     
     // Init TaskGraphFile
-    ct_write(&taskGraphVersion, sizeof(int), out);
-    ct_write(&space, sizeof(unsigned long long), out); // Index
-    ct_write(&space, sizeof(unsigned long long), out); // ROI start
-    ct_write(&space, sizeof(unsigned long long), out); // ROI end
+    if (resume)
+    {
+        resumeTaskWriter(checkpoint, out);
+    }
+    else
+    {
+        ct_write(&taskGraphVersion, sizeof(int), out);
+        ct_write(&space, sizeof(unsigned long long), out); // Index
+        ct_write(&space, sizeof(unsigned long long), out); // ROI start
+        ct_write(&space, sizeof(unsigned long long), out); // ROI end
+    }
     
     pthread_mutex_init(&taskQueueLock, NULL);
     pthread_cond_init(&taskQueueCond, NULL);
@@ -71,36 +197,47 @@ reset_middle:
     int r = pthread_create(&backgroundT, NULL, backgroundTaskWriter, &out);
     assert(r == 0);
     
+    // Actions are recorded into chunks that are reused once their task is written
+    ActionPool actionPool;
+    Task::setActionPool(&actionPool);
+    
+    // The main loop resolves the edges between tasks, while the blocks and memory
+    //   ops of each task are recorded by the worker of its context
+    BlockPipeline blocks(blockThreads, recordRanges);
+    if (blocks.isParallel()) blockPipeline = &blocks;
+    
+    if (spillBudget != 0) taskSpill = new TaskSpill(spillBudget);
+    
     // Track the owners of sync primitives
     map<ct_addr_t, Task*> ownerList;
     
     // Track the barrier task for each address
-    map<ct_addr_t, BarrierWrapper> barrierList;
+    unordered_map<ct_addr_t, BarrierWrapper> barrierList;
 
     // Declare each context
-    map<ContextId, Context> context;
+    ContextTable context;
 
     // MPI Transfers src-rank -> dst rank -> tag -> task
     map <int, map <int, map <int, Task*> > > mpiSendQ;
     map <int, map <int, map <int, Task*> > > mpiRecvQ;
     map <int, map <ct_addr_t, mpi_recv_req> > mpiReq;
     
+    if (resume)
+    {
+        checkpoint.loadState(context, ownerList, barrierList, mpiSendQ, mpiRecvQ, mpiReq);
+        checkpoint.endLoad();
+    }
     // Context 0 is special, since it is uncreated
-    if (totalRanks > 1)
+    else if (totalRanks > 1)
     {
-        //context[0].tasks.push_front(new Task(0, task_type_create));
-        context[0].tasks[0] = new Task(0, task_type_create);
+        context[0].addTask(new Task(0, task_type_create));
+        context[0].hasStarted = true;
     }
     else
     {
-        //context[0].tasks.push_front(new Task(0, task_type_basic_blocks));
-        context[0].tasks[0] = new Task(0, task_type_basic_blocks);
+        context[0].addTask(new Task(0, task_type_basic_blocks));
+        context[0].hasStarted = true;
     }
-    context[0].hasStarted = true;
-    
-
-    // Count the number of events processed
-    uint64 eventCount = 0;
 
     {
         struct timeb tp;
@@ -150,15 +287,66 @@ reset_middle:
         EventLib::deleteContechEvent(event);
         if (seenFirstEvent) break;
     }
-    assert(seenFirstEvent);
     
-    tgi->writeTaskGraphInfo(out);
+    // A trace filtered by traceSplit (-c, -s, -w or -r) may lack the first create
+    if (!seenFirstEvent)
+    {
+        fprintf(stderr, "ERROR: The trace does not contain the creation of context 0\n");
+        return 1;
+    }
+    
+    if (!resume) tgi->writeTaskGraphInfo(out);
     delete tgi;
+    
+    // The events before the checkpoint are taken again, with the creates that
+    //   released the events of other contexts, so the rest arrive in the same order
+    for (uint64 i = 0; i < resumedEvents; i++)
+    {
+        ct_event* event = eventQ.getNextContechEvent(&currentRank);
+        assert(event != NULL);
+        if (event->event_type == ct_event_task_create &&
+            event->tc.approx_skew == 0 &&
+            event->tc.other_id != 0)
+        {
+            eventQ.readyEvents(currentRank, event->tc.other_id);
+        }
+        EventLib::deleteContechEvent(event);
+    }
 
     // Main loop: Process the events from the file in order
     while (ct_event* event = eventQ.getNextContechEvent(&currentRank))
     {
+        // Checkpoint before this event, once the tasks queued so far are written
+        if (checkpointEvents != 0 && eventCount != 0 &&
+            (eventCount % checkpointEvents) == 0 && eventCount != resumedEvents)
+        {
+            blocks.drain();
+            checkpoint.beginSave();
+            uint64 traceCount = traceSizes.size();
+            checkpoint.write(CHECKPOINT_VERSION);
+            checkpoint.write(checkpointFlags);
+            checkpoint.write(traceCount);
+            for (uint64 size : traceSizes) checkpoint.write(size);
+            checkpoint.write(eventCount);
+            checkpoint.write(roiEvent);
+            checkpoint.write(totalCycles);
+            checkpointTaskWriter(checkpoint);
+            checkpoint.saveState(context, ownerList, barrierList, mpiSendQ, mpiRecvQ, mpiReq);
+            checkpoint.commitSave();
+            if (DEBUG) printf("Checkpoint after %lu events\n", eventCount);
+            
+            // Saving restored any spilled actions
+            if (taskSpill != NULL) taskSpill->check(context);
+        }
+        
         ++eventCount;
+        
+        // The spill needs the actions of the waiting tasks to be complete
+        if (taskSpill != NULL && (eventCount % SPILL_CHECK_EVENTS) == 0)
+        {
+            blocks.drain();
+            taskSpill->check(context);
+        }
 
         // Whitelist of event types that we handle. Others are informational/debug info and can be skipped
         // Be sure to add event types to this list if you handle new ones
@@ -274,44 +462,68 @@ reset_middle:
                 
                 activeT = activeContech.activeTask();
             }
-            else if (activeT->getBBCount() >= MAX_BLOCK_THRESHOLD)
+            
+            if (activeContech.countedTask != activeT->getTaskId())
+            {
+                activeContech.countedTask = activeT->getTaskId();
+                activeContech.countedBlocks = 0;
+            }
+            
+            if (activeContech.countedBlocks >= MAX_BLOCK_THRESHOLD)
             {
                 // There is no available time stamp for ending this task
                 //   Assume that every basic block costs 1 cycle, which is a
                 //   lower bound
                 activeT->setEndTime(activeT->getStartTime() + MAX_BLOCK_THRESHOLD);
                 activeContech.createBasicBlockContinuation();
-                activeContech.removeTask(activeT);
-                backgroundQueueTask(activeT);
+                if (!activeContech.holdsAtomicRun(activeT))
+                {
+                    activeContech.removeTask(activeT);
+                    backgroundQueueTask(activeT);
+                }
                 updateContextTaskList(activeContech);
                 
                 activeT = activeContech.activeTask();
+                activeContech.countedTask = activeT->getTaskId();
+                activeContech.countedBlocks = 0;
+            }
+            activeContech.countedBlocks++;
+            
+            if (blocks.isParallel())
+            {
+                // The worker records the block and its memory ops, and then frees the event.
+                //   It cannot split the task if they cannot be allocated, see BlockPipeline.
+                blocks.recordBlock(activeT, event);
+                event = NULL;
+                continue;
             }
             
             // If the basic block action will overflow, then split the task at this time
             try {
-                // Record that this task executed this basic block
+                // Record that this task executed this basic block, keeping the block
+                //   and its memory ops, of which there are at most len, in one chunk
+                activeT->reserveActions(1 + event->bb.len);
                 activeT->recordBasicBlockAction(event->bb.basic_block_id);
             }
             catch (std::bad_alloc)
             {
                 activeT->setEndTime(activeT->getStartTime() + MAX_BLOCK_THRESHOLD);
                 activeContech.createBasicBlockContinuation();
-                activeContech.removeTask(activeT);
-                backgroundQueueTask(activeT);
+                if (!activeContech.holdsAtomicRun(activeT))
+                {
+                    activeContech.removeTask(activeT);
+                    backgroundQueueTask(activeT);
+                }
                 updateContextTaskList(activeContech);
                 
                 activeT = activeContech.activeTask();
+                activeContech.countedTask = activeT->getTaskId();
+                activeContech.countedBlocks = 1;
                 activeT->recordBasicBlockAction(event->bb.basic_block_id);
             }
 
             // Examine memory operations
-            for (uint i = 0; i < event->bb.len; i++)
-            {
-                ct_memory_op memOp = event->bb.mem_op_array[i];
-                memOp.rank = currentRank;
-                activeT->recordMemOpAction(memOp.is_write, memOp.pow_size, memOp.data);
-            }
+            BlockPipeline::recordMemOps(activeT, event, recordRanges);
         }
 
         // Task create: Create and initialize child task/context
@@ -331,8 +543,7 @@ reset_middle:
                     Task* taskCreate;
                     
                     context[(currentRank << 24) | 0].hasStarted = true;
-                    //context[(currentRank << 24) | 0].tasks.push_front(new Task(childTaskId, task_type_basic_blocks));
-                    context[(currentRank << 24) | 0].tasks[childTaskId] = new Task(childTaskId, task_type_basic_blocks);
+                    context[(currentRank << 24) | 0].addTask(new Task(childTaskId, task_type_basic_blocks));
                     context[(currentRank << 24) | 0].timeOffset = event->tc.start_time;
                     taskCreate = context[0].activeTask();
                     assert(taskCreate->getType() == task_type_create);
@@ -387,8 +598,7 @@ reset_middle:
 
                 // Start the first task for the new context
                 activeContech.hasStarted = true;
-                //activeContech.tasks.push_front(new Task(newContechTaskId, task_type_basic_blocks));
-                activeContech.tasks[newContechTaskId] = new Task(newContechTaskId, task_type_basic_blocks);
+                activeContech.addTask(new Task(newContechTaskId, task_type_basic_blocks));
                 activeContech.activeTask()->setStartTime(endTime);
 
                 // Record parent of this task
@@ -410,55 +620,98 @@ reset_middle:
         // Sync events
         else if (event->event_type == ct_event_sync)
         {
-            // Create a sync task
-            Task* activeT = activeContech.activeTask();
-            Task* sync = activeContech.createContinuation(task_type_sync, startTime, endTime);
-            attemptBackgroundQueueTask(activeT, activeContech);
             ct_memory_op syncA;
             syncA.data = 0;
             syncA.addr = event->sy.sync_addr;
             syncA.rank = currentRank;
             
-            // Record the address in this sync task as an action
-            activeContech.activeTask()->recordMemOpAction(true, 8, syncA.data);
-
-            // Create a continuation
-            activeContech.createBasicBlockContinuation();
-            
-            // Make the sync dependent on whomever accessed the sync primitive last         
-            auto it = ownerList.find(syncA.data);
-            if (it != ownerList.end() &&
-                event->sy.sync_type != ct_cond_wait&&
-                parallelMiddle)
+            // If this contech's previous sync was an atomic that still owns this address,
+            //   then no other contech has synchronized on it since.  The atomic is kept as
+            //   a tagged write in the current task rather than a new sync task, and that
+            //   task becomes the owner, so the next syncer is ordered after the atomic.
+            auto atomicOwner = ownerList.find(syncA.data);
+            if (coalesceAtomics &&
+                event->sy.sync_type == ct_sync_atomic &&
+                activeContech.atomicRunValid &&
+                atomicOwner != ownerList.end() &&
+                atomicOwner->second->getTaskId() == activeContech.atomicRunTask)
             {
-                Task* owner = it->second;
-                ContextId cid = owner->getContextId();
-                owner->addSuccessor(sync->getTaskId());
-                sync->addPredecessor(owner->getTaskId());
-                
-                // Owner can now be background queued
-                //  N.B. owner cannot be the active context
-                bool wasRem = context[cid].removeTask(owner);
-                assert(wasRem == true);
-                backgroundQueueTask(owner);
+                Task* activeT = activeContech.activeTask();
+                Task* owner = atomicOwner->second;
+                blocks.recordAtomic(activeT, syncA.data);
                 
-                updateContextTaskList(context[cid]);
+                if (owner != activeT)
+                {
+                    // The previous owner precedes the active task in this contech
+                    if (parallelMiddle)
+                    {
+                        bool wasRem = activeContech.removeTask(owner);
+                        assert(wasRem == true);
+                        backgroundQueueTask(owner);
+                    }
+                    atomicOwner->second = activeT;
+                    activeContech.atomicRunTask = activeT->getTaskId();
+                }
             }
-
-            // Make the sync task the new owner of the sync primitive
-            if (event->sy.sync_type != ct_cond_wait) 
+            else
             {
-                ownerList[syncA.data] = sync;
-            }
+                // Create a sync task
+                Task* activeT = activeContech.activeTask();
+                Task* sync = activeContech.createContinuation(task_type_sync, startTime, endTime);
+                attemptBackgroundQueueTask(activeT, activeContech);
+            
+                // Record the address in this sync task as an action
+                activeContech.activeTask()->recordMemOpAction(true, 8, syncA.data);
+
+                // Create a continuation
+                activeContech.createBasicBlockContinuation();
+            
+                // Make the sync dependent on whomever accessed the sync primitive last         
+                auto it = ownerList.find(syncA.data);
+                if (it != ownerList.end() &&
+                    event->sy.sync_type != ct_cond_wait&&
+                    parallelMiddle)
+                {
+                    Task* owner = it->second;
+                    ContextId cid = owner->getContextId();
+                    owner->addSuccessor(sync->getTaskId());
+                    sync->addPredecessor(owner->getTaskId());
                 
-            if (event->sy.sync_type == ct_sync_release ||
-                event->sy.sync_type == ct_sync_acquire)
-                sync->setSyncType(sync_type_lock);
-            else if (event->sy.sync_type == ct_cond_wait ||
-                event->sy.sync_type == ct_cond_sig)
-                sync->setSyncType(sync_type_condition_variable);
-            else
-                sync->setSyncType(sync_type_user_defined);
+                    // A task of coalesced atomics may still be active in its contech,
+                    //   which queues it once it ends, as it no longer owns the address
+                    if (owner == context[cid].activeTask())
+                    {
+                        context[cid].atomicRunValid = false;
+                    }
+                    else
+                    {
+                        // Owner can now be background queued
+                        bool wasRem = context[cid].removeTask(owner);
+                        assert(wasRem == true);
+                        backgroundQueueTask(owner);
+                    
+                        updateContextTaskList(context[cid]);
+                    }
+                }
+
+                // Make the sync task the new owner of the sync primitive
+                if (event->sy.sync_type != ct_cond_wait) 
+                {
+                    ownerList[syncA.data] = sync;
+                }
+                
+                if (event->sy.sync_type == ct_sync_release ||
+                    event->sy.sync_type == ct_sync_acquire)
+                    sync->setSyncType(sync_type_lock);
+                else if (event->sy.sync_type == ct_cond_wait ||
+                    event->sy.sync_type == ct_cond_sig)
+                    sync->setSyncType(sync_type_condition_variable);
+                else
+                    sync->setSyncType(sync_type_user_defined);
+            
+                activeContech.atomicRunValid = (event->sy.sync_type == ct_sync_atomic);
+                activeContech.atomicRunTask = sync->getTaskId();
+            }
         }
 
         // Task joins
@@ -579,6 +832,7 @@ reset_middle:
                     attemptBackgroundQueueTask(activeT, activeContech);
                 }
                 Task* barrierTask = barrierList[barA.data].onEnter(*activeContech.activeTask(), startTime, event->bar.sync_addr);
+                activeContech.inBarrier = true;
                 if (DEBUG) eventDebugPrint(activeContech.activeTask()->getTaskId(), "arrived at barrier", barrierTask->getTaskId(), startTime, endTime);
             }
 
@@ -592,6 +846,7 @@ reset_middle:
                 barA.addr = event->bar.sync_addr;
                 barA.rank = currentRank;
                 Task* barrierTask = barrierList[barA.data].onExit(activeContech.activeTask(), endTime, &isFinished);
+                activeContech.inBarrier = false;
                 if (DEBUG) 
                 {
                     eventDebugPrint(activeContech.activeTask()->getTaskId(), "leaving barrier", barrierTask->getTaskId(), startTime, endTime);
@@ -614,11 +869,9 @@ reset_middle:
                     activeContech.activeTask()->addSuccessor(continuation->getTaskId());
                     continuation->addPredecessor(activeContech.activeTask()->getTaskId());
                     // Barrier owner is responsible for making sure the barrier task gets added to the output file
-                    //activeContech.tasks.push_front(barrierTask);
-                    activeContech.tasks[barrierTask->getTaskId()] = barrierTask;
+                    activeContech.addTask(barrierTask);
                     // Make it the active task for this context
-                    //activeContech.tasks.push_front(continuation);
-                    activeContech.tasks[continuation->getTaskId()] = continuation;
+                    activeContech.addTask(continuation);
                     attemptBackgroundQueueTask(activeT, activeContech);
                 }
                 else
@@ -656,16 +909,16 @@ reset_middle:
             memA.rank = currentRank;
             if (event->mem.isAllocate)
             {
-                activeContech.activeTask()->recordMallocAction(memA.data, event->mem.size);
+                blocks.recordMalloc(activeContech.activeTask(), memA.data, event->mem.size);
             } else {
-                activeContech.activeTask()->recordFreeAction(memA.data);
+                blocks.recordFree(activeContech.activeTask(), memA.data);
             }
 
         } 
         
         // Memcpy etc
         //  In the case of etc, src may be NULL
-        else if (event->event_type == ct_event_bulk_memory_op)
+        else if (event->event_type == ct_event_bulk_memory_op && controlOnly == false)
         {
             ct_memory_op srcA, dstA;
             srcA.data = 0;
@@ -674,7 +927,7 @@ reset_middle:
             dstA.data = 0;
             dstA.addr = event->bm.dst_addr;
             dstA.rank = currentRank;
-            activeContech.activeTask()->recordMemCpyAction(event->bm.size, dstA.data, srcA.data);
+            blocks.recordMemCpy(activeContech.activeTask(), event->bm.size, dstA.data, srcA.data);
         }
         
         else if (event->event_type == ct_event_mpi_transfer)
@@ -812,7 +1065,7 @@ reset_middle:
                     dstA.data = 0;
                     dstA.addr = event->bm.dst_addr;
                     dstA.rank = currentRank;
-                    activeContech.activeTask()->recordMemCpyAction(event->bm.size, dstA.data, srcA.data);
+                    blocks.recordMemCpy(activeContech.activeTask(), event->bm.size, dstA.data, srcA.data);
                 }
             }
         }
@@ -896,20 +1149,46 @@ reset_middle:
     
     if (DEBUG) printf("Processed %lu events.\n", eventCount);
     
+    // A thread still running at exit never queues its buffers, so a runtime trace can
+    //   hold events that wait on it or name a context that never ran; report and go on
+    if (eventQ.getStrandedEvents() != 0)
+    {
+        fprintf(stderr, "WARNING: %lu events wait on tickets, barriers or creates that are not in the trace\n",
+                eventQ.getStrandedEvents());
+    }
+    
     char* d = NULL;
     
-    for (auto& p : context)
+    vector<ContextId> contextIds = context.getIds();
+    for (ContextId cid : contextIds)
+    {
+        if (context[cid].hasStarted == false)
+        {
+            fprintf(stderr, "WARNING: Context %u is created but none of its events are in the trace\n", 
+                    (unsigned int)cid);
+        }
+    }
+    for (ContextId cid : contextIds)
     {
-        Context& c = p.second;
+        Context& c = context[cid];
         
-        //printf("%d\t%llx\t%llx\t%llx\n", p.first, c.timeOffset, c.startTime, c.endTime);
+        //printf("%d\t%llx\t%llx\t%llx\n", (uint32_t)cid, c.timeOffset, c.startTime, c.endTime);
         
-        for (auto t : c.tasks)
+        for (Task* t : c.tasks)
         {
-            backgroundQueueTask(t.second);
+            backgroundQueueTask(t);
         }
     }
+    
+    // Every action must be recorded before the writer sees the last task
+    blocks.finish();
+    blockPipeline = NULL;
     eventQ.printSpaceTime(totalCycles);
+    if (taskSpill != NULL)
+    {
+        printf("Spilled %lu tasks, %lu bytes, in a file of %lu bytes\n", taskSpill->getSpilledTasks(),
+               taskSpill->getSpilledBytes(), taskSpill->getFileBytes());
+    }
     
     pthread_mutex_lock(&taskQueueLock);
     noMoreTasks = true;
@@ -929,6 +1208,8 @@ reset_middle:
     }
     
     fclose(out);
+    delete taskSpill;
+    if (checkpointEvents != 0 || resume) checkpoint.remove();
     
     return 0;
 }
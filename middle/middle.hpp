@@ -22,6 +22,9 @@
 
 #define MAX_BLOCK_THRESHOLD 10000000
 
+// Events between checks of the spill budget
+#define SPILL_CHECK_EVENTS (1 << 20)
+
 using namespace contech;
 
 void checkContextId(ContextId id);
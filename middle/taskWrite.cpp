@@ -1,8 +1,10 @@
 #include "taskWrite.hpp"
 #include "middle.hpp"
+#include "TaskIndexGraph.hpp"
 #include "../common/taskLib/TaskGraph.hpp"
 #include <sys/timeb.h>
 #include <sys/sysinfo.h>
+#include <unistd.h>
 #include <map>
 
 using namespace std;
@@ -12,10 +14,22 @@ bool noMoreTasks = false;
 pthread_mutex_t taskQueueLock;
 pthread_cond_t taskQueueCond;
 deque<Task*>* taskQueue;
+BlockPipeline* blockPipeline = NULL;
+TaskSpill* taskSpill = NULL;
+uint64_t taskIndexBudget = 0;
 
 TaskId roiStart = 0;
 TaskId roiEnd = 0;
 
+// Set by checkpointTaskWriter, and cleared by the writer once its state is saved
+static Checkpoint* checkpointOut = NULL;
+static pthread_cond_t checkpointCond = PTHREAD_COND_INITIALIZER;
+
+// Writer state from a checkpoint, taken up when the writer starts
+static TaskIndexGraph* resumedGraph = NULL;
+static uint64 resumedTaskCount = 0;
+static uint64 resumedTaskWriteCount = 0;
+
 void setROIStart(TaskId t)
 {
     roiStart = t;
@@ -35,6 +49,17 @@ void setROIEnd(TaskId t)
 //
 #define QUEUE_SIGNAL_THRESHOLD 16
 void backgroundQueueTask(Task* t)
+{
+    // With block workers, the task waits for its worker to record its last actions
+    if (blockPipeline != NULL)
+    {
+        blockPipeline->queueTask(t);
+        return;
+    }
+    backgroundQueueTaskNow(t);
+}
+
+void backgroundQueueTaskNow(Task* t)
 {
     unsigned int qSize = 0;
     assert(t->getEndTime() >= t->getStartTime());
@@ -47,7 +72,7 @@ void backgroundQueueTask(Task* t)
     if (qSize == QUEUE_SIGNAL_THRESHOLD || t->getBBCount() > (MAX_BLOCK_THRESHOLD - 1)) {pthread_cond_signal(&taskQueueCond);}
     pthread_mutex_unlock(&taskQueueLock);
 
-    totalCycles += tcyc;
+    __sync_fetch_and_add(&totalCycles, tcyc);
 }
 
 //
@@ -57,15 +82,13 @@ void backgroundQueueTask(Task* t)
 //   the tasks currently queued at a context.  And to display the details of the
 //   oldest task.
 //
-void displayContextTasks(map<ContextId, Context> &context, int id)
+void displayContextTasks(ContextTable &context, int id)
 {
     Context tgt = context[id];
     Task* last = NULL;
     
-    //for (Task* t : tgt.tasks)
-    for (auto it : tgt.tasks)
+    for (Task* t : tgt.tasks)
     {
-        Task* t = it.second;
         if (last == NULL)
         {
             last = t;
@@ -101,19 +124,18 @@ void displayContextTasks(map<ContextId, Context> &context, int id)
 //
 // Debug routine
 //
-void identifyMaxTaskPerContext(map<ContextId, Context> &context)
+void identifyMaxTaskPerContext(ContextTable &context)
 {
-    for (auto it = context.begin(), et = context.end(); it != et; ++it)
+    vector<ContextId> contextIds = context.getIds();
+    for (auto it = contextIds.begin(), et = contextIds.end(); it != et; ++it)
     {
-        Context tgt = it->second;
+        Context& tgt = context[*it];
         int countSyn = 0, countBB = 0, countC = 0, countJ = 0, countBar = 0;
         uint64_t maxBBCount = 0;
         Task* maxBBTask = NULL;
         
-        //for (Task* t : tgt.tasks)
-        for (auto it : tgt.tasks)
+        for (Task* t : tgt.tasks)
         {
-            Task* t = it.second;
             switch(t->getType())
             {
                 case task_type_basic_blocks:
@@ -150,13 +172,15 @@ void identifyMaxTaskPerContext(map<ContextId, Context> &context)
             }
         }
         cout << maxBBTask->getTaskId().toString() << " - " << maxBBCount << endl;
-        cout << it->first << " C: " << countC << " J: " << countJ << " S: " << countSyn;
+        cout << *it << " C: " << countC << " J: " << countJ << " S: " << countSyn;
         cout << " B: " << countBar << " BB: " << countBB << endl;
     }
 }
 
 void attemptBackgroundQueueTask(Task* t, Context &c)
 {
+    if (c.holdsAtomicRun(t)) return;
+    
     if (t->getType() == task_type_basic_blocks ||
         t->getType() == task_type_create)
     {
@@ -305,33 +329,138 @@ unsigned long long getCurrentFreeMemory()
     return 0;
 }
 
-struct TaskWrapper
+//
+// Save the writer's state to ckpt, once every task queued so far is written.  The
+//   caller must not queue tasks until this returns.
+//
+void checkpointTaskWriter(Checkpoint& ckpt)
+{
+    pthread_mutex_lock(&taskQueueLock);
+    checkpointOut = &ckpt;
+    pthread_cond_signal(&taskQueueCond);
+    while (checkpointOut != NULL)
+    {
+        pthread_cond_wait(&checkpointCond, &taskQueueLock);
+    }
+    pthread_mutex_unlock(&taskQueueLock);
+}
+
+static void saveTaskWriter(Checkpoint& ckpt, FILE* out, TaskIndexGraph& graph, uint64 taskCount, uint64 taskWriteCount)
 {
-    TaskId      self;   // probably redundant in a map
-    int         p;      // number of predecessor tasks remaining
-    vector<TaskId> s;   // tasks that follow this task
-    ct_tsc_t    start;  // start time for this task
-    long        writePos; // where was the task written
-    task_type   t;
-};
+    // The taskgraph must hold every task written so far, or resuming would lose them
+    long pos = -1;
+    if (fflush(out) == 0 && ferror(out) == 0) pos = ftell(out);
+    if (pos < 0)
+    {
+        fprintf(stderr, "ERROR: Failed writing the taskgraph before its checkpoint\n");
+        exit(1);
+    }
+    
+    ckpt.write(pos);
+    ckpt.write(taskCount);
+    ckpt.write(taskWriteCount);
+    ckpt.write(roiStart);
+    ckpt.write(roiEnd);
+    graph.save(ckpt);
+}
 
-void findPredInTaskMap(map<TaskId, TaskWrapper> &writeTaskMap, int c, int s)
+//
+// Restore the writer's state from ckpt before the writer starts, discarding anything
+//   written to out after the checkpoint
+//
+void resumeTaskWriter(Checkpoint& ckpt, FILE* out)
 {
-    TaskId tid = TaskId(c, s);
+    long pos;
+    
+    ckpt.read(pos);
+    ckpt.read(resumedTaskCount);
+    ckpt.read(resumedTaskWriteCount);
+    ckpt.read(roiStart);
+    ckpt.read(roiEnd);
+    resumedGraph = new TaskIndexGraph(taskIndexBudget);
+    resumedGraph->load(ckpt);
     
-    for (auto it = writeTaskMap.begin(), et = writeTaskMap.end(); it != et; ++it)
+    if (ftruncate(fileno(out), pos) != 0 || fseek(out, pos, SEEK_SET) != 0)
     {
-        for (TaskId succ : it->second.s)
+        fprintf(stderr, "ERROR: Unable to return the taskgraph to its checkpoint\n");
+        exit(1);
+    }
+}
+
+//
+// With taskWriteThreads, tasks are serialized and compressed by a pool of workers,
+//   while the background thread writes the finished records in queue order and
+//   assigns their file offsets.  The output is identical to the serial writer.
+//
+unsigned int taskWriteThreads = 0;
+
+// Records encoded but not yet written, per worker, before the writer waits
+#define TASK_RECORDS_PER_THREAD 4
+
+typedef struct _task_record
+{
+    Task* t;
+    uint32_t n;         // Number of the task in the index graph
+    vector<uint8_t> bytes;
+    size_t recordSize;
+    bool done;
+} task_record, *ptask_record;
+
+static pthread_mutex_t taskRecordLock;
+static pthread_cond_t taskRecordWorkCond;
+static pthread_cond_t taskRecordDoneCond;
+static deque<ptask_record> taskRecordWork;
+static bool taskRecordStop = false;
+
+static void* taskRecordWorker(void* v)
+{
+    pthread_mutex_lock(&taskRecordLock);
+    while (true)
+    {
+        while (taskRecordWork.empty() && !taskRecordStop)
         {
-            if (succ == tid)
-            {
-                printf("Found in %u:%u that is at %u\n", (uint32_t)it->first.getContextId(),
-                                                         (uint32_t)it->first.getSeqId(),
-                                                         it->second.p);
-                return;
-            }
+            pthread_cond_wait(&taskRecordWorkCond, &taskRecordLock);
         }
+        if (taskRecordWork.empty()) break;
+        
+        ptask_record r = taskRecordWork.front();
+        taskRecordWork.pop_front();
+        pthread_mutex_unlock(&taskRecordLock);
+        
+        r->recordSize = Task::encodeContechTask(*r->t, r->bytes);
+        delete r->t;
+        r->t = NULL;
+        
+        pthread_mutex_lock(&taskRecordLock);
+        r->done = true;
+        pthread_cond_signal(&taskRecordDoneCond);
     }
+    pthread_mutex_unlock(&taskRecordLock);
+    
+    return NULL;
+}
+
+//
+// Write the oldest encoded record, waiting for its worker if needed
+//
+static uint64 writeTaskRecord(deque<ptask_record>& pending, TaskIndexGraph& graph, FILE* out)
+{
+    ptask_record r = pending.front();
+    pending.pop_front();
+    
+    pthread_mutex_lock(&taskRecordLock);
+    while (!r->done)
+    {
+        pthread_cond_wait(&taskRecordDoneCond, &taskRecordLock);
+    }
+    pthread_mutex_unlock(&taskRecordLock);
+    
+    graph.setWritePos(r->n, ftell(out));
+    ct_write(r->bytes.data(), r->bytes.size(), out);
+    
+    uint64 recordSize = r->recordSize;
+    delete r;
+    return recordSize;
 }
 
 void* backgroundTaskWriter(void* v)
@@ -339,14 +468,26 @@ void* backgroundTaskWriter(void* v)
     FILE* out = *(FILE**)v;
 
     deque<Task*> writeTaskQueue;
-    map<TaskId, TaskWrapper> writeTaskMap;
-    uint64 taskCount = 0, taskWriteCount = 0;
+    TaskIndexGraph* graph = (resumedGraph != NULL) ? resumedGraph : new TaskIndexGraph(taskIndexBudget);
+    TaskIndexGraph& writeGraph = *graph;
+    uint64 taskCount = resumedTaskCount, taskWriteCount = resumedTaskWriteCount;
     
     uint64 bytesWritten = ftell(out);
     long pos;
     bool firstTime = true;
     unsigned int sec = 0, msec = 0, taskLastWriteCount = 0;
     
+    deque<ptask_record> pendingRecords;
+    vector<pthread_t> recordThreads(taskWriteThreads);
+    pthread_mutex_init(&taskRecordLock, NULL);
+    pthread_cond_init(&taskRecordWorkCond, NULL);
+    pthread_cond_init(&taskRecordDoneCond, NULL);
+    for (unsigned int i = 0; i < taskWriteThreads; i++)
+    {
+        int r = pthread_create(&recordThreads[i], NULL, taskRecordWorker, NULL);
+        assert(r == 0);
+    }
+    
     //
     // noMoreTasks is a flag from the foreground thread
     //   And if there are no more, then there is the worklist of ready tasks
@@ -362,7 +503,7 @@ void* backgroundTaskWriter(void* v)
         // Get tasks from the foreground
         //
         pthread_mutex_lock(&taskQueueLock);
-        while (!noMoreTasks && taskQueue->empty())
+        while (!noMoreTasks && taskQueue->empty() && checkpointOut == NULL)
         {
             pthread_cond_wait(&taskQueueCond, &taskQueueLock);
         }
@@ -395,12 +536,12 @@ void* backgroundTaskWriter(void* v)
         while (!writeTaskQueue.empty())
         {
             Task* t = writeTaskQueue.front();
-            TaskId id = t->getTaskId();
             
             writeTaskQueue.pop_front();
             
             // Task will be null if it has already been handled
             assert(t != NULL);
+            if (taskSpill != NULL) taskSpill->restore(t);
             // Write out the task
             pos = ftell(out);
             
@@ -408,16 +549,29 @@ void* backgroundTaskWriter(void* v)
             //   determine the bfs order, this way tasks can be written out
             //   immediately
             {
-                TaskWrapper tw;
+                uint32_t n = writeGraph.addTask(t);
+                writeGraph.setWritePos(n, pos);
                 
-                tw.self = id;
-                tw.start = t->getStartTime();
-                tw.p = t->getPredecessorTasks().size();
-                tw.s = t->getSuccessorTasks();
-                tw.t = t->getType();
-                tw.writePos = pos;
-                assert(writeTaskMap.find(id) == writeTaskMap.end());
-                writeTaskMap[id] = tw;
+                if (taskWriteThreads > 0)
+                {
+                    ptask_record r = new task_record;
+                    r->t = t;
+                    r->n = n;
+                    r->done = false;
+                    
+                    pthread_mutex_lock(&taskRecordLock);
+                    taskRecordWork.push_back(r);
+                    pthread_cond_signal(&taskRecordWorkCond);
+                    pthread_mutex_unlock(&taskRecordLock);
+                    
+                    pendingRecords.push_back(r);
+                    while (pendingRecords.size() > TASK_RECORDS_PER_THREAD * taskWriteThreads)
+                    {
+                        bytesWritten += writeTaskRecord(pendingRecords, writeGraph, out);
+                    }
+                    taskWriteCount += 1;
+                    continue;
+                }
                 
                 /* Debugging code for bug where TaskId(x:0) had multiple predecessors
                 if (id.getSeqId() == 0)
@@ -440,6 +594,34 @@ void* backgroundTaskWriter(void* v)
             delete t;
         }
         taskLastWriteCount = taskWriteCount;
+        
+        // A checkpoint waits for every task queued before it to be written
+        pthread_mutex_lock(&taskQueueLock);
+        if (checkpointOut != NULL && taskQueue != NULL && taskQueue->empty())
+        {
+            while (!pendingRecords.empty())
+            {
+                bytesWritten += writeTaskRecord(pendingRecords, writeGraph, out);
+            }
+            saveTaskWriter(*checkpointOut, out, writeGraph, taskCount, taskWriteCount);
+            checkpointOut = NULL;
+            pthread_cond_broadcast(&checkpointCond);
+        }
+        pthread_mutex_unlock(&taskQueueLock);
+    }
+    
+    // Every record must be written before the index
+    while (!pendingRecords.empty())
+    {
+        bytesWritten += writeTaskRecord(pendingRecords, writeGraph, out);
+    }
+    pthread_mutex_lock(&taskRecordLock);
+    taskRecordStop = true;
+    pthread_cond_broadcast(&taskRecordWorkCond);
+    pthread_mutex_unlock(&taskRecordLock);
+    for (unsigned int i = 0; i < taskWriteThreads; i++)
+    {
+        pthread_join(recordThreads[i], NULL);
     }
     
     // Write how many entries are in the index
@@ -458,73 +640,13 @@ void* backgroundTaskWriter(void* v)
     printf("Writing index for %lu at %ld\n", taskWriteCount, pos);
     size_t t = ct_write(&taskWriteCount, sizeof(taskWriteCount), out);
     
-    priority_queue<pair<ct_tsc_t, pair<TaskId, uint64> >, vector<pair<ct_tsc_t, pair<TaskId, uint64> > >, first_compare > taskSort;
-    
-    {
-        TaskWrapper tw = writeTaskMap.find(0)->second;
-        taskSort.push(make_pair(tw.start, make_pair(tw.self, tw.writePos)));
-    }
-    
-    //
-    // This reproduces the BFS algorithm that had been used for writing tasks
-    //   It is much faster to sort the tasks on just the graph information than
-    //   to indefinitely delay writing a task until the entire graph is available.
-    //
-    // taskSort is a priority queue, the top element is the oldest task that has all
-    //   its prior tasks in the index.
-    //
-    unsigned int indexWriteCount = 0;
     TaskId lastTid = 0;
-    while (!taskSort.empty())
-    {
-        TaskId tid = taskSort.top().second.first;
-        uint64 offset = taskSort.top().second.second;
-        
-        lastTid = tid;
-        
-        ct_write(&tid, sizeof(TaskId), out);
-        ct_write(&offset, sizeof(uint64), out);
-        //printf("%d:%d @ %llx\t", tid.getContextId(), tid.getSeqId(), offset);
-        
-        taskSort.pop();
-        
-        auto twit = writeTaskMap.find(tid);
-        assert(twit != writeTaskMap.end());
-        TaskWrapper tw = twit->second;
-        
-        assert(twit->first == tw.self);
-        
-        for (TaskId succ : tw.s)
-        {
-            TaskWrapper &suTW = writeTaskMap.find(succ)->second;
-            
-            //printf("%d:%d (%d)\t", succ.getContextId(), succ.getSeqId(), suTW.p);
-            
-            suTW.p--;
-            if (suTW.p == 0)
-            {
-                taskSort.push(make_pair(suTW.start, make_pair(suTW.self, suTW.writePos)));
-            }
-        }
-        //printf("\n");
-        
-        //  Can erase tid, but we don't need the memory, will it speed up?
-        writeTaskMap.erase(twit);
-        indexWriteCount ++;
-    }
-    printf("Wrote %u tasks to index\n", indexWriteCount);
+    uint64 indexWriteCount = writeGraph.writeIndex(out, &lastTid);
+    printf("Wrote %lu tasks to index\n", indexWriteCount);
     
     if (indexWriteCount != taskWriteCount)
     {
-        for (auto it = writeTaskMap.begin(), et = writeTaskMap.end(); it != et; ++it)
-        {
-            printf("%s (type:%d) (pred:%d)\t", it->first.toString().c_str(), it->second.t, it->second.p);
-            for (TaskId succ : it->second.s)
-            {
-                printf("%s\t", succ.toString().c_str());
-            }
-            printf("\n");
-        }
+        writeGraph.printUnwritten();
     }
     
     // Failing this assert indicates that the graph either has cycles or is disjoint
@@ -555,6 +677,7 @@ void* backgroundTaskWriter(void* v)
     if (taskQueue != NULL)
         printf("Tasks Left: %ld\n", taskQueue->size());
     printf("Tasks Remaining: %lu\n", writeTaskQueue.size());
-        
+    
+    delete graph;
     return NULL;
 }
@@ -3,6 +3,9 @@
 
 #include "../common/taskLib/Task.hpp"
 #include "Context.hpp"
+#include "Checkpoint.hpp"
+#include "BlockPipeline.hpp"
+#include "TaskSpill.hpp"
 #include "pthread.h"
 #include <deque>
 
@@ -10,10 +13,19 @@ extern bool noMoreTasks;
 extern pthread_mutex_t taskQueueLock;
 extern pthread_cond_t taskQueueCond;
 extern std::deque<contech::Task*>* taskQueue;
+extern contech::BlockPipeline* blockPipeline;
+extern contech::TaskSpill* taskSpill;
+extern unsigned int taskWriteThreads;
+extern uint64_t taskIndexBudget;
 
 void updateContextTaskList(contech::Context &c);
 void attemptBackgroundQueueTask(contech::Task* t, contech::Context &c);
 void backgroundQueueTask(contech::Task* t);
+void backgroundQueueTaskNow(contech::Task* t);
+
+// Save the writer's state to a checkpoint, or restore it before the writer starts
+void checkpointTaskWriter(contech::Checkpoint& ckpt);
+void resumeTaskWriter(contech::Checkpoint& ckpt, FILE* out);
 
 void setROIStart(contech::TaskId);
 void setROIEnd(contech::TaskId);